@@ -44,7 +44,8 @@ libbcinfo_STATIC_LIBRARIES := \
   libLLVMCore \
   libLLVMSupport \
   libLLVMBitReader_2_7 \
-  libLLVMBitReader_3_0
+  libLLVMBitReader_3_0 \
+  libmincrypt
 
 LLVM_ROOT_PATH := external/llvm
 
@@ -23,6 +23,7 @@
 
 #define LOG_TAG "bcinfo"
 #include <cutils/log.h>
+#include <mincrypt/sha.h>
 
 #include "llvm/ADT/OwningPtr.h"
 #include "llvm/Bitcode/BitstreamWriter.h"
@@ -30,9 +31,17 @@
 #include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
 #include "llvm/Support/MemoryBuffer.h"
-#include "llvm/Support/raw_ostream.h"
 
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace bcinfo {
 
@@ -64,20 +73,79 @@ static const unsigned int kMinimumUntranslatedVersion = 16;
 static const unsigned int kMinimumCompatibleVersion_LLVM_3_0 = 14;
 static const unsigned int kMinimumCompatibleVersion_LLVM_2_7 = 11;
 
+/**
+ * Version of the translation. Bump it whenever the translated bitcode of the
+ * same input changes (e.g. the legacy readers or the bitcode writer is
+ * updated) to invalidate the cache files.
+ */
+static const uint32_t kTranslatorVersion = 1;
+
+/**
+ * Layout of a cache file: the header followed by the translated bitcode
+ * (including its wrapper).
+ */
+#define TRANSLATION_CACHE_MAGIC "\0bctc\n\0"
+
+struct __attribute__((packed)) TranslationCacheHeader {
+  uint8_t magic[8];
+  uint32_t translatorVersion;
+  uint32_t apiVersion;
+  uint8_t bitcodeSHA1[SHA_DIGEST_SIZE];
+  uint32_t translatedBitcodeSize;
+};
+
+/**
+ * The same bitcode translates differently for different API levels, so the
+ * API level is part of the file name: {cacheDir}/{SHA-1 of bitcode}-{API}.bct
+ */
+static std::string getCachePath(const std::string &cacheDir,
+                                const unsigned char *bitcodeSHA1,
+                                unsigned int apiVersion) {
+  std::string path(cacheDir);
+  path.append("/");
+  for (int i = 0; i < SHA_DIGEST_SIZE; i++) {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", bitcodeSHA1[i]);
+    path.append(hex);
+  }
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "-%u.bct", apiVersion);
+  path.append(suffix);
+  return path;
+}
+
+static bool writeFully(int fd, const void *buf, size_t size) {
+  const char *p = static_cast<const char *>(buf);
+  while (size > 0) {
+    ssize_t written = write(fd, p, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += written;
+    size -= written;
+  }
+  return true;
+}
+
 
 BitcodeTranslator::BitcodeTranslator(const char *bitcode, size_t bitcodeSize,
                                      unsigned int version)
     : mBitcode(bitcode), mBitcodeSize(bitcodeSize), mTranslatedBitcode(NULL),
-      mTranslatedBitcodeSize(0), mVersion(version) {
+      mTranslatedBitcodeSize(0), mVersion(version), mCacheMapAddr(NULL),
+      mCacheMapSize(0) {
   return;
 }
 
 
 BitcodeTranslator::~BitcodeTranslator() {
-  if (mVersion < kMinimumUntranslatedVersion) {
-    // We didn't actually do a translation in the alternate case, so deleting
-    // the bitcode would be improper.
-    delete [] mTranslatedBitcode;
+  // The translated bitcode is either in the cache file mapping or in
+  // mTranslatedBuffer (unless no translation was needed, in which case it's
+  // the input bitcode.)
+  if (mCacheMapAddr) {
+    munmap(mCacheMapAddr, mCacheMapSize);
   }
   mTranslatedBitcode = NULL;
   return;
@@ -112,6 +180,17 @@ bool BitcodeTranslator::translate() {
     return true;
   }
 
+  // Reuse the result of the previous translation of the same bitcode.
+  unsigned char bitcodeSHA1[SHA_DIGEST_SIZE];
+  std::string cachePath;
+  if (!mCacheDir.empty()) {
+    SHA_hash(mBitcode, mBitcodeSize, bitcodeSHA1);
+    cachePath = getCachePath(mCacheDir, bitcodeSHA1, mVersion);
+    if (loadFromCache(cachePath, bitcodeSHA1)) {
+      return true;
+    }
+  }
+
   // Do the actual transcoding by invoking a 2.7-era bitcode reader that can
   // then write the bitcode back out in a more modern (acceptable) version.
   llvm::OwningPtr<llvm::LLVMContext> mContext(new llvm::LLVMContext());
@@ -138,30 +217,124 @@ bool BitcodeTranslator::translate() {
     return false;
   }
 
-  std::string Buffer;
+  // Write the bitcode straight into the output buffer after the space
+  // reserved for the wrapper, which is filled in once the size of the bitcode
+  // is known. The translated bitcode is about as large as the input, so
+  // reserve that much up front rather than letting the buffer grow (and be
+  // copied) repeatedly.
+  mTranslatedBuffer.clear();
+  mTranslatedBuffer.reserve(sizeof(AndroidBitcodeWrapper) + mBitcodeSize);
+  mTranslatedBuffer.resize(sizeof(AndroidBitcodeWrapper));
+  {
+    llvm::BitstreamWriter Stream(mTranslatedBuffer);
+    llvm::WriteBitcodeToStream(module, Stream);
+  }
 
-  llvm::raw_string_ostream OS(Buffer);
-  llvm::WriteBitcodeToFile(module, OS);
-  OS.flush();
+  // The legacy module is no longer needed. Release it before going on.
+  mContext.reset();
 
   AndroidBitcodeWrapper wrapper;
   size_t actualWrapperLen = writeAndroidBitcodeWrapper(
-      &wrapper, Buffer.size(), BCWrapper.getTargetAPI(),
-      BCWrapper.getCompilerVersion(), BCWrapper.getOptimizationLevel());
-  if (!actualWrapperLen) {
+      &wrapper, mTranslatedBuffer.size() - sizeof(AndroidBitcodeWrapper),
+      BCWrapper.getTargetAPI(), BCWrapper.getCompilerVersion(),
+      BCWrapper.getOptimizationLevel());
+  if (actualWrapperLen != sizeof(AndroidBitcodeWrapper)) {
     ALOGE("Couldn't produce bitcode wrapper!");
+    mTranslatedBuffer.clear();
     return false;
   }
+  memcpy(&mTranslatedBuffer[0], &wrapper, actualWrapperLen);
 
-  mTranslatedBitcodeSize = actualWrapperLen + Buffer.size();
-  char *c = new char[mTranslatedBitcodeSize];
-  memcpy(c, &wrapper, actualWrapperLen);
-  memcpy(c + actualWrapperLen, Buffer.c_str(), Buffer.size());
+  mTranslatedBitcodeSize = mTranslatedBuffer.size();
+  mTranslatedBitcode = reinterpret_cast<const char *>(&mTranslatedBuffer[0]);
 
-  mTranslatedBitcode = c;
+  if (!cachePath.empty()) {
+    saveToCache(cachePath, bitcodeSHA1);
+  }
 
   return true;
 }
 
+
+bool BitcodeTranslator::loadFromCache(const std::string &cachePath,
+                                      const unsigned char *bitcodeSHA1) {
+  int fd = open(cachePath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if ((fstat(fd, &st) != 0) ||
+      (static_cast<size_t>(st.st_size) <= sizeof(TranslationCacheHeader))) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    ALOGW("Could not map translated bitcode cache %s (%s)", cachePath.c_str(),
+          strerror(errno));
+    return false;
+  }
+
+  const TranslationCacheHeader *header =
+      static_cast<const TranslationCacheHeader *>(addr);
+  if ((memcmp(header->magic, TRANSLATION_CACHE_MAGIC,
+              sizeof(header->magic)) != 0) ||
+      (header->translatorVersion != kTranslatorVersion) ||
+      (header->apiVersion != mVersion) ||
+      (memcmp(header->bitcodeSHA1, bitcodeSHA1, SHA_DIGEST_SIZE) != 0) ||
+      (header->translatedBitcodeSize !=
+       (size - sizeof(TranslationCacheHeader)))) {
+    ALOGV("Ignoring stale translated bitcode cache %s", cachePath.c_str());
+    munmap(addr, size);
+    return false;
+  }
+
+  mCacheMapAddr = addr;
+  mCacheMapSize = size;
+  mTranslatedBitcode =
+      static_cast<const char *>(addr) + sizeof(TranslationCacheHeader);
+  mTranslatedBitcodeSize = header->translatedBitcodeSize;
+  return true;
+}
+
+
+void BitcodeTranslator::saveToCache(const std::string &cachePath,
+                                    const unsigned char *bitcodeSHA1) const {
+  TranslationCacheHeader header;
+  memcpy(header.magic, TRANSLATION_CACHE_MAGIC, sizeof(header.magic));
+  header.translatorVersion = kTranslatorVersion;
+  header.apiVersion = mVersion;
+  memcpy(header.bitcodeSHA1, bitcodeSHA1, SHA_DIGEST_SIZE);
+  header.translatedBitcodeSize = mTranslatedBitcodeSize;
+
+  // Write to a temporary file and rename it so that the other processes
+  // never see a partial cache file.
+  char pid[16];
+  snprintf(pid, sizeof(pid), ".%d.tmp", getpid());
+  std::string tmpPath(cachePath + pid);
+
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    ALOGW("Could not create translated bitcode cache %s (%s)",
+          tmpPath.c_str(), strerror(errno));
+    return;
+  }
+
+  bool success = writeFully(fd, &header, sizeof(header)) &&
+                 writeFully(fd, mTranslatedBitcode, mTranslatedBitcodeSize);
+  success = (close(fd) == 0) && success;
+
+  if (!success || (rename(tmpPath.c_str(), cachePath.c_str()) != 0)) {
+    ALOGW("Could not write translated bitcode cache %s (%s)",
+          cachePath.c_str(), strerror(errno));
+    unlink(tmpPath.c_str());
+  }
+  return;
+}
+
 }  // namespace bcinfo
 
@@ -414,13 +414,18 @@ bool MetadataExtractor::extract() {
         llvm::StringRef(mBitcode, mBitcodeSize), "", false));
     std::string error;
 
-    // Module ownership is handled by the context, so we don't need to free it.
-    mModule = llvm::ParseBitcodeFile(MEM.get(), *mContext, &error);
+    // Only the named metadata is needed, so load the module lazily to skip
+    // deserializing the function bodies. Module ownership is handled by the
+    // context, so we don't need to free it.
+    mModule = llvm::getLazyBitcodeModule(MEM.get(), *mContext, &error);
     if (!mModule) {
       ALOGE("Could not parse bitcode file");
       ALOGE("%s", error.c_str());
       return false;
     }
+
+    // The module now owns the buffer.
+    MEM.take();
   }
 
   const llvm::NamedMDNode *ExportVarMetadata =
@@ -41,8 +41,39 @@ LOCAL_CFLAGS += -D__HOST__
 LOCAL_C_INCLUDES := \
   $(LOCAL_PATH)/../../include
 
-LOCAL_LDLIBS = -ldl
+LOCAL_LDLIBS = -ldl -lpthread
 
 include $(LLVM_ROOT_PATH)/llvm-host-build.mk
 include $(BUILD_HOST_EXECUTABLE)
 
+
+# Benchmark of the bitcode readers for host
+# ========================================================
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := bcinfo_bench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := \
+  bench.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+  libbcinfo
+
+LOCAL_STATIC_LIBRARIES := \
+  libLLVMBitReader_2_7 \
+  libLLVMBitReader_3_0 \
+  libLLVMBitReader \
+  libLLVMCore \
+  libLLVMSupport
+
+LOCAL_CFLAGS += -D__HOST__
+
+LOCAL_C_INCLUDES := \
+  $(LOCAL_PATH)/.. \
+  $(LOCAL_PATH)/../../include
+
+LOCAL_LDLIBS = -ldl -lpthread
+
+include $(LLVM_ROOT_PATH)/llvm-host-build.mk
+include $(BUILD_HOST_EXECUTABLE)
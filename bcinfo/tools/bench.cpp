@@ -0,0 +1,425 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <bcinfo/BitcodeTranslator.h>
+#include <bcinfo/BitcodeWrapper.h>
+#include <bcinfo/MetadataExtractor.h>
+
+#include "BitReader_2_7/BitReader_2_7.h"
+#include "BitReader_3_0/BitReader_3_0.h"
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/Module.h>
+#include <llvm/Support/ManagedStatic.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+// This file corresponds to the bcinfo_bench tool. It measures the bitcode
+// readers in the tree (BitReader_2_7, BitReader_3_0 and LLVM's own reader,
+// each eager and lazy), the wrapper parsing, the metadata extraction and the
+// translation over a corpus of bitcode files given on the command line.
+//
+// For each benchmark it reports the throughput in MB/s, the number of
+// operator new calls per file and the heap in use while the result (e.g. the
+// module) is alive. Files a benchmark doesn't apply to are counted as skipped
+// and left out of its numbers. The max RSS of the process is reported at the
+// end.
+
+extern char *optarg;
+extern int opterr;
+extern int optind;
+
+unsigned iterations = 5;
+std::string onlyBenchmark;
+
+//===----------------------------------------------------------------------===//
+// Allocation counting
+//===----------------------------------------------------------------------===//
+// The benchmark is single-threaded, so a plain counter is enough.
+static unsigned long numAllocations = 0;
+
+void *operator new(size_t size) throw(std::bad_alloc) {
+  numAllocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    // Built without exceptions.
+    fprintf(stderr, "Out of memory\n");
+    abort();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) throw(std::bad_alloc) {
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) throw() {
+  numAllocations++;
+  return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) throw() {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) throw() {
+  free(p);
+}
+
+void operator delete[](void *p) throw() {
+  free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) throw() {
+  free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) throw() {
+  free(p);
+}
+
+// Heap in use, including the memory LLVM gets from malloc directly (e.g. the
+// slabs of its bump pointer allocators.)
+static size_t getHeapInUse() {
+  struct mallinfo info = mallinfo();
+  return info.uordblks + info.hblkhd;
+}
+
+static double getTimeMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+//===----------------------------------------------------------------------===//
+// Corpus
+//===----------------------------------------------------------------------===//
+struct BitcodeFile {
+  std::string path;
+  std::vector<char> data;
+  unsigned int targetAPI;
+};
+
+std::vector<BitcodeFile> corpus;
+
+static bool loadFile(const char *path) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    fprintf(stderr, "Could not open input file %s: %s\n", path,
+            strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fileno(in), &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size) {
+    fprintf(stderr, "Input file %s should be a non-empty regular file.\n",
+            path);
+    fclose(in);
+    return false;
+  }
+
+  BitcodeFile file;
+  file.path = path;
+  file.data.resize(st.st_size);
+  size_t nread = fread(&file.data[0], 1, file.data.size(), in);
+  fclose(in);
+  if (nread != file.data.size()) {
+    fprintf(stderr, "Could not read all of file %s\n", path);
+    return false;
+  }
+
+  bcinfo::BitcodeWrapper wrapper(&file.data[0], file.data.size());
+  file.targetAPI = (wrapper.getBCFileType() == bcinfo::BC_WRAPPER) ?
+                   wrapper.getTargetAPI() : 0;
+
+  corpus.push_back(file);
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Benchmarks
+//===----------------------------------------------------------------------===//
+enum Reader {
+  kReader_2_7,
+  kReader_3_0,
+  kReaderCurrent
+};
+
+// The reader that can read the bitcode of targetAPI. Bitcode without the
+// wrapper is assumed to be current.
+static Reader getReader(unsigned int targetAPI) {
+  if (targetAPI == 0 || targetAPI >= 16) {
+    return kReaderCurrent;
+  } else if (targetAPI >= 14) {
+    return kReader_3_0;
+  }
+  return kReader_2_7;
+}
+
+enum BenchResult {
+  kBenchDone,
+  kBenchFailed,
+  // The benchmark doesn't apply to the file (e.g. MetadataExtractor and legacy
+  // bitcode.) It's left out of the throughput and the allocation counts.
+  kBenchSkipped
+};
+
+static BenchResult toBenchResult(bool success) {
+  return success ? kBenchDone : kBenchFailed;
+}
+
+// Run one iteration of a benchmark over file. heapInUse is set to the heap in
+// use while the result is alive.
+typedef BenchResult (*BenchmarkFunc)(const BitcodeFile &file,
+                                     size_t &heapInUse);
+
+static BenchResult benchWrapper(const BitcodeFile &file, size_t &heapInUse) {
+  size_t base = getHeapInUse();
+  bcinfo::BitcodeWrapper wrapper(&file.data[0], file.data.size());
+  heapInUse = getHeapInUse() - base;
+  return toBenchResult(wrapper.getBCFileType() != bcinfo::BC_NOT_BC);
+}
+
+static bool parseWith(Reader reader, bool lazy, const BitcodeFile &file,
+                      size_t &heapInUse) {
+  size_t base = getHeapInUse();
+
+  llvm::LLVMContext ctx;
+  llvm::MemoryBuffer *mem = llvm::MemoryBuffer::getMemBuffer(
+      llvm::StringRef(&file.data[0], file.data.size()), file.path, false);
+  std::string error;
+  llvm::Module *module = NULL;
+
+  switch (reader) {
+    case kReader_2_7:
+      module = lazy ? llvm_2_7::getLazyBitcodeModule(mem, ctx, &error) :
+                      llvm_2_7::ParseBitcodeFile(mem, ctx, &error);
+      break;
+    case kReader_3_0:
+      module = lazy ? llvm_3_0::getLazyBitcodeModule(mem, ctx, &error) :
+                      llvm_3_0::ParseBitcodeFile(mem, ctx, &error);
+      break;
+    case kReaderCurrent:
+      module = lazy ? llvm::getLazyBitcodeModule(mem, ctx, &error) :
+                      llvm::ParseBitcodeFile(mem, ctx, &error);
+      break;
+  }
+
+  heapInUse = getHeapInUse() - base;
+
+  if (!module) {
+    fprintf(stderr, "Could not parse %s: %s\n", file.path.c_str(),
+            error.c_str());
+    delete mem;
+    return false;
+  }
+
+  // The lazily loaded module owns the buffer. The context deletes the module.
+  if (!lazy) {
+    delete mem;
+  }
+  return true;
+}
+
+static BenchResult benchEager(const BitcodeFile &file, size_t &heapInUse) {
+  return toBenchResult(parseWith(getReader(file.targetAPI), false, file,
+                                 heapInUse));
+}
+
+static BenchResult benchLazy(const BitcodeFile &file, size_t &heapInUse) {
+  return toBenchResult(parseWith(getReader(file.targetAPI), true, file,
+                                 heapInUse));
+}
+
+static BenchResult benchMetadata(const BitcodeFile &file, size_t &heapInUse) {
+  // MetadataExtractor only reads current bitcode.
+  if (getReader(file.targetAPI) != kReaderCurrent) {
+    return kBenchSkipped;
+  }
+
+  size_t base = getHeapInUse();
+  bcinfo::MetadataExtractor ME(&file.data[0], file.data.size());
+  bool result = ME.extract();
+  heapInUse = getHeapInUse() - base;
+  return toBenchResult(result);
+}
+
+static BenchResult benchTranslate(const BitcodeFile &file,
+                                  size_t &heapInUse) {
+  size_t base = getHeapInUse();
+  bcinfo::BitcodeTranslator BT(&file.data[0], file.data.size(),
+                               file.targetAPI ? file.targetAPI : 10000);
+  bool result = BT.translate();
+  heapInUse = getHeapInUse() - base;
+  return toBenchResult(result);
+}
+
+struct Benchmark {
+  const char *name;
+  const char *description;
+  BenchmarkFunc func;
+};
+
+static const Benchmark benchmarks[] = {
+  { "wrapper", "BitcodeWrapper parsing", benchWrapper },
+  { "eager", "ParseBitcodeFile() of the matching reader", benchEager },
+  { "lazy", "getLazyBitcodeModule() of the matching reader", benchLazy },
+  { "metadata", "MetadataExtractor::extract()", benchMetadata },
+  { "translate", "BitcodeTranslator::translate()", benchTranslate },
+};
+
+static void runBenchmark(const Benchmark &bench) {
+  size_t totalBytes = 0;
+  unsigned failures = 0;
+  unsigned skipped = 0;
+  size_t maxHeapInUse = 0;
+  size_t runs = 0;
+  unsigned long allocations = 0;
+  double elapsedMs = 0;
+
+  // Only the files the benchmark ran over count, so time each run.
+  for (unsigned i = 0; i < iterations; i++) {
+    for (size_t j = 0; j < corpus.size(); j++) {
+      size_t heapInUse = 0;
+      unsigned long allocationsBefore = numAllocations;
+      double start = getTimeMs();
+
+      BenchResult result = bench.func(corpus[j], heapInUse);
+
+      double runMs = getTimeMs() - start;
+      if (result == kBenchSkipped) {
+        skipped++;
+        continue;
+      }
+
+      elapsedMs += runMs;
+      allocations += numAllocations - allocationsBefore;
+      runs++;
+
+      if (result == kBenchFailed) {
+        failures++;
+        continue;
+      }
+      totalBytes += corpus[j].data.size();
+      if (heapInUse > maxHeapInUse) {
+        maxHeapInUse = heapInUse;
+      }
+    }
+  }
+
+  printf("%-10s %10.3f %10.2f %12.1f %12zu %8u %8u  %s\n", bench.name,
+         elapsedMs / iterations,
+         (elapsedMs > 0) ? (totalBytes / (1024.0 * 1024.0)) /
+                           (elapsedMs / 1000.0) : 0.0,
+         runs ? static_cast<double>(allocations) / runs : 0.0,
+         maxHeapInUse / 1024, failures, skipped / iterations,
+         bench.description);
+  return;
+}
+
+static int parseOption(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "n:b:")) != -1) {
+    opterr = 0;
+
+    switch(c) {
+      case 'n':
+        iterations = atoi(optarg);
+        if (!iterations) {
+          iterations = 1;
+        }
+        break;
+
+      case 'b':
+        onlyBenchmark = optarg;
+        break;
+
+      default:
+        fprintf(stderr, "usage: bcinfo_bench [-n iterations] [-b benchmark] "
+                        "bitcode_file(s)...\n");
+        return 0;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "input files required\n");
+    return 0;
+  }
+
+  for (int i = optind; i < argc; i++) {
+    if (!loadFile(argv[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+int main(int argc, char** argv) {
+  llvm::llvm_shutdown_obj called_on_exit;
+
+  if (!parseOption(argc, argv)) {
+    return 1;
+  }
+
+  size_t corpusSize = 0;
+  for (size_t i = 0; i < corpus.size(); i++) {
+    corpusSize += corpus[i].data.size();
+  }
+  printf("corpus: %zu files, %zu bytes, %u iterations\n\n", corpus.size(),
+         corpusSize, iterations);
+
+  printf("%-10s %10s %10s %12s %12s %8s %8s\n", "benchmark", "ms/iter",
+         "MB/s", "allocs/file", "heap KB", "failures", "skipped");
+
+  bool found = false;
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+    if (!onlyBenchmark.empty() && onlyBenchmark != benchmarks[i].name) {
+      continue;
+    }
+    found = true;
+    runBenchmark(benchmarks[i]);
+  }
+
+  if (!found) {
+    fprintf(stderr, "Unknown benchmark %s\n", onlyBenchmark.c_str());
+    return 1;
+  }
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    printf("\nmax RSS: %ld KB\n", usage.ru_maxrss);
+  }
+
+  return 0;
+}
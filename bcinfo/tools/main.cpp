@@ -26,6 +26,7 @@
 #include <llvm/Module.h>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/ToolOutputFile.h>
 
 #include <ctype.h>
@@ -38,8 +39,10 @@
 #include <getopt.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <unistd.h>
 
@@ -48,11 +51,20 @@
 
 // This file corresponds to the standalone bcinfo tool. It prints a variety of
 // information about a supplied bitcode input file.
+//
+// In batch mode (-b, or -m <manifest> to read the input files from a file
+// with one path per line), it processes many input files on -j <N> worker
+// threads and prints one JSON object per input file (one per line) instead.
+//
+// With -c <dir>, the translated bitcode is cached in <dir> and reused by later
+// runs on the same input files.
 
 std::string inFile;
 std::string outFile;
 std::string infoFile;
+std::string cacheDir;
 
+extern char *optarg;
 extern int opterr;
 extern int optind;
 
@@ -60,9 +72,35 @@ bool translateFlag = false;
 bool infoFlag = false;
 bool verbose = true;
 
+bool batchFlag = false;
+unsigned numWorkers = 0;
+std::vector<std::string> batchFiles;
+
+static bool readManifest(const char *manifest) {
+  FILE *in = fopen(manifest, "r");
+  if (!in) {
+    fprintf(stderr, "Could not open manifest %s\n", manifest);
+    return false;
+  }
+
+  char line[4096];
+  while (fgets(line, sizeof(line), in)) {
+    size_t len = strlen(line);
+    while (len > 0 && isspace(line[len - 1])) {
+      line[--len] = '\0';
+    }
+    if (len > 0) {
+      batchFiles.push_back(line);
+    }
+  }
+
+  fclose(in);
+  return true;
+}
+
 static int parseOption(int argc, char** argv) {
   int c;
-  while ((c = getopt(argc, argv, "itv")) != -1) {
+  while ((c = getopt(argc, argv, "itvbc:j:m:")) != -1) {
     opterr = 0;
 
     switch(c) {
@@ -70,6 +108,25 @@ static int parseOption(int argc, char** argv) {
         // ignore any error
         break;
 
+      case 'b':
+        batchFlag = true;
+        break;
+
+      case 'c':
+        cacheDir = optarg;
+        break;
+
+      case 'j':
+        numWorkers = atoi(optarg);
+        break;
+
+      case 'm':
+        batchFlag = true;
+        if (!readManifest(optarg)) {
+          return 0;
+        }
+        break;
+
       case 't':
         translateFlag = true;
         break;
@@ -91,6 +148,17 @@ static int parseOption(int argc, char** argv) {
     }
   }
 
+  if (batchFlag) {
+    for (int i = optind; i < argc; i++) {
+      batchFiles.push_back(argv[i]);
+    }
+    if (batchFiles.empty()) {
+      fprintf(stderr, "input files required\n");
+      return 0;
+    }
+    return 1;
+  }
+
   if(optind >= argc) {
     fprintf(stderr, "input file required\n");
     return 0;
@@ -216,14 +284,14 @@ static void dumpMetadata(bcinfo::MetadataExtractor *ME) {
 }
 
 
-static size_t readBitcode(const char **bitcode) {
-  if (!inFile.length()) {
+static size_t readBitcode(const std::string &file, const char **bitcode) {
+  if (!file.length()) {
     fprintf(stderr, "input file required\n");
     return 0;
   }
 
   struct stat statInFile;
-  if (stat(inFile.c_str(), &statInFile) < 0) {
+  if (stat(file.c_str(), &statInFile) < 0) {
     fprintf(stderr, "Unable to stat input file: %s\n", strerror(errno));
     return 0;
   }
@@ -233,9 +301,9 @@ static size_t readBitcode(const char **bitcode) {
     return 0;
   }
 
-  FILE *in = fopen(inFile.c_str(), "r");
+  FILE *in = fopen(file.c_str(), "r");
   if (!in) {
-    fprintf(stderr, "Could not open input file %s\n", inFile.c_str());
+    fprintf(stderr, "Could not open input file %s\n", file.c_str());
     return 0;
   }
 
@@ -245,7 +313,7 @@ static size_t readBitcode(const char **bitcode) {
   size_t nread = fread((void*) *bitcode, 1, bitcodeSize, in);
 
   if (nread != bitcodeSize)
-      fprintf(stderr, "Could not read all of file %s\n", inFile.c_str());
+      fprintf(stderr, "Could not read all of file %s\n", file.c_str());
 
   fclose(in);
   return nread;
@@ -261,14 +329,218 @@ static void releaseBitcode(const char **bitcode) {
 }
 
 
+static double getTimeMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+static void appendJSONString(std::string &out, const char *str) {
+  out += '"';
+  for (const char *p = str; *p; p++) {
+    unsigned char ch = *p;
+    if (ch == '"' || ch == '\\') {
+      out += '\\';
+      out += ch;
+    } else if (ch < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+      out += escaped;
+    } else {
+      out += ch;
+    }
+  }
+  out += '"';
+}
+
+
+static void appendJSONField(std::string &out, const char *key,
+                            const char *format, ...) {
+  char value[64];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(value, sizeof(value), format, ap);
+  va_end(ap);
+
+  out += ", ";
+  appendJSONString(out, key);
+  out += ": ";
+  out += value;
+}
+
+
+// Translate, extract the metadata from and parse one input file. Output the
+// result as a JSON object to json. Return false on error.
+static bool processBatchFile(const std::string &file, std::string &json) {
+  json = "{";
+  appendJSONString(json, "file");
+  json += ": ";
+  appendJSONString(json, file.c_str());
+
+  const char *error = NULL;
+  const char *bitcode = NULL;
+  size_t bitcodeSize = readBitcode(file, &bitcode);
+  appendJSONField(json, "size", "%zu", bitcodeSize);
+
+  do {
+    if (!bitcodeSize) {
+      error = "failed to read bitcode";
+      break;
+    }
+
+    unsigned int version = 0;
+    bcinfo::BitcodeWrapper bcWrapper(bitcode, bitcodeSize);
+    if (bcWrapper.getBCFileType() == bcinfo::BC_WRAPPER) {
+      version = bcWrapper.getTargetAPI();
+    } else if (translateFlag) {
+      version = 12;
+    }
+    appendJSONField(json, "targetAPI", "%u", version);
+    appendJSONField(json, "compilerVersion", "%u",
+                    bcWrapper.getCompilerVersion());
+    appendJSONField(json, "optimizationLevel", "%u",
+                    bcWrapper.getOptimizationLevel());
+
+    double start = getTimeMs();
+    bcinfo::BitcodeTranslator BT(bitcode, bitcodeSize, version);
+    BT.setCacheDir(cacheDir.c_str());
+    if (!BT.translate()) {
+      error = "failed to translate bitcode";
+      break;
+    }
+    appendJSONField(json, "translateMs", "%.3f", getTimeMs() - start);
+    appendJSONField(json, "translatedSize", "%zu",
+                    BT.getTranslatedBitcodeSize());
+
+    start = getTimeMs();
+    bcinfo::MetadataExtractor ME(BT.getTranslatedBitcode(),
+                                 BT.getTranslatedBitcodeSize());
+    if (!ME.extract()) {
+      error = "failed to get metadata";
+      break;
+    }
+    appendJSONField(json, "extractMs", "%.3f", getTimeMs() - start);
+    appendJSONField(json, "exportVarCount", "%u", ME.getExportVarCount());
+    appendJSONField(json, "exportFuncCount", "%u", ME.getExportFuncCount());
+    appendJSONField(json, "exportForEachCount", "%u",
+                    ME.getExportForEachSignatureCount());
+    appendJSONField(json, "pragmaCount", "%u", ME.getPragmaCount());
+    appendJSONField(json, "objectSlotCount", "%u", ME.getObjectSlotCount());
+    appendJSONField(json, "rsFloatPrecision", "%d",
+                    static_cast<int>(ME.getRSFloatPrecision()));
+
+    // Each worker parses in its own context.
+    start = getTimeMs();
+    llvm::LLVMContext ctx;
+    llvm::OwningPtr<llvm::MemoryBuffer> mem(llvm::MemoryBuffer::getMemBuffer(
+        llvm::StringRef(BT.getTranslatedBitcode(),
+                        BT.getTranslatedBitcodeSize()),
+        file.c_str(), false));
+    std::string errmsg;
+    llvm::OwningPtr<llvm::Module> module(
+        llvm::ParseBitcodeFile(mem.get(), ctx, &errmsg));
+    if (module.get() == 0) {
+      error = "failed to parse bitcode";
+      break;
+    }
+    appendJSONField(json, "parseMs", "%.3f", getTimeMs() - start);
+    appendJSONField(json, "functionCount", "%zu", module->size());
+    appendJSONField(json, "globalCount", "%zu", module->getGlobalList().size());
+  } while (false);
+
+  releaseBitcode(&bitcode);
+
+  if (error) {
+    json += ", ";
+    appendJSONString(json, "error");
+    json += ": ";
+    appendJSONString(json, error);
+  }
+  json += "}\n";
+  return (error == NULL);
+}
+
+
+static pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+static size_t nextBatchFile = 0;
+static unsigned numBatchErrors = 0;
+
+static void *batchWorker(void *) {
+  while (true) {
+    pthread_mutex_lock(&batchLock);
+    size_t i = nextBatchFile++;
+    pthread_mutex_unlock(&batchLock);
+
+    if (i >= batchFiles.size()) {
+      break;
+    }
+
+    std::string json;
+    bool success = processBatchFile(batchFiles[i], json);
+
+    // Print each object in one piece. The order follows the completion.
+    pthread_mutex_lock(&batchLock);
+    if (!success) {
+      numBatchErrors++;
+    }
+    fputs(json.c_str(), stdout);
+    fflush(stdout);
+    pthread_mutex_unlock(&batchLock);
+  }
+  return NULL;
+}
+
+
+static int runBatch() {
+  if (numWorkers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    numWorkers = (cpus > 0) ? cpus : 1;
+  }
+  if (numWorkers > batchFiles.size()) {
+    numWorkers = batchFiles.size();
+  }
+
+  if ((numWorkers > 1) && !llvm::llvm_start_multithreaded()) {
+    fprintf(stderr, "LLVM is built without thread support. Run serially.\n");
+    numWorkers = 1;
+  }
+
+  std::vector<pthread_t> workers;
+  for (unsigned i = 1; i < numWorkers; i++) {
+    pthread_t worker;
+    int error = pthread_create(&worker, NULL, batchWorker, NULL);
+    if (error != 0) {
+      fprintf(stderr, "Could not create worker thread: %s\n",
+              strerror(error));
+      break;
+    }
+    workers.push_back(worker);
+  }
+
+  // The main thread works too.
+  batchWorker(NULL);
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  return (numBatchErrors == 0) ? 0 : 7;
+}
+
+
 int main(int argc, char** argv) {
   if(!parseOption(argc, argv)) {
     fprintf(stderr, "failed to parse option\n");
     return 1;
   }
 
+  if (batchFlag) {
+    return runBatch();
+  }
+
   const char *bitcode = NULL;
-  size_t bitcodeSize = readBitcode(&bitcode);
+  size_t bitcodeSize = readBitcode(inFile, &bitcode);
 
   unsigned int version = 0;
 
@@ -290,6 +562,7 @@ int main(int argc, char** argv) {
 
   llvm::OwningPtr<bcinfo::BitcodeTranslator> BT;
   BT.reset(new bcinfo::BitcodeTranslator(bitcode, bitcodeSize, version));
+  BT->setCacheDir(cacheDir.c_str());
   if (!BT->translate()) {
     fprintf(stderr, "failed to translate bitcode\n");
     return 3;
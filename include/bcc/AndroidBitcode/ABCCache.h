@@ -0,0 +1,101 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_ABC_CACHE_H
+#define BCC_ABC_CACHE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace bcc {
+
+namespace abccache {
+
+/* ABC cache file magic */
+#define ABCCACHE_MAGIC    "\0abcc\n\0\0"
+
+/* ABC cache file version, encoded in 4 bytes of ASCII */
+#define ABCCACHE_VERSION  "001\0"
+
+struct __attribute__((packed)) Header {
+  uint8_t magic[8];
+  uint8_t version[4];
+
+  // Number of the dependent libraries following the header, each the
+  // NUL-terminated file name and the SHA-1 of the one it was linked against.
+  uint32_t numDependentLibs;
+
+  // The shared object starts at a page boundary so that it can be cloned.
+  uint64_t dataOffset;
+  uint64_t dataSize;
+};
+
+} // end namespace abccache
+
+/*
+ * ABCCache keeps the shared objects built by ABCCompilerDriver in a
+ * directory, so that a build of unchanged bitcode (e.g. an app update which
+ * doesn't touch a library) doesn't compile and link again.
+ *
+ * An entry is keyed by the SHA-1 of the inputs, the triple, the libbcc build
+ * and the system objects always linked in. The libraries the inputs depend
+ * on are only known after compiling them, so their SHA-1s are recorded in the
+ * entry and checked on load instead.
+ */
+class ABCCache {
+private:
+  std::string mCacheDir;
+  std::string mTriple;
+  std::string mAndroidSysroot;
+
+  std::string getEntryPath(const std::string &pKey) const;
+
+  // Compute the SHA-1 of the file pName in the system/lib of the sysroot. A
+  // missing file gets all zeros. Return false if it can't be read.
+  bool getSystemFileDigest(const std::string &pName, uint8_t *pResult) const;
+
+public:
+  ABCCache(const std::string &pCacheDir, const std::string &pTriple,
+           const std::string &pAndroidSysroot);
+
+  // Compute the key of the build of pInputFds into pKey. Return false if an
+  // input can't be hashed (e.g. it's a pipe), and the build isn't cached.
+  bool getKey(const std::vector<int> &pInputFds, std::string &pKey) const;
+
+  // Write the shared object cached under pKey to pOutputFd, replacing its
+  // contents. Return false if there's none or a library it depends on has
+  // changed since.
+  bool load(const std::string &pKey, int pOutputFd) const;
+
+  // Cache the shared object in pOutputFd under pKey. pDependentLibs are the
+  // libraries (namespecs) it's linked against. pOutputFd must be readable.
+  bool save(const std::string &pKey, int pOutputFd,
+            const std::vector<std::string> &pDependentLibs) const;
+
+  // Create a readable and writable file in the cache directory to link into
+  // when the output can't be read back. It's unlinked already. Return -1 on
+  // error.
+  int createScratchFile() const;
+
+  // Replace the contents of pOutputFd with the whole file pInputFd.
+  static bool CopyFile(int pInputFd, int pOutputFd);
+};
+
+} // end namespace bcc
+
+#endif // BCC_ABC_CACHE_H
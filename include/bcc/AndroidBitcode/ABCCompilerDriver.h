@@ -17,40 +17,73 @@
 #ifndef BCC_ABC_COMPILER_DRIVER_H
 #define BCC_ABC_COMPILER_DRIVER_H
 
-#include "bcc/AndroidBitcode/ABCCompiler.h"
-#include "bcc/BCCContext.h"
-#include "bcc/Compiler.h"
-#include "bcc/Linker.h"
+#include <pthread.h>
 
 #include <string>
+#include <vector>
 
 namespace bcc {
 
+class ABCCompiler;
 class ABCExpandVAArgPass;
 class CompilerConfig;
+class Linker;
 class LinkerConfig;
 
 class ABCCompilerDriver {
 private:
-  BCCContext mContext;
-  ABCCompiler mCompiler;
-  Linker mLinker;
+  // An input to compile into a relocatable object.
+  struct CompileJob {
+    int mInputFd;
+    std::string mRelocatable;
+    // Names of the libraries the input depends on.
+    std::vector<std::string> mDependentLibs;
+    bool mSuccess;
+  };
+
+  // The jobs shared by the compile threads.
+  struct CompileQueue;
+
+  // The configured compilers not in use. Creating the TargetMachine of a
+  // compiler is costly, so they're kept for the following jobs and builds.
+  std::vector<ABCCompiler *> mIdleCompilers;
+  pthread_mutex_t mIdleCompilersLock;
+
+  Linker *mLinker;
 
-  CompilerConfig *mCompilerConfig;
   LinkerConfig *mLinkerConfig;
 
   std::string mTriple;
   std::string mAndroidSysroot;
 
+  // Directory to cache the built shared objects in. Empty to disable.
+  std::string mCacheDir;
+
 private:
-  bool configCompiler();
+  bool configCompiler(ABCCompiler &pCompiler, CompilerConfig &pConfig) const;
   bool configLinker();
 
+  // Create and configure the compilers on the calling thread until there're
+  // pNumCompilers idle ones. Must not be called while the compile threads are
+  // running. Return the number of idle compilers, up to pNumCompilers.
+  size_t prepareCompilers(size_t pNumCompilers);
+
+  // Return an idle compiler for a job. Each compile thread holds one at a
+  // time, so prepareCompilers() makes sure there's one. Return NULL if none.
+  ABCCompiler *acquireCompiler();
+  void releaseCompiler(ABCCompiler *pCompiler);
+
 private:
-  Script *prepareScript(int pInputFd);
-  bool compile(Script &pScript, llvm::raw_ostream &pOutput);
-  bool link(const Script &pScript, const std::string &input_relocatable,
-            int pOutputFd);
+  // Compile pJob with its own context and compiler, so that the jobs can run
+  // on different threads at the same time.
+  bool compile(CompileJob &pJob);
+  static void *CompileThread(void *pQueue);
+  bool link(const std::vector<CompileJob> &pJobs,
+            const std::vector<std::string> &pDependentLibs, int pOutputFd);
+
+  // Collect the dependent libraries of all the jobs, each once.
+  static void GetDependentLibs(const std::vector<CompileJob> &pJobs,
+                               std::vector<std::string> &pResult);
 
 protected:
   virtual const char **getNonPortableList() const {
@@ -80,8 +113,23 @@ public:
     return mTriple;
   }
 
-  // Compile the bitcode and link the shared object
+  inline const std::string &getCacheDir() const {
+    return mCacheDir;
+  }
+
+  // Cache the built shared objects in pCacheDir and reuse them for the builds
+  // of the same inputs (see ABCCache.) Caching is disabled by default.
+  inline void setCacheDir(const std::string &pCacheDir) {
+    mCacheDir = pCacheDir;
+  }
+
+  // Compile the bitcode and link the shared object. A driver can build any
+  // number of times, reusing its compilers.
   bool build(int pInputFd, int pOutputFd);
+
+  // Compile each of the bitcode inputs into a relocatable object in parallel
+  // and link them all into one shared object.
+  bool build(const std::vector<int> &pInputFds, int pOutputFd);
 };
 
 } // end namespace bcc
@@ -79,6 +79,10 @@ private:
   // LTO is enabled by default.
   bool mEnableLTO;
 
+  // Copied from the CompilerConfig supplied to config().
+  unsigned mPrefetchDistance;
+  bool mNonTemporalStore;
+
   enum ErrorCode runLTO(Script &pScript);
   enum ErrorCode runCodeGen(Script &pScript, llvm::raw_ostream &pResult);
 
@@ -103,6 +107,11 @@ public:
   virtual ~Compiler();
 
 protected:
+  inline unsigned getPrefetchDistance() const
+  { return mPrefetchDistance; }
+  inline bool isNonTemporalStoreEnabled() const
+  { return mNonTemporalStore; }
+
   //===--------------------------------------------------------------------===//
   // Plugin callbacks for sub-class.
   //===--------------------------------------------------------------------===//
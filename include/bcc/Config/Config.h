@@ -76,6 +76,19 @@
   #define ARM_USE_VFP
 #endif
 
+//---------------------------------------------------------------------------
+// Configuration for Renderscript ForEach Expansion
+//---------------------------------------------------------------------------
+
+// Amount of data (in bytes) a single tile of a cache-blocked foreach kernel
+// should touch. This is sized to fit into the L1 data cache of the targets we
+// care about.
+#define RS_FOREACH_TILE_CACHE_SIZE  (32 * 1024)
+
+// Size of a cache line (in bytes.) The width of a tile is always rounded up
+// to cover whole cache lines.
+#define RS_FOREACH_CACHE_LINE_SIZE  64
+
 //---------------------------------------------------------------------------
 
 #endif // BCC_CONFIG_CONFIG_H
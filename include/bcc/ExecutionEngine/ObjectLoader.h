@@ -18,6 +18,7 @@
 #define BCC_EXECUTION_ENGINE_OBJECT_LOADER_H
 
 #include <cstddef>
+#include <ctime>
 
 #include "bcc/Support/Log.h"
 
@@ -40,9 +41,35 @@ public:
 private:
   ObjectLoaderImpl *mImpl;
 
+  // The image of the object registered with GDB's JIT interface. It's built on
+  // demand since it costs a copy of the whole object.
+  bool mEnableGDBDebug;
   void *mDebugImage;
+  size_t mDebugImageSize;
+  bool mIsDebugImageMapped;
+
+  // A private descriptor of the object file to build the debug image from. The
+  // file is mapped copy-on-write so only the patched pages are copied. It's -1
+  // when the object is loaded from memory, in which case the image can only be
+  // built at load time. So each object loaded from a file with GDB debug
+  // enabled holds one more descriptor until its image is built or it's
+  // destroyed.
+  int mDebugFD;
+  // Modification time of the object file when it was loaded. The debug image
+  // is not built from a file rewritten since then.
+  time_t mDebugFileMTime;
+
+  ObjectLoader() : mImpl(NULL), mEnableGDBDebug(false), mDebugImage(NULL),
+                   mDebugImageSize(0), mIsDebugImageMapped(false),
+                   mDebugFD(-1), mDebugFileMTime(0) { }
+
+  // Patch the section addresses in pDebugImage and register it. Take the
+  // ownership of pDebugImage on success.
+  bool registerDebugImage(void *pDebugImage, bool pIsMapped);
 
-  ObjectLoader() : mImpl(NULL), mDebugImage(0) { }
+  static ObjectLoader *Load(void *pMemStart, size_t pMemSize, const char *pName,
+                            SymbolResolverInterface &pResolver,
+                            bool pEnableGDBDebug, int pDebugFD);
 
 public:
   // Load from a in-memory object. pName is a descriptive name of this memory.
@@ -55,10 +82,30 @@ public:
                             SymbolResolverInterface &pResolver,
                             bool pEnableGDBDebug);
 
+  // Build the debug image and register it with GDB if it hasn't been done.
+  // This happens at load time if a debugger is attached to the process or the
+  // property debug.bcc.gdb is set (to debug with a debugger attached later).
+  // Return false if GDB debug is not enabled for this object or the image
+  // failed to build.
+  bool registerWithGDB();
+
+  inline bool isRegisteredWithGDB() const
+  { return (mDebugImage != NULL); }
+
   void *getSymbolAddress(const char *pName) const;
 
   size_t getSymbolSize(const char *pName) const;
 
+  // Get the index of the section where the symbol is defined and its offset in
+  // that section. Return false if the symbol is not defined in a section of the
+  // object. The location is stable across the loads of the same object file.
+  bool getSymbolLocation(const char *pName, unsigned &pSectionIdx,
+                         size_t &pOffset) const;
+
+  // Get the address where the section with index pSectionIdx is loaded. Return
+  // NULL if there's no such section or it isn't loaded into memory.
+  void *getSectionAddress(unsigned pSectionIdx) const;
+
   // Get the symbol name where the symbol is of the type pType. If kUnknownType
   // is given, it returns all symbols' names in the object.
   bool getSymbolNameList(android::Vector<const char *>& pNameList,
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_EXECUTION_ENGINE_PERF_JIT_RECORDER_H
+#define BCC_EXECUTION_ENGINE_PERF_JIT_RECORDER_H
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+
+#include <pthread.h>
+
+namespace bcc {
+
+class ObjectLoader;
+
+/*
+ * PerfJITRecorder tells Linux perf about the functions of the loaded objects,
+ * which are otherwise seen as anonymous memory. It's enabled by the property
+ * debug.bcc.perf (or the environment variable BCC_PERF on host) set to:
+ *
+ *  - "map": append "<address> <size> <name>" lines to /tmp/perf-<pid>.map.
+ *  - "jitdump": write the code load records, including the code bytes, to
+ *    jit-<pid>.dump. Use with `perf record -k mono` and `perf inject --jit`.
+ *  - "1" or "all": both.
+ *
+ * Unloads are not recorded: neither format has a record for code going away.
+ * With jitdump, a later load at the same address has a later timestamp and
+ * takes over the samples after it. The perf map has no timestamps, so once
+ * the memory of an unloaded object is reused, perf may attribute the samples
+ * to the stale functions. Use jitdump for processes that load and destroy
+ * scripts over time.
+ */
+class PerfJITRecorder {
+private:
+  pthread_mutex_t mLock;
+
+  FILE *mPerfMap;
+
+  int mJITDumpFD;
+  void *mJITDumpMarker;
+  uint64_t mCodeIndex;
+
+  PerfJITRecorder();
+
+  bool openPerfMap();
+  bool openJITDump();
+
+  void writePerfMapEntry(const void *pAddr, size_t pSize, const char *pName);
+  void writeJITDumpEntry(const void *pAddr, size_t pSize, const char *pName);
+
+public:
+  static PerfJITRecorder &GetInstance();
+
+  inline bool isEnabled() const
+  { return (mPerfMap != NULL) || (mJITDumpFD >= 0); }
+
+  // Record all the functions in pLoader. pName is the name of the object.
+  void recordObject(const ObjectLoader &pLoader, const char *pName);
+
+  ~PerfJITRecorder();
+};
+
+} // end namespace bcc
+
+#endif // BCC_EXECUTION_ENGINE_PERF_JIT_RECORDER_H
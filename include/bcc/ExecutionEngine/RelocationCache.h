@@ -0,0 +1,124 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_EXECUTION_ENGINE_RELOCATION_CACHE_H
+#define BCC_EXECUTION_ENGINE_RELOCATION_CACHE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+
+#include "bcc/ExecutionEngine/SymbolResolverInterface.h"
+#include "bcc/Support/Log.h"
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace bcc {
+
+class FileBase;
+class InputFile;
+class OutputFile;
+
+namespace relocache {
+
+/* Relocation cache file magic */
+#define RELOCACHE_MAGIC       "\0bccrel\n"
+
+/* Relocation cache file version, encoded in 4 bytes of ASCII */
+#define RELOCACHE_VERSION     "001\0"
+
+struct __attribute__((packed)) Header {
+  uint8_t magic[8];
+  uint8_t version[4];
+
+  uint32_t numLibraries;
+  uint32_t numSymbols;
+  uint32_t strPoolSize;
+};
+
+// A shared library which contains the resolved addresses.
+struct __attribute__((packed)) LibraryItem {
+  // Indices into the string pool.
+  uint32_t name;
+  uint32_t buildId;
+};
+
+struct __attribute__((packed)) SymbolItem {
+  uint32_t name;
+  // Index of the library or gNoLibrary.
+  uint32_t library;
+  // Offset from the load address of the library.
+  uint32_t offset;
+};
+
+// The library of the symbols whose addresses don't belong to any shared
+// library. They're always resolved with the underlying resolver.
+const uint32_t gNoLibrary = static_cast<uint32_t>(-1);
+
+} // end namespace relocache
+
+/*
+ * RelocationCache memoizes the external symbols resolved when an object is
+ * loaded. The symbols are recorded in the order they're requested, as an
+ * offset into the shared library which contains them, together with the build
+ * ID of each of those libraries. If none of the libraries has changed, the
+ * next load of the same object replays the recorded addresses in order instead
+ * of walking the chain of resolvers. A symbol which doesn't match the recorded
+ * one is resolved with the underlying resolver and the cache becomes dirty.
+ */
+class RelocationCache : public SymbolResolverInterface {
+private:
+  SymbolResolverInterface &mResolver;
+
+  // Recorded symbols to replay. Names point into mStringPool.
+  android::Vector<std::pair<const char *, void *> > mReplay;
+  char *mStringPool;
+  size_t mNext;
+
+  // Symbols resolved in this load.
+  android::Vector<std::pair<std::string, void *> > mResolved;
+
+  bool mIsDirty;
+
+public:
+  // Return the path of the relocation cache corresponded to the given object
+  // file.
+  static android::String8 GetPath(const FileBase &pObjFile);
+
+  RelocationCache(SymbolResolverInterface &pResolver);
+
+  // Read the symbols to replay from pInput. Return false if the file is
+  // invalid or any of the libraries it refers to has changed.
+  bool read(InputFile &pInput);
+
+  // Write out the symbols resolved in this load.
+  bool write(OutputFile &pOutput) const;
+
+  // Return true if the symbols resolved in this load differ from the ones read
+  // in.
+  inline bool isDirty() const
+  { return mIsDirty || (mNext != mReplay.size()); }
+
+  virtual void *getAddress(const char *pName);
+
+  ~RelocationCache();
+};
+
+} // end namespace bcc
+
+#endif // BCC_EXECUTION_ENGINE_RELOCATION_CACHE_H
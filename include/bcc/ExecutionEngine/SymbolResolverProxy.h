@@ -17,22 +17,46 @@
 #ifndef BCC_EXECUTION_ENGINE_SYMBOL_RESOLVER_PROXY_H
 #define BCC_EXECUTION_ENGINE_SYMBOL_RESOLVER_PROXY_H
 
+#include <pthread.h>
+
 #include "bcc/ExecutionEngine/SymbolResolverInterface.h"
 #include "bcc/Support/Log.h"
 
+#include <llvm/ADT/StringMap.h>
 #include <utils/Vector.h>
 
 namespace bcc {
 
+/*
+ * SymbolResolverProxy resolves a symbol by following a chain of resolvers.
+ * The results (including the symbols that none of the resolvers knows) are
+ * memoized, so each name walks the chain (and calls dlsym() for the
+ * DyldSymbolResolver in it) only once. Call invalidateCache() if a resolver in
+ * the chain may return a different address for a name it has been asked for.
+ *
+ * getAddress() and invalidateCache() may be called from multiple threads. The
+ * chain must be set up before the proxy is shared.
+ */
 class SymbolResolverProxy : public SymbolResolverInterface {
 private:
   android::Vector<SymbolResolverInterface *> mChain;
 
+  // Name to address. NULL is cached for the names that can't be resolved.
+  // Guarded by mCacheLock.
+  llvm::StringMap<void *> mCache;
+  pthread_mutex_t mCacheLock;
+
 public:
-  SymbolResolverProxy() { }
+  SymbolResolverProxy()
+  { pthread_mutex_init(&mCacheLock, NULL); }
+
+  ~SymbolResolverProxy()
+  { pthread_mutex_destroy(&mCacheLock); }
 
   void chainResolver(SymbolResolverInterface &pResolver);
 
+  void invalidateCache();
+
   virtual void *getAddress(const char *pName);
 };
 
@@ -17,8 +17,14 @@
 #ifndef BCC_EXECUTION_ENGINE_SYMBOL_RESOLVERS_H
 #define BCC_EXECUTION_ENGINE_SYMBOL_RESOLVERS_H
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
 
 #include "SymbolResolverInterface.h"
 
@@ -51,6 +57,14 @@ public:
 
 /*
  * Symbol lookup by searching through an array of SymbolMap.
+ *
+ * A minimal perfect hash over Subclass::SymbolArray is built on the first
+ * lookup (once per process and per Subclass) using the "hash and displace"
+ * scheme: keys are first distributed into buckets, then for each bucket a
+ * displacement is searched such that all of its keys land in distinct free
+ * slots. A lookup then costs two hashes and a single strcmp(). If the table
+ * can't be built (e.g., out of memory or duplicated names in the array), the
+ * resolver falls back to binary search (if mSorted) or linear search.
  */
 template<typename Subclass>
 class ArraySymbolResolver : public SymbolResolverInterface {
@@ -66,18 +80,142 @@ private:
   // True if the symbol name is sorted in the array.
   bool mSorted;
 
+  // The perfect hash table. sDisplacements[i] is the seed of the second hash
+  // for the keys in bucket i if it's positive or -(slot + 1) for a bucket with
+  // a single key. sSlots is NULL if the table is unavailable.
+  static pthread_once_t sHashTableOnce;
+  static int32_t *sDisplacements;
+  static const SymbolMap **sSlots;
+
   static int CompareSymbolName(const void *pA, const void *pB) {
     return ::strcmp(reinterpret_cast<const SymbolMap *>(pA)->mName,
                     reinterpret_cast<const SymbolMap *>(pB)->mName);
   }
 
+  // FNV-1 variant (multiply, then XOR each byte) taking a seed.
+  static uint32_t Hash(uint32_t pSeed, const char *pName) {
+    uint32_t h = (pSeed == 0) ? 0x01000193 : pSeed;
+    while (*pName != '\0') {
+      h = (h * 0x01000193) ^ static_cast<uint8_t>(*pName++);
+    }
+    return h;
+  }
+
+  static bool BucketSizeGreater(const std::vector<size_t> *pA,
+                                const std::vector<size_t> *pB) {
+    return (pA->size() > pB->size());
+  }
+
+  static void BuildHashTable() {
+    const size_t num_symbols = Subclass::NumSymbols;
+    if (num_symbols == 0) {
+      return;
+    }
+
+    int32_t *displacements = new (std::nothrow) int32_t [num_symbols];
+    const SymbolMap **slots =
+        new (std::nothrow) const SymbolMap * [num_symbols];
+    if ((displacements == NULL) || (slots == NULL)) {
+      delete [] displacements;
+      delete [] slots;
+      return;
+    }
+    ::memset(displacements, 0, sizeof(int32_t) * num_symbols);
+    ::memset(slots, 0, sizeof(const SymbolMap *) * num_symbols);
+
+    // Distribute the keys into buckets.
+    std::vector<std::vector<size_t> > buckets(num_symbols);
+    for (size_t i = 0; i < num_symbols; i++) {
+      const char *name = Subclass::SymbolArray[i].mName;
+      buckets[Hash(0, name) % num_symbols].push_back(i);
+    }
+
+    // Place the largest buckets first.
+    std::vector<std::vector<size_t> *> order;
+    for (size_t i = 0; i < num_symbols; i++) {
+      order.push_back(&buckets[i]);
+    }
+    std::stable_sort(order.begin(), order.end(), BucketSizeGreater);
+
+    std::vector<size_t> bucket_slots;
+    size_t free_slot = 0;
+    for (size_t i = 0; i < num_symbols; i++) {
+      const std::vector<size_t> &bucket = *order[i];
+      const size_t bucket_index = order[i] - &buckets[0];
+
+      if (bucket.empty()) {
+        break;
+      }
+
+      if (bucket.size() == 1) {
+        // No collision to resolve. Put it into the next free slot.
+        while (slots[free_slot] != NULL) {
+          free_slot++;
+        }
+        slots[free_slot] = &Subclass::SymbolArray[bucket[0]];
+        displacements[bucket_index] = -static_cast<int32_t>(free_slot) - 1;
+        continue;
+      }
+
+      // Search for a seed mapping all keys in the bucket to distinct free
+      // slots. Give up after a while (e.g., duplicated names can never be
+      // separated.)
+      static const uint32_t MaxSeed = (1 << 16);
+      uint32_t seed;
+      for (seed = 1; seed < MaxSeed; seed++) {
+        bucket_slots.clear();
+        size_t j;
+        for (j = 0; j < bucket.size(); j++) {
+          size_t slot = Hash(seed, Subclass::SymbolArray[bucket[j]].mName) %
+                        num_symbols;
+          if ((slots[slot] != NULL) ||
+              (std::find(bucket_slots.begin(), bucket_slots.end(), slot) !=
+                   bucket_slots.end())) {
+            break;
+          }
+          bucket_slots.push_back(slot);
+        }
+        if (j == bucket.size()) {
+          break;
+        }
+      }
+
+      if (seed >= MaxSeed) {
+        delete [] displacements;
+        delete [] slots;
+        return;
+      }
+
+      for (size_t j = 0; j < bucket.size(); j++) {
+        slots[bucket_slots[j]] = &Subclass::SymbolArray[bucket[j]];
+      }
+      displacements[bucket_index] = static_cast<int32_t>(seed);
+    }
+
+    sDisplacements = displacements;
+    sSlots = slots;
+    return;
+  }
+
 public:
   ArraySymbolResolver(bool pSorted = false) : mSorted(pSorted) { }
 
   virtual void *getAddress(const char *pName) {
     const SymbolMap *result = NULL;
 
-    if (mSorted) {
+    ::pthread_once(&sHashTableOnce, BuildHashTable);
+
+    if (sSlots != NULL) {
+      // Use the perfect hash.
+      const size_t num_symbols = Subclass::NumSymbols;
+      int32_t d = sDisplacements[Hash(0, pName) % num_symbols];
+      size_t slot = (d < 0) ? static_cast<size_t>(-d - 1) :
+                              (Hash(static_cast<uint32_t>(d), pName) %
+                                  num_symbols);
+      if (::strcmp(sSlots[slot]->mName, pName) == 0) {
+        result = sSlots[slot];
+      }
+    } else if (mSorted) {
       // Use binary search.
       const SymbolMap key = { pName, NULL };
 
@@ -100,6 +238,16 @@ public:
   }
 };
 
+template<typename Subclass>
+pthread_once_t ArraySymbolResolver<Subclass>::sHashTableOnce = PTHREAD_ONCE_INIT;
+
+template<typename Subclass>
+int32_t *ArraySymbolResolver<Subclass>::sDisplacements = NULL;
+
+template<typename Subclass>
+const typename ArraySymbolResolver<Subclass>::SymbolMap **
+ArraySymbolResolver<Subclass>::sSlots = NULL;
+
 template<typename ContextTy = void *>
 class LookupFunctionSymbolResolver : public SymbolResolverInterface {
 public:
@@ -17,6 +17,9 @@
 #ifndef BCC_LINKER_H
 #define BCC_LINKER_H
 
+#include <stdint.h>
+
+#include <map>
 #include <string>
 
 namespace mcld {
@@ -25,6 +28,7 @@ class TargetLDBackend;
 class MCLDDriver;
 class MemoryFactory;
 class MCLDInfo;
+class MemoryArea;
 class TreeIteratorBase;
 class Input;
 
@@ -66,11 +70,24 @@ private:
   mcld::TargetLDBackend *mBackend;
   mcld::MCLDDriver *mDriver;
   MemoryFactory *mMemAreaFactory;
+  // Areas of the inputs in memory. They're only valid for one link, so the
+  // factory is dropped by reset().
+  MemoryFactory *mInputAreaFactory;
+  mcld::MemoryArea *mOutputArea;
   mcld::MCLDInfo *mLDInfo;
   mcld::TreeIteratorBase *mRoot;
   bool mShared;
   std::string mSOName;
 
+  // Identity of each file opened by path at the time it was last opened.
+  struct FileStamp {
+    uint64_t mDev;
+    uint64_t mIno;
+    uint64_t mSize;
+    uint64_t mMTime;
+  };
+  std::map<std::string, FileStamp> mFileStamps;
+
 public:
   Linker();
 
@@ -80,6 +97,15 @@ public:
 
   enum ErrorCode config(const LinkerConfig& pConfig);
 
+  // Write out and close the output and drop the state of the last link, so
+  // that the linker can be configured again for another link. The inputs
+  // added from memory are released. The memory areas of the files opened by
+  // path (e.g. the system libraries) are kept, so linking against them again
+  // doesn't open and map them again, unless the file has been replaced or
+  // modified since. Call it before the LinkerConfig given to config() is
+  // deleted.
+  void reset();
+
   enum ErrorCode addNameSpec(const std::string &pNameSpec);
 
   enum ErrorCode addObject(const std::string &pObjectPath);
@@ -102,6 +128,10 @@ private:
                           mcld::Input& pInput);
 
   void advanceRoot();
+
+  // Record the identity of the file at pPath. Return true if it differs from
+  // the one recorded when the file was last opened.
+  bool updateFileStamp(const std::string &pPath);
 };
 
 } // end namespace bcc
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_CACHE_INDEX_H
+#define BCC_RS_CACHE_INDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include <pthread.h>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/Log.h"
+
+namespace android {
+class FileMap;
+} // end namespace android
+
+namespace bcc {
+
+namespace rsindex {
+
+/* RS cache index file magic */
+#define RSINDEX_MAGIC     "\0rsidx\n\0"
+
+/* RS cache index file version, encoded in 4 bytes of ASCII */
+#define RSINDEX_VERSION   "002\0"
+
+struct __attribute__((packed)) Header {
+  uint8_t magic[8];
+  uint8_t version[4];
+
+  uint32_t numEntries;
+  uint8_t entrySize;
+};
+
+// The entries follow the header. Offsets are from the beginning of the file.
+struct __attribute__((packed)) EntryItem {
+  // NUL-terminated file name of the object file of the script.
+  uint32_t name;
+  // A copy of the RS info file of the script.
+  uint32_t info;
+  uint32_t infoSize;
+  // The object file the RS info belongs to when the entry was written.
+  uint64_t objSize;
+  uint64_t objMTime;
+  // The RS info file copied. RSExecutable::syncInfo() replaces the file, so
+  // the inode tells whether it has been rewritten since.
+  uint64_t infoIno;
+  uint64_t infoMTime;
+};
+
+} // end namespace rsindex
+
+/*
+ * RSCacheIndex keeps the RS info of all the scripts in a cache directory in
+ * one file, so that a cache hit doesn't have to open, lock and map the RS info
+ * file of each script. The index is mapped once per process and replaced
+ * atomically (by rename()) on update. The RS info files remain the source of
+ * truth: an entry is only used if neither the object file nor the RS info file
+ * has changed since the entry was written, and a miss in the index falls back
+ * to them.
+ */
+class RSCacheIndex {
+private:
+  std::string mPath;
+
+  pthread_mutex_t mLock;
+
+  // The mapping of the index file and the identity of that file.
+  android::FileMap *mMap;
+  const uint8_t *mData;
+  size_t mSize;
+  dev_t mDev;
+  ino_t mIno;
+  time_t mMTime;
+
+  RSCacheIndex(const std::string &pPath);
+
+  // Remap the index file if it has been replaced. Must hold mLock.
+  void refresh();
+  void unmap();
+
+  // Return the entry named pName in pData or NULL. pData must be valid.
+  static const rsindex::EntryItem *FindEntry(const uint8_t *pData,
+                                             size_t pSize, const char *pName);
+
+  // Check the header and the entries in pData.
+  static bool Validate(const uint8_t *pData, size_t pSize,
+                       const char *pPath);
+
+public:
+  // Return the path of the index file in pCacheDir.
+  static std::string GetPath(const char *pCacheDir);
+
+  // Return the index of the scripts in pCacheDir, shared in the process.
+  // Return NULL if out of memory.
+  static RSCacheIndex *Get(const char *pCacheDir);
+
+  // Return the RS info of the object file pObjPath (in the cache directory of
+  // this index) if the index has an entry for it, neither the object file nor
+  // its RS info file has changed since then and the dependencies match pDeps.
+  // Otherwise, return NULL.
+  RSInfo *lookup(const char *pObjPath, const RSInfo::DependencyTableTy &pDeps);
+
+  // Replace the entry of the object file pObjPath with the contents of its RS
+  // info file pInfoPath.
+  bool update(const char *pObjPath, const char *pInfoPath);
+
+  ~RSCacheIndex();
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_CACHE_INDEX_H
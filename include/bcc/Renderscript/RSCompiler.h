@@ -23,8 +23,21 @@ namespace bcc {
 
 class RSCompiler : public Compiler {
 private:
+  // Call the external functions through an import table (see
+  // createRSImportTablePass().) Required to link the script into a shared
+  // object.
+  bool mUseImportTable;
+
   virtual bool beforeAddLTOPasses(Script &pScript, llvm::PassManager &pPM);
   virtual bool beforeExecuteLTOPasses(Script &pScript, llvm::PassManager &pPM);
+
+public:
+  RSCompiler() : Compiler(), mUseImportTable(false) { }
+
+  inline bool isImportTableEnabled() const
+  { return mUseImportTable; }
+  inline void enableImportTable(bool pEnable = true)
+  { mUseImportTable = pEnable; }
 };
 
 } // end namespace bcc
@@ -17,6 +17,8 @@
 #ifndef BCC_RS_COMPILER_DRIVER_H
 #define BCC_RS_COMPILER_DRIVER_H
 
+#include <llvm/Support/CodeGen.h>
+
 #include "bcc/ExecutionEngine/BCCRuntimeSymbolResolver.h"
 #include "bcc/ExecutionEngine/SymbolResolvers.h"
 #include "bcc/ExecutionEngine/SymbolResolverProxy.h"
@@ -27,6 +29,7 @@ namespace bcc {
 
 class BCCContext;
 class CompilerConfig;
+class RSCacheIndex;
 class RSExecutable;
 class RSScript;
 
@@ -35,6 +38,17 @@ private:
   CompilerConfig *mConfig;
   RSCompiler mCompiler;
 
+  // Link the compiled scripts into shared objects and load them with dlopen()
+  // instead of the ObjectLoader.
+  bool mUseSharedObject;
+
+  // Look up the RS info in the index of the cache directory before reading
+  // the RS info file of the script.
+  bool mUseCacheIndex;
+
+  // The relocation model mConfig was created with.
+  llvm::Reloc::Model mTargetRelocModel;
+
   BCCRuntimeSymbolResolver mBCCRuntime;
   LookupFunctionSymbolResolver<void*> mRSRuntime;
   SymbolResolverProxy mResolver;
@@ -42,10 +56,17 @@ private:
   RSExecutable *loadScriptCache(const char *pOutputPath,
                                 const RSInfo::DependencyTableTy &pDeps);
 
+  // Return the index of the cache directory of pOutputPath or NULL if the
+  // index is not used.
+  RSCacheIndex *getCacheIndex(const char *pOutputPath) const;
+
   // Setup the compiler config for the given script. Return true if mConfig has
   // been changed and false if it remains unchanged.
   bool setupConfig(const RSScript &pScript);
 
+  // Link the object file pObjPath into the shared object pSOPath.
+  bool linkSharedObject(const char *pObjPath, const char *pSOPath);
+
   RSExecutable *compileScript(RSScript &pScript,
                               const char* pScriptName,
                               const char *pOutputPath,
@@ -55,11 +76,31 @@ public:
   RSCompilerDriver();
   ~RSCompilerDriver();
 
+  // The addresses memoized in mResolver are dropped whenever the lookup
+  // function or its context changes.
   inline void setRSRuntimeLookupFunction(
-      LookupFunctionSymbolResolver<>::LookupFunctionTy pLookupFunc)
-  { mRSRuntime.setLookupFunction(pLookupFunc); }
-  inline void setRSRuntimeLookupContext(void *pContext)
-  { mRSRuntime.setContext(pContext); }
+      LookupFunctionSymbolResolver<>::LookupFunctionTy pLookupFunc) {
+    mRSRuntime.setLookupFunction(pLookupFunc);
+    mResolver.invalidateCache();
+  }
+  inline void setRSRuntimeLookupContext(void *pContext) {
+    mRSRuntime.setContext(pContext);
+    mResolver.invalidateCache();
+  }
+
+  // Defaults to the property debug.rs.sharedobject.
+  inline void setUseSharedObject(bool pEnable) {
+    mUseSharedObject = pEnable;
+    mCompiler.enableImportTable(pEnable);
+  }
+  inline bool isUsingSharedObject() const
+  { return mUseSharedObject; }
+
+  // Defaults to the property debug.rs.cacheindex.
+  inline void setUseCacheIndex(bool pEnable)
+  { mUseCacheIndex = pEnable; }
+  inline bool isUsingCacheIndex() const
+  { return mUseCacheIndex; }
 
   // FIXME: This method accompany with loadScriptCache and compileScript should
   //        all be const-methods. They're not now because the getAddress() in
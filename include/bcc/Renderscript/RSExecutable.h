@@ -18,18 +18,21 @@
 #define BCC_RS_EXECUTABLE_H
 
 #include <cstddef>
+#include <stdint.h>
 
 
 #include "bcc/ExecutionEngine/ObjectLoader.h"
 #include "bcc/Renderscript/RSInfo.h"
 #include "bcc/Support/Log.h"
 
+#include <utils/String8.h>
 #include <utils/Vector.h>
 
 namespace bcc {
 
 class FileBase;
 class OutputFile;
+class SymbolResolverInterface;
 class SymbolResolverProxy;
 
 /*
@@ -42,33 +45,63 @@ private:
 
   FileBase *mObjFile;
 
+  // Exactly one of mLoader and mSharedObject is non-NULL. mSharedObject is the
+  // handle returned by dlopen() when the script was linked into a shared
+  // object.
   ObjectLoader *mLoader;
+  void *mSharedObject;
 
   // Memory address of rs export stuffs
   android::Vector<void *> mExportVarAddrs;
   android::Vector<void *> mExportFuncAddrs;
   android::Vector<void *> mExportForeachFuncAddrs;
 
+  // Cache-blocked variants of the expanded foreach functions and their tile
+  // dimension ({ width, height }.) Entries are NULL for the foreach functions
+  // which were not tiled.
+  android::Vector<void *> mExportForeachTileFuncAddrs;
+  android::Vector<const uint32_t *> mExportForeachTileDims;
+
   // FIXME: These are designed for Renderscript HAL and is initialized in
   //        RSExecutable::Create(). Both of them come from RSInfo::getPragmas().
   //        If possible, read the pragma key/value pairs directly from RSInfo.
   android::Vector<const char *> mPragmaKeys;
   android::Vector<const char *> mPragmaValues;
 
-  RSExecutable(RSInfo &pInfo, FileBase &pObjFile, ObjectLoader &pLoader)
-    : mInfo(&pInfo), mIsInfoDirty(false), mObjFile(&pObjFile), mLoader(&pLoader)
+  RSExecutable(RSInfo &pInfo, FileBase &pObjFile, ObjectLoader *pLoader,
+               void *pSharedObject)
+    : mInfo(&pInfo), mIsInfoDirty(false), mObjFile(&pObjFile),
+      mLoader(pLoader), mSharedObject(pSharedObject)
   { }
 
+  // Fill the import table (if any) of the loaded script with the addresses
+  // from pResolver.
+  bool resolveImports(SymbolResolverInterface &pResolver);
+
 public:
   // This is a NULL-terminated string array which specifies "Special" functions
   // in Renderscript (e.g., root().)
   static const char *SpecialFunctionNames[];
 
+  // Names of the import table generated by createRSImportTablePass() and of
+  // the NULL-terminated list of the function names for its slots.
+  static const char ImportTableSymbolName[];
+  static const char ImportNameTableSymbolName[];
+
+  // Return the path of the shared object linked from the object file pObjPath.
+  static android::String8 GetSharedObjectPath(const char *pObjPath);
+
   // Return NULL on error. If the return object is non-NULL, it claims the
   // ownership of pInfo and pObjFile.
+  //
+  // If pUseSharedObject is true and the shared object linked from pObjFile
+  // exists, it's loaded with dlopen() such that its text pages are shared
+  // among the processes using the same script. Otherwise, pObjFile is loaded
+  // by ObjectLoader.
   static RSExecutable *Create(RSInfo &pInfo,
                               FileBase &pObjFile,
-                              SymbolResolverProxy &pResolver);
+                              SymbolResolverProxy &pResolver,
+                              bool pUseSharedObject = false);
 
   inline const RSInfo &getInfo() const
   { return *mInfo; }
@@ -85,12 +118,21 @@ public:
     return;
   }
 
-  // Interfaces to ObjectLoader
-  inline void *getSymbolAddress(const char *pName) const
-  { return mLoader->getSymbolAddress(pName); }
+  inline bool isSharedObject() const
+  { return (mSharedObject != NULL); }
+
+  // Interfaces to ObjectLoader or dlsym()
+  void *getSymbolAddress(const char *pName) const;
 
   bool syncInfo(bool pForce = false);
 
+  // Register the script with GDB's JIT interface if it has debug information.
+  // Done at load time if a debugger is attached or debug.bcc.gdb is set.
+  // Scripts loaded as shared objects are seen by the debugger through the
+  // dynamic linker instead.
+  inline bool registerWithGDB()
+  { return (mLoader != NULL) && mLoader->registerWithGDB(); }
+
   // Disassemble and dump the relocated functions to the pOutput.
   void dumpDisassembly(OutputFile &pOutput) const;
 
@@ -100,6 +142,11 @@ public:
   { return mExportFuncAddrs; }
   inline const android::Vector<void *> &getExportForeachFuncAddrs() const
   { return mExportForeachFuncAddrs; }
+  inline const android::Vector<void *> &getExportForeachTileFuncAddrs() const
+  { return mExportForeachTileFuncAddrs; }
+  inline const android::Vector<const uint32_t *> &
+  getExportForeachTileDims() const
+  { return mExportForeachTileDims; }
 
   inline const android::Vector<const char *> &getPragmaKeys() const
   { return mPragmaKeys; }
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_FOREACH_EXECUTOR_H
+#define BCC_RS_FOREACH_EXECUTOR_H
+
+#include <cstddef>
+#include <stdint.h>
+
+#include <pthread.h>
+
+namespace bcc {
+
+class RSExecutable;
+
+/*
+ * RSForEachExecutor is a reference implementation of the driver side of
+ * rsForEach() on the CPU. It invokes the "<name>.expand" functions generated
+ * by RSForEachExpandPass over a 2D iteration space using a pool of worker
+ * threads. The iteration space is cut into chunks of cells in a row, or into
+ * tiles when the kernel has a cache-blocked "<name>.expand_tile" variant. Each
+ * worker starts with a contiguous range of chunks and steals half of the
+ * remaining range of another worker once it runs out of work.
+ *
+ * This is meant for benchmarking and testing the generated code without the
+ * Renderscript runtime. It's not used by libbcc itself.
+ */
+class RSForEachExecutor {
+public:
+  // Must match RsForEachStubParamStruct created in RSForEachExpand.cpp.
+  struct StubParam {
+    const void *in;
+    void *out;
+    const void *usr;
+    uint32_t usr_len;
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    uint32_t lod;
+    uint32_t face;
+    uint32_t ar[16];
+    uint32_t tile_x1;
+    uint32_t tile_x2;
+    uint32_t tile_y1;
+    uint32_t tile_y2;
+    uint32_t in_ystride;
+    uint32_t out_ystride;
+  };
+
+  typedef void (*ExpandedFuncTy)(const StubParam *p, uint32_t x1, uint32_t x2,
+                                 uint32_t instep, uint32_t outstep);
+
+  // "<name>.expand_tile" runs the tile given by p->tile_x1, ..., p->tile_y2.
+  typedef void (*TiledFuncTy)(const StubParam *p, uint32_t instep,
+                              uint32_t outstep);
+
+  // Describe the allocations a foreach kernel is launched over.
+  struct Launch {
+    const void *in;
+    void *out;
+    const void *usr;
+    uint32_t usrLen;
+
+    uint32_t dimX;
+    uint32_t dimY;
+
+    // Number of bytes between two adjacent cells in a row.
+    uint32_t inStep;
+    uint32_t outStep;
+
+    // Number of bytes between two adjacent rows.
+    uint32_t inYStride;
+    uint32_t outYStride;
+  };
+
+  struct Stats {
+    // Number of threads that actually took part in the launch.
+    unsigned numThreads;
+    uint64_t numElements;
+    uint64_t elapsedNs;
+    // Number of successful steals among all workers.
+    unsigned numSteals;
+
+    double getElementsPerSecond() const {
+      return (elapsedNs == 0) ? 0.0 :
+          (static_cast<double>(numElements) * 1.0e9 / elapsedNs);
+    }
+  };
+
+private:
+  struct Worker {
+    RSForEachExecutor *mExecutor;
+    unsigned mIndex;
+    pthread_t mThread;
+
+    // Range of the chunks [mBegin, mEnd) owned by this worker. Guarded by
+    // mLock since other workers may steal from it.
+    pthread_mutex_t mLock;
+    uint32_t mBegin;
+    uint32_t mEnd;
+
+    unsigned mNumSteals;
+  };
+
+  unsigned mNumThreads;
+  // Number of cells in a chunk.
+  uint32_t mChunkSize;
+  Worker *mWorkers;
+
+  // Worker threads sleep on mWorkCond until mGeneration changes.
+  pthread_mutex_t mLock;
+  pthread_cond_t mWorkCond;
+  pthread_cond_t mDoneCond;
+  unsigned mGeneration;
+  unsigned mNumBusyWorkers;
+  bool mShutdown;
+  bool mHasError;
+
+  // Setting of the launch in progress. Exactly one of mFunc and mTileFunc is
+  // non-NULL. A chunk covers mCellsPerChunk cells in each of mRowsPerChunk
+  // rows.
+  ExpandedFuncTy mFunc;
+  TiledFuncTy mTileFunc;
+  const Launch *mLaunch;
+  unsigned mNumActiveWorkers;
+  uint32_t mCellsPerChunk;
+  uint32_t mRowsPerChunk;
+  uint32_t mChunksPerRow;
+
+  static void *WorkerMain(void *pWorker);
+
+  void runChunk(uint32_t pChunk);
+  bool grabChunk(Worker &pWorker, uint32_t &pChunk);
+  bool stealChunks(Worker &pThief);
+  void work(Worker &pWorker);
+  bool launch(bool pThreadable, const Launch &pLaunch, Stats *pStats);
+
+public:
+  // Create a pool of pNumThreads threads (including the calling thread.)
+  // pChunkSize is the number of cells in a unit of work. Zero means whole
+  // rows.
+  RSForEachExecutor(unsigned pNumThreads, uint32_t pChunkSize = 0);
+
+  inline bool hasError() const
+  { return mHasError; }
+
+  inline unsigned getNumThreads() const
+  { return mNumThreads; }
+
+  // Run pFunc over pLaunch and wait for completion. The launch uses only the
+  // calling thread if pThreadable is false. Return false on error.
+  bool run(ExpandedFuncTy pFunc, bool pThreadable, const Launch &pLaunch,
+           Stats *pStats = NULL);
+
+  // Same as above but run the tiled function pFunc on tiles of pTileWidth by
+  // pTileHeight cells.
+  bool runTiled(TiledFuncTy pFunc, uint32_t pTileWidth, uint32_t pTileHeight,
+                bool pThreadable, const Launch &pLaunch, Stats *pStats = NULL);
+
+  // Run the pSlot-th expanded foreach function in pExecutable, by tiles if it
+  // has a tiled variant. Honors RSExecutable::isThreadable().
+  bool run(const RSExecutable &pExecutable, size_t pSlot,
+           const Launch &pLaunch, Stats *pStats = NULL);
+
+  ~RSForEachExecutor();
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_FOREACH_EXECUTOR_H
@@ -28,6 +28,10 @@
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
+namespace android {
+class FileMap;
+} // end namespace android
+
 namespace bcc {
 
 // Forward declarations
@@ -42,7 +46,7 @@ namespace rsinfo {
 #define RSINFO_MAGIC      "\0rsinfo\n"
 
 /* RS info file version, encoded in 4 bytes of ASCII */
-#define RSINFO_VERSION    "003\0"
+#define RSINFO_VERSION    "004\0"
 
 struct __attribute__((packed)) ListHeader {
   // The offset from the beginning of the file of data
@@ -72,6 +76,7 @@ struct __attribute__((packed)) Header {
   struct ListHeader exportVarNameList;
   struct ListHeader exportFuncNameList;
   struct ListHeader exportForeachFuncList;
+  struct ListHeader symbolLocationList;
 };
 
 typedef uint32_t StringIndexTy;
@@ -109,6 +114,20 @@ struct __attribute__((packed)) ExportForeachFuncItem {
   uint32_t signature;
 };
 
+// Location of an exported symbol in the object file. The loaded address of the
+// symbol is the address where the section is loaded plus the offset.
+struct __attribute__((packed)) SymbolLocationItem {
+  uint32_t section;
+  uint32_t offset;
+};
+
+// Section index of the symbols which are not defined in the object.
+const uint32_t gUndefSectionIndex = static_cast<uint32_t>(-1);
+// Section index of the symbols which are defined in the object but can't be
+// located by section and offset (e.g., common symbols.) They're looked up by
+// name.
+const uint32_t gUnknownSectionIndex = static_cast<uint32_t>(-2);
+
 // Return the human-readable name of the given rsinfo::*Item in the template
 // parameter. This is for debugging and error message.
 template<typename Item>
@@ -138,6 +157,10 @@ template<>
 inline const char *GetItemTypeName<ExportForeachFuncItem>()
 { return "rs export foreach"; }
 
+template<>
+inline const char *GetItemTypeName<SymbolLocationItem>()
+{ return "rs symbol location"; }
+
 } // end namespace rsinfo
 
 class RSInfo {
@@ -150,6 +173,9 @@ public:
   typedef android::Vector<const char *> ExportFuncNameListTy;
   typedef android::Vector<std::pair<const char *,
                                     uint32_t> > ExportForeachFuncListTy;
+  // (section index, offset) pairs. See getSymbolLocations() for the order.
+  typedef android::Vector<std::pair<uint32_t,
+                                    uint32_t> > SymbolLocationListTy;
 
 public:
   // Calculate or load the SHA-1 information of the built-in dependencies.
@@ -188,6 +214,13 @@ private:
 
   char *mStringPool;
 
+  // The mapping of the RS info file this RSInfo was read from. If it's not
+  // NULL, mStringPool points into it (read-only) instead of the heap. Nothing
+  // mutates the string pool after the read and the RS info file is always
+  // replaced by rename() (see RSExecutable::syncInfo()), so the mapping stays
+  // valid while the RSInfo lives.
+  android::FileMap *mFileMap;
+
   // In most of the time, there're 4 source dependencies stored (libbcc.so,
   // libRS.so, libclcore and the input bitcode itself.)
   DependencyTableTy mDependencyTable;
@@ -196,10 +229,18 @@ private:
   ExportVarNameListTy mExportVarNames;
   ExportFuncNameListTy mExportFuncNames;
   ExportForeachFuncListTy mExportForeachFuncs;
+  SymbolLocationListTy mSymbolLocations;
 
   // Initialize an empty RSInfo with its size of string pool is pStringPoolSize.
   RSInfo(size_t pStringPoolSize);
 
+  // Implemented in RSInfoReader.cpp. Read the RS info in pData. If pMap is
+  // not NULL, pData is its mapped memory and the result RSInfo takes the
+  // ownership of pMap and uses its string pool in place. Otherwise, the
+  // string pool is copied. pMap is released on failure.
+  static RSInfo *Read(const uint8_t *pData, size_t pSize, const char *pName,
+                      const DependencyTableTy &pDeps, android::FileMap *pMap);
+
   // layout() assigns value of offset in each ListHeader (i.e., it decides where
   // data should go in the file.) It also updates fields other than offset to
   // reflect the current RSInfo object states to mHeader.
@@ -212,10 +253,17 @@ public:
   static RSInfo *ExtractFromSource(const Source &pSource,
                                    const DependencyTableTy &pDeps);
 
-  // Implemented in RSInfoReader.cpp.
+  // Implemented in RSInfoReader.cpp. The strings in the returned RSInfo are
+  // served from the mapping of pInput without copying.
   static RSInfo *ReadFromFile(InputFile &pInput,
                               const DependencyTableTy &pDeps);
 
+  // Implemented in RSInfoReader.cpp. Read the RS info in the memory, in the
+  // format of the RS info file. pName is used in the messages.
+  static RSInfo *ReadFromBuffer(const uint8_t *pData, size_t pSize,
+                                const char *pName,
+                                const DependencyTableTy &pDeps);
+
   // Implemneted in RSInfoWriter.cpp
   bool write(OutputFile &pOutput);
 
@@ -238,6 +286,12 @@ public:
   { return mExportFuncNames; }
   inline const ExportForeachFuncListTy &getExportForeachFuncs() const
   { return mExportForeachFuncs; }
+  // Locations of the exported symbols in the object file, recorded when the
+  // object is first loaded. It lists the export vars, then the export funcs
+  // and then three entries for each foreach function (the expanded function,
+  // its tiled variant and the tile dimension.) Empty if not yet recorded.
+  inline const SymbolLocationListTy &getSymbolLocations() const
+  { return mSymbolLocations; }
 
   const char *getStringFromPool(rsinfo::StringIndexTy pStrIdx) const;
   rsinfo::StringIndexTy getStringIdxInPool(const char *pStr) const;
@@ -245,6 +299,8 @@ public:
   // setter
   inline void setThreadable(bool pThreadable = true)
   { mHeader.isThreadable = pThreadable; }
+  inline void setSymbolLocations(const SymbolLocationListTy &pLocations)
+  { mSymbolLocations = pLocations; }
 
 public:
   enum FloatPrecision {
@@ -17,17 +17,57 @@
 #ifndef BCC_RS_TRANSFORMS_H
 #define BCC_RS_TRANSFORMS_H
 
+#include <string>
+#include <vector>
+
 #include "bcc/Renderscript/RSInfo.h"
 
 namespace llvm {
+  class Function;
   class ModulePass;
 }
 
 namespace bcc {
 
+// If pTileCacheSize is non-zero, kernels accessing neighboring cells (via
+// rsGetElementAt()) additionally get a cache-blocked "<name>.expand_tile"
+// variant whose tiles touch about pTileCacheSize bytes of data.
+//
+// If pPrefetchDistance is non-zero, the input element pPrefetchDistance
+// elements ahead is prefetched in each iteration. pNonTemporalStore makes the
+// stores of the kernel results non-temporal.
 llvm::ModulePass *
 createRSForEachExpandPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
-                          bool pEnableStepOpt);
+                          bool pEnableStepOpt, unsigned pTileCacheSize = 0,
+                          unsigned pPrefetchDistance = 0,
+                          bool pNonTemporalStore = false);
+
+// Return true if F reads allocation cells other than the one it is invoked on,
+// i.e., it calls one of the rsGetElementAt() variants, either directly or
+// through the functions defined in the module it calls.
+bool RSForEachHasNeighborAccess(llvm::Function *F);
+
+// Names of the kernels in a fusion group, in the order they are launched.
+typedef std::vector<std::string> RSForEachFusionGroupTy;
+
+// Collect the fusion groups requested by "#pragma rs_fuse(k1, k2, ...)" in
+// pInfo and append them to pGroups.
+void GetRSForEachFusionGroups(const RSInfo &pInfo,
+                              std::vector<RSForEachFusionGroupTy> &pGroups);
+
+// Return the name of the fused function for pGroup, i.e., "k1.k2.expand".
+std::string GetRSForEachFusedName(const RSForEachFusionGroupTy &pGroup);
+
+// Fuse each group of kernels in pGroups into a single expanded function. Groups
+// whose kernels have incompatible signatures, or where a kernel other than the
+// first reads neighboring cells, are skipped.
+llvm::ModulePass *
+createRSForEachFusePass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
+                        const std::vector<RSForEachFusionGroupTy> &pGroups);
+
+// Route the calls to the external functions through a table which is filled
+// when the script is loaded. See RSExecutable::ImportTableSymbolName.
+llvm::ModulePass *createRSImportTablePass();
 
 } // end namespace bcc
 
@@ -47,6 +47,9 @@ public:
   static Source *CreateFromFile(BCCContext &pContext,
                                 const std::string &pPath);
 
+  // A regular file is mapped. Otherwise (e.g., pFd is a pipe), the bitcode is
+  // streamed from pFd as it's parsed, so pFd must stay open until the module
+  // is materialized (i.e., the Source is compiled.)
   static Source *CreateFromFd(BCCContext &pContext, int pFd);
 
   // Create a Source object from an existing module. If pNoDelete
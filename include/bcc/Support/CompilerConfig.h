@@ -54,6 +54,15 @@ private:
   // be a list of strings starting with '+' (enable) or '-' (disable).
   std::string mFeatureString;
 
+  // Distance (in elements) ahead of the current input element to prefetch in
+  // the loops generated by the compiler (e.g., the expanded foreach kernels
+  // in Renderscript.) Zero disables software prefetch.
+  unsigned mPrefetchDistance;
+
+  // Emit non-temporal (streaming) stores for the output of the loops generated
+  // by the compiler. Useful when the output won't be read again soon.
+  bool mNonTemporalStore;
+
 private:
   //===--------------------------------------------------------------------===//
   // These are generated by CompilerConfig during initialize().
@@ -106,6 +115,16 @@ public:
   { return mFeatureString; }
   void setFeatureString(const std::vector<std::string> &pAttrs);
 
+  inline unsigned getPrefetchDistance() const
+  { return mPrefetchDistance; }
+  inline void setPrefetchDistance(unsigned pDistance)
+  { mPrefetchDistance = pDistance; }
+
+  inline bool isNonTemporalStoreEnabled() const
+  { return mNonTemporalStore; }
+  inline void enableNonTemporalStore(bool pEnable = true)
+  { mNonTemporalStore = pEnable; }
+
 public:
   CompilerConfig(const std::string &pTriple);
 
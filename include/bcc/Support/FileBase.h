@@ -134,6 +134,10 @@ public:
   off_t seek(off_t pOffset);
   off_t tell();
 
+  // Return a new file descriptor referring to the opened file (see dup(2)),
+  // owned by the caller. Return -1 (with errno set) on error.
+  int duplicateFD();
+
   inline bool hasError() const
   { return (mError.value() != llvm::errc::success); }
 
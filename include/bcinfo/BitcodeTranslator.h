@@ -18,6 +18,8 @@
 #define __ANDROID_BCINFO_BITCODETRANSLATOR_H__
 
 #include <cstddef>
+#include <string>
+#include <vector>
 
 namespace bcinfo {
 
@@ -29,6 +31,19 @@ class BitcodeTranslator {
   size_t mTranslatedBitcodeSize;
   unsigned int mVersion;
 
+  // Owns the translated bitcode written by translate().
+  std::vector<unsigned char> mTranslatedBuffer;
+
+  std::string mCacheDir;
+  // Mapping of the cache file mTranslatedBitcode points into (if any).
+  void *mCacheMapAddr;
+  size_t mCacheMapSize;
+
+  bool loadFromCache(const std::string &cachePath,
+                     const unsigned char *bitcodeSHA1);
+  void saveToCache(const std::string &cachePath,
+                   const unsigned char *bitcodeSHA1) const;
+
  public:
   /**
    * Translates \p bitcode of a particular \p version to the latest version.
@@ -50,6 +65,18 @@ class BitcodeTranslator {
    */
   bool translate();
 
+  /**
+   * Keep the translated bitcode in \p cacheDir, keyed by the SHA-1 of the
+   * input bitcode, the API version and the translator version, so that
+   * translate() maps the result of the previous translation instead of
+   * translating again.
+   *
+   * \param cacheDir - directory for the cache files. Empty to disable.
+   */
+  void setCacheDir(const char *cacheDir) {
+    mCacheDir = cacheDir;
+  }
+
   /**
    * \return translated bitcode.
    */
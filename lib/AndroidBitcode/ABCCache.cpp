@@ -0,0 +1,388 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/AndroidBitcode/ABCCache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(TARGET_BUILD)
+#include <linux/fs.h>
+#endif
+
+#include "bcc/Config/BuildInfo.h"
+#include "bcc/Support/Log.h"
+#include "bcc/Support/Sha1Util.h"
+
+using namespace bcc;
+
+namespace {
+
+const size_t kPageSize = 4096;
+
+// The system objects linked into every shared object (see
+// ABCCompilerDriver::link().)
+const char *const SystemObjects[] = {
+  "crtbegin_so.o",
+  "crtend_so.o",
+  "libbcc.so",
+};
+
+bool ReadFully(int pFd, void *pBuf, size_t pSize) {
+  uint8_t *buf = reinterpret_cast<uint8_t *>(pBuf);
+  while (pSize > 0) {
+    ssize_t nread = ::read(pFd, buf, pSize);
+    if (nread < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    } else if (nread == 0) {
+      return false;
+    }
+    buf += nread;
+    pSize -= nread;
+  }
+  return true;
+}
+
+bool WriteFully(int pFd, const void *pBuf, size_t pSize) {
+  const uint8_t *buf = reinterpret_cast<const uint8_t *>(pBuf);
+  while (pSize > 0) {
+    ssize_t written = ::write(pFd, buf, pSize);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    pSize -= written;
+  }
+  return true;
+}
+
+// Copy pSize bytes at pOffset of pIn to the current position of pOut. Let the
+// kernel do it if it can.
+bool CopyFileRange(int pIn, off_t pOffset, size_t pSize, int pOut) {
+  while (pSize > 0) {
+    ssize_t copied = ::sendfile(pOut, pIn, &pOffset, pSize);
+    if (copied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if ((errno != EINVAL) && (errno != ENOSYS)) {
+        return false;
+      }
+      break;
+    } else if (copied == 0) {
+      return false;
+    }
+    pSize -= copied;
+  }
+
+  // Fall back to read() and write().
+  char buf[kPageSize];
+  while (pSize > 0) {
+    size_t chunk = (pSize < sizeof(buf)) ? pSize : sizeof(buf);
+    ssize_t nread = ::pread(pIn, buf, chunk, pOffset);
+    if (nread < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    } else if (nread == 0) {
+      return false;
+    }
+    if (!WriteFully(pOut, buf, nread)) {
+      return false;
+    }
+    pOffset += nread;
+    pSize -= nread;
+  }
+
+  return true;
+}
+
+// Share the blocks of the shared object with the output where the file system
+// supports it. pOffset is page-aligned and the data runs to the end of pIn.
+bool CloneFileRange(int pIn, off_t pOffset, int pOut) {
+#if defined(FICLONERANGE)
+  struct file_clone_range range;
+  range.src_fd = pIn;
+  range.src_offset = pOffset;
+  range.src_length = 0; // To the end of the file.
+  range.dest_offset = 0;
+  return (::ioctl(pOut, FICLONERANGE, &range) == 0);
+#else
+  return false;
+#endif
+}
+
+// Empty the output and rewind it, so that both the clone (at offset 0) and the
+// copy (at the current position) write the shared object from the start.
+// Neither applies to a pipe, which is written in sequence anyway.
+void ResetOutput(int pOutputFd) {
+  ::ftruncate(pOutputFd, 0);
+  ::lseek(pOutputFd, 0, SEEK_SET);
+}
+
+std::string GetHexDigest(const uint8_t pDigest[SHA1_DIGEST_LENGTH]) {
+  static const char hex[] = "0123456789abcdef";
+  std::string result;
+  for (size_t i = 0; i < SHA1_DIGEST_LENGTH; i++) {
+    result += hex[pDigest[i] >> 4];
+    result += hex[pDigest[i] & 0xf];
+  }
+  return result;
+}
+
+} // end anonymous namespace
+
+ABCCache::ABCCache(const std::string &pCacheDir, const std::string &pTriple,
+                   const std::string &pAndroidSysroot)
+  : mCacheDir(pCacheDir), mTriple(pTriple), mAndroidSysroot(pAndroidSysroot) {
+}
+
+std::string ABCCache::getEntryPath(const std::string &pKey) const {
+  return mCacheDir + "/" + pKey + ".abcc";
+}
+
+bool ABCCache::getSystemFileDigest(const std::string &pName,
+                                   uint8_t *pResult) const {
+  std::string path = mAndroidSysroot + "/system/lib/" + pName;
+
+  if (::access(path.c_str(), F_OK) != 0) {
+    ::memset(pResult, 0, SHA1_DIGEST_LENGTH);
+    return true;
+  }
+
+  return Sha1Util::GetSHA1DigestFromFile(pResult, path.c_str());
+}
+
+bool ABCCache::getKey(const std::vector<int> &pInputFds,
+                      std::string &pKey) const {
+  std::string key_data("abcc cache " ABCCACHE_VERSION);
+  key_data.append(BuildInfo::GetBuildRev()).append("\n");
+  key_data.append(BuildInfo::GetBuildSourceBlob()).append("\n");
+  key_data.append(mTriple).append("\n");
+
+  uint8_t digest[SHA1_DIGEST_LENGTH];
+  for (size_t i = 0; i < sizeof(SystemObjects) / sizeof(SystemObjects[0]);
+       i++) {
+    if (!getSystemFileDigest(SystemObjects[i], digest)) {
+      return false;
+    }
+    key_data.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+  }
+
+  for (size_t i = 0, e = pInputFds.size(); i != e; i++) {
+    struct stat input_stat;
+    if ((::fstat(pInputFds[i], &input_stat) != 0) ||
+        !S_ISREG(input_stat.st_mode) || (input_stat.st_size == 0)) {
+      ALOGV("Input file descriptor `%d' can't be hashed. Don't cache the "
+            "build.", pInputFds[i]);
+      return false;
+    }
+
+    void *data = ::mmap(NULL, input_stat.st_size, PROT_READ, MAP_PRIVATE,
+                        pInputFds[i], 0);
+    if (data == MAP_FAILED) {
+      ALOGW("Failed to map file descriptor `%d' for hashing! (%s)",
+            pInputFds[i], ::strerror(errno));
+      return false;
+    }
+
+    Sha1Util::GetSHA1DigestFromBuffer(digest,
+                                      reinterpret_cast<const uint8_t *>(data),
+                                      input_stat.st_size);
+    ::munmap(data, input_stat.st_size);
+
+    key_data.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+  }
+
+  Sha1Util::GetSHA1DigestFromBuffer(digest, key_data.data(), key_data.size());
+  pKey = GetHexDigest(digest);
+  return true;
+}
+
+bool ABCCache::load(const std::string &pKey, int pOutputFd) const {
+  std::string path = getEntryPath(pKey);
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  abccache::Header header;
+  struct stat entry_stat;
+  if (!ReadFully(fd, &header, sizeof(header)) ||
+      (::memcmp(header.magic, ABCCACHE_MAGIC, sizeof(header.magic)) != 0) ||
+      (::memcmp(header.version, ABCCACHE_VERSION,
+                sizeof(header.version)) != 0) ||
+      (::fstat(fd, &entry_stat) != 0) ||
+      ((header.dataOffset + header.dataSize) !=
+          static_cast<uint64_t>(entry_stat.st_size))) {
+    ALOGW("Invalid ABC cache file %s. Ignore it.", path.c_str());
+    ::close(fd);
+    return false;
+  }
+
+  // Check the libraries the shared object was linked against.
+  for (uint32_t i = 0; i < header.numDependentLibs; i++) {
+    std::string name;
+    char c;
+    bool read_name;
+    while ((read_name = ReadFully(fd, &c, 1)) && (c != '\0')) {
+      name += c;
+    }
+
+    uint8_t expected[SHA1_DIGEST_LENGTH];
+    uint8_t digest[SHA1_DIGEST_LENGTH];
+    if (!read_name || !ReadFully(fd, expected, sizeof(expected))) {
+      ALOGW("Corrupted ABC cache file %s!", path.c_str());
+      ::close(fd);
+      return false;
+    }
+
+    if (!getSystemFileDigest(name, digest) ||
+        (::memcmp(expected, digest, sizeof(digest)) != 0)) {
+      ALOGV("%s has changed since ABC cache file %s was written.",
+            name.c_str(), path.c_str());
+      ::close(fd);
+      return false;
+    }
+  }
+
+  ResetOutput(pOutputFd);
+  bool result = CloneFileRange(fd, header.dataOffset, pOutputFd) ||
+                CopyFileRange(fd, header.dataOffset, header.dataSize,
+                              pOutputFd);
+  if (!result) {
+    ALOGE("Failed to copy the shared object from ABC cache file %s! (%s)",
+          path.c_str(), ::strerror(errno));
+    // Leave the output empty for the build.
+    ResetOutput(pOutputFd);
+  }
+
+  ::close(fd);
+  return result;
+}
+
+int ABCCache::createScratchFile() const {
+  char pid[16];
+  ::snprintf(pid, sizeof(pid), "%d", ::getpid());
+  std::string path = mCacheDir + "/scratch." + pid;
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    ALOGW("Unable to create scratch file %s! (%s)", path.c_str(),
+          ::strerror(errno));
+    return -1;
+  }
+
+  // Nobody else needs to see it.
+  ::unlink(path.c_str());
+  return fd;
+}
+
+bool ABCCache::CopyFile(int pInputFd, int pOutputFd) {
+  struct stat input_stat;
+  if (::fstat(pInputFd, &input_stat) != 0) {
+    return false;
+  }
+
+  ResetOutput(pOutputFd);
+  if (CloneFileRange(pInputFd, 0, pOutputFd) ||
+      CopyFileRange(pInputFd, 0, input_stat.st_size, pOutputFd)) {
+    return true;
+  }
+
+  ALOGE("Failed to copy the shared object to file descriptor `%d'! (%s)",
+        pOutputFd, ::strerror(errno));
+  ResetOutput(pOutputFd);
+  return false;
+}
+
+bool ABCCache::save(const std::string &pKey, int pOutputFd,
+                    const std::vector<std::string> &pDependentLibs) const {
+  struct stat output_stat;
+  if ((::fstat(pOutputFd, &output_stat) != 0) ||
+      !S_ISREG(output_stat.st_mode)) {
+    ALOGV("Output file descriptor `%d' can't be cached.", pOutputFd);
+    return false;
+  }
+
+  // Lay out the header and the dependent libraries, padded to a page.
+  std::string contents(sizeof(abccache::Header), '\0');
+  uint8_t digest[SHA1_DIGEST_LENGTH];
+  for (size_t i = 0, e = pDependentLibs.size(); i != e; i++) {
+    std::string name = "lib" + pDependentLibs[i] + ".so";
+    if (!getSystemFileDigest(name, digest)) {
+      return false;
+    }
+    contents.append(name.c_str(), name.size() + 1);
+    contents.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+  }
+  contents.resize((contents.size() + kPageSize - 1) & ~(kPageSize - 1), '\0');
+
+  abccache::Header header;
+  ::memcpy(header.magic, ABCCACHE_MAGIC, sizeof(header.magic));
+  ::memcpy(header.version, ABCCACHE_VERSION, sizeof(header.version));
+  header.numDependentLibs = pDependentLibs.size();
+  header.dataOffset = contents.size();
+  header.dataSize = output_stat.st_size;
+  contents.replace(0, sizeof(header), reinterpret_cast<const char *>(&header),
+                   sizeof(header));
+
+  // Write to a temporary file and rename it into place, so that the readers
+  // never see a partial entry.
+  std::string path = getEntryPath(pKey);
+  char pid[16];
+  ::snprintf(pid, sizeof(pid), "%d", ::getpid());
+  std::string tmp_path = path + ".tmp." + pid;
+
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    ALOGW("Unable to create ABC cache file %s! (%s)", tmp_path.c_str(),
+          ::strerror(errno));
+    return false;
+  }
+
+  bool result = WriteFully(fd, contents.data(), contents.size()) &&
+                CopyFileRange(pOutputFd, 0, output_stat.st_size, fd);
+  ::close(fd);
+
+  if (result && (::rename(tmp_path.c_str(), path.c_str()) != 0)) {
+    result = false;
+  }
+
+  if (!result) {
+    ALOGW("Failed to write ABC cache file %s! (%s)", path.c_str(),
+          ::strerror(errno));
+    ::unlink(tmp_path.c_str());
+  }
+
+  return result;
+}
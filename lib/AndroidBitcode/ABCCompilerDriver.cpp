@@ -16,13 +16,24 @@
 
 #include "bcc/AndroidBitcode/ABCCompilerDriver.h"
 
+#include <algorithm>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
 #include <llvm/Module.h>
 #include <llvm/Pass.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/raw_ostream.h>
 #include <mcld/Config/Config.h>
 
+#include "bcc/AndroidBitcode/ABCCache.h"
+#include "bcc/AndroidBitcode/ABCCompiler.h"
+#include "bcc/BCCContext.h"
 #include "bcc/Config/Config.h"
+#include "bcc/Linker.h"
 #include "bcc/Script.h"
 #include "bcc/Source.h"
 #include "bcc/Support/CompilerConfig.h"
@@ -44,35 +55,58 @@
 
 namespace bcc {
 
+struct ABCCompilerDriver::CompileQueue {
+  ABCCompilerDriver *mDriver;
+  std::vector<CompileJob> &mJobs;
+  pthread_mutex_t mLock;
+  size_t mNextJob;
+
+  CompileQueue(ABCCompilerDriver *pDriver,
+               std::vector<CompileJob> &pJobs)
+    : mDriver(pDriver), mJobs(pJobs), mNextJob(0) {
+    pthread_mutex_init(&mLock, NULL);
+  }
+
+  ~CompileQueue() {
+    pthread_mutex_destroy(&mLock);
+  }
+
+  // Return the next job to run or NULL if there's none.
+  CompileJob *next() {
+    CompileJob *job = NULL;
+    pthread_mutex_lock(&mLock);
+    if (mNextJob < mJobs.size()) {
+      job = &mJobs[mNextJob++];
+    }
+    pthread_mutex_unlock(&mLock);
+    return job;
+  }
+};
+
 ABCCompilerDriver::ABCCompilerDriver(const std::string &pTriple)
-  : mContext(), mCompiler(*this), mLinker(),
-    mCompilerConfig(NULL), mLinkerConfig(NULL),
-    mTriple(pTriple), mAndroidSysroot("/") {
+  : mLinker(NULL), mLinkerConfig(NULL), mTriple(pTriple),
+    mAndroidSysroot("/") {
+  pthread_mutex_init(&mIdleCompilersLock, NULL);
 }
 
 ABCCompilerDriver::~ABCCompilerDriver() {
-  delete mCompilerConfig;
+  for (size_t i = 0, e = mIdleCompilers.size(); i != e; i++) {
+    delete mIdleCompilers[i];
+  }
+  pthread_mutex_destroy(&mIdleCompilersLock);
+  delete mLinker;
   delete mLinkerConfig;
 }
 
-bool ABCCompilerDriver::configCompiler() {
-  if (mCompilerConfig != NULL) {
-    return true;
-  }
-
-  mCompilerConfig = new (std::nothrow) CompilerConfig(mTriple);
-  if (mCompilerConfig == NULL) {
-    ALOGE("Out of memory when create the compiler configuration!");
-    return false;
-  }
-
+bool ABCCompilerDriver::configCompiler(ABCCompiler &pCompiler,
+                                       CompilerConfig &pConfig) const {
   // Set PIC mode for relocatables.
-  mCompilerConfig->setRelocationModel(llvm::Reloc::PIC_);
+  pConfig.setRelocationModel(llvm::Reloc::PIC_);
 
   // Set optimization level to -O1.
-  mCompilerConfig->setOptimizationLevel(llvm::CodeGenOpt::Less);
+  pConfig.setOptimizationLevel(llvm::CodeGenOpt::Less);
 
-  Compiler::ErrorCode result = mCompiler.config(*mCompilerConfig);
+  Compiler::ErrorCode result = pCompiler.config(pConfig);
 
   if (result != Compiler::kSuccess) {
     ALOGE("Failed to configure the compiler! (detail: %s)",
@@ -84,10 +118,20 @@ bool ABCCompilerDriver::configCompiler() {
 }
 
 bool ABCCompilerDriver::configLinker() {
-  if (mLinkerConfig != NULL) {
-    return true;
+  // The linker is kept across the builds, so that the system libraries and
+  // objects stay mapped. The configuration records the inputs and is set up
+  // for each build.
+  if (mLinker == NULL) {
+    mLinker = new (std::nothrow) Linker();
+    if (mLinker == NULL) {
+      ALOGE("Out of memory when create the linker!");
+      return false;
+    }
+  } else {
+    mLinker->reset();
   }
 
+  delete mLinkerConfig;
   mLinkerConfig = new (std::nothrow) LinkerConfig(mTriple);
   if (mLinkerConfig == NULL) {
     ALOGE("Out of memory when create the linker configuration!");
@@ -119,7 +163,7 @@ bool ABCCompilerDriver::configLinker() {
   mLinkerConfig->setBsymbolic(true);
 
   // Config the linker.
-  Linker::ErrorCode result = mLinker.config(*mLinkerConfig);
+  Linker::ErrorCode result = mLinker->config(*mLinkerConfig);
   if (result != Linker::kSuccess) {
     ALOGE("Failed to configure the linker! (%s)",
           Linker::GetErrorString(result));
@@ -129,45 +173,133 @@ bool ABCCompilerDriver::configLinker() {
   return true;
 }
 
+size_t ABCCompilerDriver::prepareCompilers(size_t pNumCompilers) {
+  // No compile thread is running, so the lock isn't needed here.
+  while (mIdleCompilers.size() < pNumCompilers) {
+    ABCCompiler *compiler = new (std::nothrow) ABCCompiler(*this);
+    if (compiler == NULL) {
+      ALOGE("Out of memory when create the compiler!");
+      break;
+    }
+
+    CompilerConfig config(mTriple);
+    if (!configCompiler(*compiler, config)) {
+      delete compiler;
+      break;
+    }
+
+    mIdleCompilers.push_back(compiler);
+  }
+
+  return std::min(mIdleCompilers.size(), pNumCompilers);
+}
+
+ABCCompiler *ABCCompilerDriver::acquireCompiler() {
+  ABCCompiler *compiler = NULL;
+
+  pthread_mutex_lock(&mIdleCompilersLock);
+  if (!mIdleCompilers.empty()) {
+    compiler = mIdleCompilers.back();
+    mIdleCompilers.pop_back();
+  }
+  pthread_mutex_unlock(&mIdleCompilersLock);
+
+  if (compiler == NULL) {
+    ALOGE("No configured compiler left for the job!");
+  }
+
+  return compiler;
+}
+
+void ABCCompilerDriver::releaseCompiler(ABCCompiler *pCompiler) {
+  pthread_mutex_lock(&mIdleCompilersLock);
+  mIdleCompilers.push_back(pCompiler);
+  pthread_mutex_unlock(&mIdleCompilersLock);
+  return;
+}
+
 //------------------------------------------------------------------------------
 
-Script *ABCCompilerDriver::prepareScript(int pInputFd) {
-  Source *source = Source::CreateFromFd(mContext, pInputFd);
+bool ABCCompilerDriver::compile(CompileJob &pJob) {
+  // Each job has its own context and compiler as neither is thread-safe.
+  BCCContext context;
+
+  // Prepare the input.
+  Source *source = Source::CreateFromFd(context, pJob.mInputFd);
   if (source == NULL) {
-    ALOGE("Failed to load LLVM module from file descriptor `%d'", pInputFd);
-    return NULL;
+    ALOGE("Failed to load LLVM module from file descriptor `%d'",
+          pJob.mInputFd);
+    return false;
   }
 
   Script *script = new (std::nothrow) Script(*source);
   if (script == NULL) {
     ALOGE("Out of memory when create script for file descriptor `%d'!",
-          pInputFd);
+          pJob.mInputFd);
     delete source;
-    return NULL;
+    return false;
   }
 
-  return script;
-}
-
-bool ABCCompilerDriver::compile(Script &pScript, llvm::raw_ostream &pOutput) {
-  // Config the compiler.
-  if (!configCompiler()) {
+  ABCCompiler *compiler = acquireCompiler();
+  if (compiler == NULL) {
+    delete script;
     return false;
   }
 
   // Run the compiler.
-  Compiler::ErrorCode result = mCompiler.compile(pScript, pOutput);
+  Compiler::ErrorCode result;
+  {
+    llvm::raw_string_ostream output(pJob.mRelocatable);
+    result = compiler->compile(*script, output);
+  }
+
+  releaseCompiler(compiler);
+
   if (result != Compiler::kSuccess) {
     ALOGE("Fatal error during compilation (%s)!",
           Compiler::GetErrorString(result));
+    delete script;
     return false;
   }
 
+  // Read dependent library list.
+  const llvm::Module &module = script->getSource().getModule();
+  for (llvm::Module::lib_iterator lib_iter = module.lib_begin(),
+          lib_end = module.lib_end(); lib_iter != lib_end; ++lib_iter) {
+    pJob.mDependentLibs.push_back(*lib_iter);
+  }
+
+  delete script;
+
   return true;
 }
 
-bool ABCCompilerDriver::link(const Script &pScript,
-                             const std::string &input_relocatable,
+void *ABCCompilerDriver::CompileThread(void *pQueue) {
+  CompileQueue *queue = reinterpret_cast<CompileQueue *>(pQueue);
+
+  while (CompileJob *job = queue->next()) {
+    job->mSuccess = queue->mDriver->compile(*job);
+  }
+
+  return NULL;
+}
+
+void ABCCompilerDriver::GetDependentLibs(const std::vector<CompileJob> &pJobs,
+                                         std::vector<std::string> &pResult) {
+  for (size_t i = 0, e = pJobs.size(); i != e; i++) {
+    const std::vector<std::string> &job_libs = pJobs[i].mDependentLibs;
+    for (size_t j = 0, je = job_libs.size(); j != je; j++) {
+      if (std::find(pResult.begin(), pResult.end(),
+                    job_libs[j]) == pResult.end()) {
+        pResult.push_back(job_libs[j]);
+      }
+    }
+  }
+  return;
+}
+
+bool ABCCompilerDriver::link(const std::vector<CompileJob> &pJobs,
+                             const std::vector<std::string> &pDependentLibs,
                              int pOutputFd) {
   // Config the linker.
   if (!configLinker()) {
@@ -175,7 +307,7 @@ bool ABCCompilerDriver::link(const Script &pScript,
   }
 
   // Prepare output file.
-  Linker::ErrorCode result = mLinker.setOutput(pOutputFd);
+  Linker::ErrorCode result = mLinker->setOutput(pOutputFd);
 
   if (result != Linker::kSuccess) {
     ALOGE("Failed to open the output file! (file descriptor `%d': %s)",
@@ -183,35 +315,37 @@ bool ABCCompilerDriver::link(const Script &pScript,
     return false;
   }
 
-  mLinker.addObject(mAndroidSysroot + "/system/lib/crtbegin_so.o");
+  mLinker->addObject(mAndroidSysroot + "/system/lib/crtbegin_so.o");
 
   // Prepare the relocatables.
   //
   // FIXME: Ugly const_cast here.
-  mLinker.addObject(const_cast<char *>(input_relocatable.data()),
-                    input_relocatable.size());
+  for (size_t i = 0, e = pJobs.size(); i != e; i++) {
+    mLinker->addObject(const_cast<char *>(pJobs[i].mRelocatable.data()),
+                       pJobs[i].mRelocatable.size());
+  }
 
-  // Read dependent library list.
-  const Source &source = pScript.getSource();
-  for (llvm::Module::lib_iterator lib_iter = source.getModule().lib_begin(),
-          lib_end = source.getModule().lib_end(); lib_iter != lib_end;
-       ++lib_iter) {
-    mLinker.addNameSpec(*lib_iter);
+  // Add the dependent libraries of all the inputs.
+  for (size_t i = 0, e = pDependentLibs.size(); i != e; i++) {
+    mLinker->addNameSpec(pDependentLibs[i]);
   }
 
   // TODO: Refactor libbcc/runtime/ to libcompilerRT.so and use it.
-  mLinker.addNameSpec("bcc");
+  mLinker->addNameSpec("bcc");
 
-  mLinker.addObject(mAndroidSysroot + "/system/lib/crtend_so.o");
+  mLinker->addObject(mAndroidSysroot + "/system/lib/crtend_so.o");
 
   // Perform linking.
-  result = mLinker.link();
+  result = mLinker->link();
   if (result != Linker::kSuccess) {
     ALOGE("Failed to link the shared object (detail: %s)",
           Linker::GetErrorString(result));
     return false;
   }
 
+  // Write out the rest of the output now.
+  mLinker->reset();
+
   return true;
 }
 
@@ -256,55 +390,128 @@ ABCCompilerDriver *ABCCompilerDriver::Create(const std::string &pTriple) {
 }
 
 bool ABCCompilerDriver::build(int pInputFd, int pOutputFd) {
-  //===--------------------------------------------------------------------===//
-  // Prepare the input.
-  //===--------------------------------------------------------------------===//
-  Script *script = prepareScript(pInputFd);
-  if (script == NULL) {
+  return build(std::vector<int>(1, pInputFd), pOutputFd);
+}
+
+bool ABCCompilerDriver::build(const std::vector<int> &pInputFds,
+                              int pOutputFd) {
+  if (pInputFds.empty()) {
+    ALOGE("No input to build!");
     return false;
   }
 
   //===--------------------------------------------------------------------===//
-  // Prepare the output.
+  // Look up the cache.
   //===--------------------------------------------------------------------===//
-  std::string output_relocatable;
-  llvm::raw_ostream *output =
-      new (std::nothrow) llvm::raw_string_ostream(output_relocatable);
-  if (output == NULL) {
-    ALOGE("Failed to prepare the output for compile the input from %d into "
-          "relocatable object!", pInputFd);
-    delete script;
-    return false;
+  ABCCache cache(mCacheDir, mTriple, mAndroidSysroot);
+  std::string cache_key;
+  bool use_cache = !mCacheDir.empty() && cache.getKey(pInputFds, cache_key);
+
+  if (use_cache && cache.load(cache_key, pOutputFd)) {
+    ALOGV("Reuse the shared object %s in the ABC cache.", cache_key.c_str());
+    return true;
   }
 
   //===--------------------------------------------------------------------===//
-  // Compile.
+  // Prepare the jobs.
   //===--------------------------------------------------------------------===//
-  if (!compile(*script, *output)) {
-    delete output;
-    delete script;
-    return false;
+  std::vector<CompileJob> jobs(pInputFds.size());
+  for (size_t i = 0, e = pInputFds.size(); i != e; i++) {
+    jobs[i].mInputFd = pInputFds[i];
+    jobs[i].mSuccess = false;
   }
 
   //===--------------------------------------------------------------------===//
-  // Close the output.
+  // Compile. The calling thread takes part and the others are only started
+  // when there's more than one input, up to the number of CPUs.
   //===--------------------------------------------------------------------===//
-  delete output;
+  CompileQueue queue(this, jobs);
+
+  long num_cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+  size_t num_threads = std::min(jobs.size(),
+                                static_cast<size_t>((num_cpus > 0) ? num_cpus :
+                                                                     1));
+  if ((num_threads > 1) && !llvm::llvm_start_multithreaded()) {
+    ALOGW("LLVM was built without thread support. Compile the inputs "
+          "serially.");
+    num_threads = 1;
+  }
 
-  //===--------------------------------------------------------------------===//
-  // Link.
-  //===--------------------------------------------------------------------===//
-  if (!link(*script, output_relocatable, pOutputFd)) {
-    delete script;
+  // Configuring a compiler sets process-wide LLVM options (e.g. the default
+  // register allocator), so configure one for each thread up front.
+  num_threads = prepareCompilers(num_threads);
+  if (num_threads == 0) {
     return false;
   }
 
+  std::vector<pthread_t> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, CompileThread, &queue) != 0) {
+      ALOGW("Failed to create the compile thread #%zu!", i);
+      break;
+    }
+    threads.push_back(thread);
+  }
+
+  CompileThread(&queue);
+
+  for (size_t i = 0, e = threads.size(); i != e; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (size_t i = 0, e = jobs.size(); i != e; i++) {
+    if (!jobs[i].mSuccess) {
+      ALOGE("Failed to compile the input from file descriptor `%d'!",
+            jobs[i].mInputFd);
+      return false;
+    }
+  }
+
   //===--------------------------------------------------------------------===//
-  // Clean up.
+  // Link.
   //===--------------------------------------------------------------------===//
-  delete script;
+  std::vector<std::string> libs;
+  GetDependentLibs(jobs, libs);
+
+  // The cache reads the shared object back from the output. The installer
+  // usually passes a write-only fd, so link into a scratch file in the cache
+  // directory then, and copy it to the output afterwards.
+  int link_fd = pOutputFd;
+  if (use_cache) {
+    int flags = ::fcntl(pOutputFd, F_GETFL);
+    if ((flags < 0) || ((flags & O_ACCMODE) != O_RDWR)) {
+      link_fd = cache.createScratchFile();
+      if (link_fd < 0) {
+        ALOGW("Output file descriptor `%d' can't be read back. Don't cache the "
+              "build.", pOutputFd);
+        link_fd = pOutputFd;
+        use_cache = false;
+      }
+    }
+  }
 
-  return true;
+  // The linker takes over the fd it links into, so keep a duplicate of it to
+  // read the shared object back.
+  int cache_fd = use_cache ? ::dup(link_fd) : -1;
+  if ((cache_fd < 0) && (link_fd != pOutputFd)) {
+    ::close(link_fd);
+    link_fd = pOutputFd;
+  }
+
+  bool result = link(jobs, libs, link_fd);
+
+  if (cache_fd >= 0) {
+    if (result) {
+      cache.save(cache_key, cache_fd, libs);
+      if (link_fd != pOutputFd) {
+        result = ABCCache::CopyFile(cache_fd, pOutputFd);
+      }
+    }
+    ::close(cache_fd);
+  }
+
+  return result;
 }
 
 } // namespace bcc
@@ -22,6 +22,7 @@ LOCAL_PATH := $(call my-dir)
 #=====================================================================
 
 libbcc_androidbitcode_SRC_FILES := \
+  ABCCache.cpp \
   ABCCompiler.cpp \
   ABCExpandVAArgPass.cpp \
   ABCCompilerDriver.cpp
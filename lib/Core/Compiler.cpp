@@ -92,12 +92,15 @@ const char *Compiler::GetErrorString(enum ErrorCode pErrCode) {
 //===----------------------------------------------------------------------===//
 // Instance Methods
 //===----------------------------------------------------------------------===//
-Compiler::Compiler() : mTarget(NULL), mEnableLTO(true) {
+Compiler::Compiler() : mTarget(NULL), mEnableLTO(true), mPrefetchDistance(0),
+                       mNonTemporalStore(false) {
   return;
 }
 
 Compiler::Compiler(const CompilerConfig &pConfig) : mTarget(NULL),
-                                                    mEnableLTO(true) {
+                                                    mEnableLTO(true),
+                                                    mPrefetchDistance(0),
+                                                    mNonTemporalStore(false) {
   const std::string &triple = pConfig.getTriple();
 
   enum ErrorCode err = config(pConfig);
@@ -145,6 +148,9 @@ enum Compiler::ErrorCode Compiler::config(const CompilerConfig &pConfig) {
   // Relax all machine instructions.
   mTarget->setMCRelaxAll(true);
 
+  mPrefetchDistance = pConfig.getPrefetchDistance();
+  mNonTemporalStore = pConfig.isNonTemporalStoreEnabled();
+
   return kSuccess;
 }
 
@@ -19,6 +19,8 @@
 #include "bcc/Support/MemoryFactory.h"
 #include "bcc/Support/Log.h"
 
+#include <sys/stat.h>
+
 #include <llvm/Support/ELF.h>
 
 #include <mcld/MC/MCLDDriver.h>
@@ -79,13 +81,15 @@ const char* Linker::GetErrorString(enum Linker::ErrorCode pErrCode) {
 // Linker
 //===----------------------------------------------------------------------===//
 Linker::Linker()
-  : mBackend(NULL), mDriver(NULL), mMemAreaFactory(NULL), mLDInfo(NULL),
-    mRoot(NULL), mShared(false) {
+  : mBackend(NULL), mDriver(NULL), mMemAreaFactory(NULL),
+    mInputAreaFactory(NULL), mOutputArea(NULL), mLDInfo(NULL), mRoot(NULL),
+    mShared(false) {
 }
 
 Linker::Linker(const LinkerConfig& pConfig)
-  : mBackend(NULL), mDriver(NULL), mMemAreaFactory(NULL), mLDInfo(NULL),
-    mRoot(NULL), mShared(false) {
+  : mBackend(NULL), mDriver(NULL), mMemAreaFactory(NULL),
+    mInputAreaFactory(NULL), mOutputArea(NULL), mLDInfo(NULL), mRoot(NULL),
+    mShared(false) {
 
   const std::string &triple = pConfig.getTriple();
 
@@ -101,6 +105,7 @@ Linker::Linker(const LinkerConfig& pConfig)
 Linker::~Linker() {
   delete mDriver;
   delete mBackend;
+  delete mInputAreaFactory;
   delete mMemAreaFactory;
   delete mRoot;
 }
@@ -130,7 +135,13 @@ enum Linker::ErrorCode Linker::config(const LinkerConfig& pConfig) {
     return kCreateBackend;
   }
 
-  mMemAreaFactory = new MemoryFactory();
+  // The factory of the files opened by path is kept across reset().
+  if (mMemAreaFactory == NULL) {
+    mMemAreaFactory = new MemoryFactory();
+  }
+  if (mInputAreaFactory == NULL) {
+    mInputAreaFactory = new MemoryFactory();
+  }
 
   mDriver = new mcld::MCLDDriver(*mLDInfo, *mBackend, *mMemAreaFactory);
 
@@ -139,6 +150,34 @@ enum Linker::ErrorCode Linker::config(const LinkerConfig& pConfig) {
   return kSuccess;
 }
 
+void Linker::reset() {
+  if (mOutputArea != NULL) {
+    mMemAreaFactory->destruct(mOutputArea);
+    mOutputArea = NULL;
+  }
+
+  // The backend and the driver hold the sections, the symbols and the
+  // segments of the last link and can't be cleared, so they're created again
+  // by config().
+  delete mDriver;
+  delete mBackend;
+  delete mRoot;
+  mDriver = NULL;
+  mBackend = NULL;
+  mRoot = NULL;
+
+  // The memory inputs are owned by the caller and may be gone by the next
+  // link.
+  delete mInputAreaFactory;
+  mInputAreaFactory = NULL;
+
+  mLDInfo = NULL;
+  mShared = false;
+  mSOName.clear();
+
+  return;
+}
+
 void Linker::advanceRoot() {
   if (mRoot->isRoot()) {
     mRoot->move<mcld::TreeIteratorBase::Leftward>();
@@ -148,12 +187,50 @@ void Linker::advanceRoot() {
   return;
 }
 
+bool Linker::updateFileStamp(const std::string &pPath) {
+  struct stat file_stat;
+  if (::stat(pPath.c_str(), &file_stat) != 0) {
+    // Let the factory report the error, and open the file again next time.
+    return (mFileStamps.erase(pPath) > 0);
+  }
+
+  FileStamp stamp;
+  stamp.mDev = file_stat.st_dev;
+  stamp.mIno = file_stat.st_ino;
+  stamp.mSize = file_stat.st_size;
+  stamp.mMTime = file_stat.st_mtime;
+
+  std::map<std::string, FileStamp>::iterator it = mFileStamps.find(pPath);
+  if (it == mFileStamps.end()) {
+    mFileStamps.insert(std::make_pair(pPath, stamp));
+    return false;
+  }
+
+  bool changed = (it->second.mDev != stamp.mDev) ||
+                 (it->second.mIno != stamp.mIno) ||
+                 (it->second.mSize != stamp.mSize) ||
+                 (it->second.mMTime != stamp.mMTime);
+  it->second = stamp;
+  return changed;
+}
+
 enum Linker::ErrorCode Linker::openFile(const mcld::sys::fs::Path& pPath,
                                         enum Linker::ErrorCode pCode,
                                         mcld::Input& pInput) {
+  bool changed = updateFileStamp(pPath.native());
+
   mcld::MemoryArea *input_memory = mMemAreaFactory->produce(pPath,
                                                     mcld::FileHandle::ReadOnly);
 
+  // The factory returns the area of an earlier link for the same path. Don't
+  // link against the old contents of a file which has changed since.
+  if (changed) {
+    ALOGV("%s has changed since the last link. Open it again.",
+          pPath.native().c_str());
+    mMemAreaFactory->destruct(input_memory);
+    input_memory = mMemAreaFactory->produce(pPath, mcld::FileHandle::ReadOnly);
+  }
+
   if (input_memory->handler()->isGood()) {
     pInput.setMemArea(input_memory);
   } else {
@@ -227,7 +304,7 @@ enum Linker::ErrorCode Linker::addObject(void* pMemory, size_t pSize) {
 
   advanceRoot();
 
-  mcld::MemoryArea *input_memory = mMemAreaFactory->produce(pMemory, pSize);
+  mcld::MemoryArea *input_memory = mInputAreaFactory->produce(pMemory, pSize);
   input->setMemArea(input_memory);
 
   mcld::LDContext *input_context = mLDInfo->contextFactory().produce();
@@ -245,7 +322,7 @@ enum Linker::ErrorCode Linker::addCode(void* pMemory, size_t pSize) {
 
   advanceRoot();
 
-  mcld::MemoryArea *input_memory = mMemAreaFactory->produce(pMemory, pSize);
+  mcld::MemoryArea *input_memory = mInputAreaFactory->produce(pMemory, pSize);
   input->setMemArea(input_memory);
 
   mcld::LDContext *input_context = mLDInfo->contextFactory().produce();
@@ -308,6 +385,7 @@ enum Linker::ErrorCode Linker::setOutput(const std::string &pPath) {
                         mcld::FileHandle::Truncate |
                         mcld::FileHandle::Create,
                       perm);
+  mOutputArea = out_area;
 
   if (!out_area->handler()->isGood()) {
     return kOpenOutput;
@@ -342,6 +420,7 @@ enum Linker::ErrorCode Linker::setOutput(int pFileHandler) {
 
   // -----  initialize output file  ----- //
   mcld::MemoryArea* out_area = mMemAreaFactory->produce(pFileHandler);
+  mOutputArea = out_area;
 
   mLDInfo->output().setType(mcld::Output::DynObj);
   mLDInfo->output().setMemArea(out_area);
@@ -16,12 +16,21 @@
 
 #include "bcc/Source.h"
 
+#include <cerrno>
+#include <cstring>
 #include <new>
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <llvm/Bitcode/ReaderWriter.h>
 #include <llvm/LLVMContext.h>
 #include <llvm/Linker.h>
 #include <llvm/Module.h>
+#include <llvm/Support/DataStream.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/system_error.h>
 
@@ -49,6 +58,203 @@ static inline llvm::Module *helper_load_bitcode(llvm::LLVMContext &pContext,
   return module;
 }
 
+// A read-only private mapping of a bitcode file. llvm::MemoryBuffer::getFile()
+// and getOpenFile() may read the whole file into the heap, where it stays as
+// long as the lazily loaded module. With the mapping, the bitcode is paged in
+// from the file as the reader goes and can be dropped under memory pressure.
+class MappedBitcodeBuffer : public llvm::MemoryBuffer {
+private:
+  std::string mName;
+  void *mMapAddr;
+  size_t mMapSize;
+
+  MappedBitcodeBuffer(const std::string &pName, void *pMapAddr,
+                      size_t pMapSize)
+    : mName(pName), mMapAddr(pMapAddr), mMapSize(pMapSize) {
+    const char *begin = reinterpret_cast<const char *>(pMapAddr);
+    // The bitcode reader doesn't need the NUL terminator.
+    init(begin, begin + pMapSize, /* RequiresNullTerminator */false);
+  }
+
+public:
+  // Map the whole file pFd. Return NULL if it can't be mapped (e.g., it's not
+  // a regular file.) pFd can be closed once this returns.
+  static MappedBitcodeBuffer *Create(int pFd, const std::string &pName) {
+    struct stat file_stat;
+    if ((::fstat(pFd, &file_stat) != 0) || !S_ISREG(file_stat.st_mode) ||
+        (file_stat.st_size <= 0)) {
+      return NULL;
+    }
+
+    size_t size = static_cast<size_t>(file_stat.st_size);
+    void *addr = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, pFd, 0);
+    if (addr == MAP_FAILED) {
+      return NULL;
+    }
+
+    // The reader walks the whole file while parsing the module and again when
+    // materializing the functions, so start the readahead now.
+    ::madvise(addr, size, MADV_WILLNEED);
+
+    MappedBitcodeBuffer *result =
+        new (std::nothrow) MappedBitcodeBuffer(pName, addr, size);
+    if (result == NULL) {
+      ::munmap(addr, size);
+    }
+    return result;
+  }
+
+  virtual const char *getBufferIdentifier() const
+  { return mName.c_str(); }
+
+  virtual BufferKind getBufferKind() const
+  { return MemoryBuffer_MMap; }
+
+  virtual ~MappedBitcodeBuffer() {
+    ::munmap(mMapAddr, mMapSize);
+  }
+};
+
+// Feed the bitcode reader from a file descriptor (e.g., a pipe from the
+// installer) as the data arrives, so the module is parsed and its functions
+// materialized while the rest of the input is still on the way.
+//
+// The bitcode wrapper header (magic 0x0B17C0DE, see bcinfo/BitcodeWrapper.h)
+// is stripped here. The streaming reader of LLVM 3.1 checks the wrapper
+// against the first 16 bytes of the stream only, so it rejects any real
+// wrapper and the module fails to parse.
+class FdDataStreamer : public llvm::DataStreamer {
+private:
+  // The leading fields of the wrapper header: magic, version, offset and size
+  // of the bitcode, each a little-endian 32-bit word.
+  enum { kWrapperHeaderSize = 16 };
+
+  int mFd;
+  bool mStarted;
+
+  // Bytes read to look for the wrapper, which are plain bitcode.
+  unsigned char mPending[kWrapperHeaderSize];
+  size_t mPendingBegin;
+  size_t mPendingEnd;
+
+  // Bytes of the bitcode left in a wrapped input. Unlimited otherwise.
+  size_t mRemaining;
+
+  size_t readFully(unsigned char *pBuf, size_t pLen) {
+    size_t total = 0;
+    while (total < pLen) {
+      ssize_t bytes = ::read(mFd, pBuf + total, pLen - total);
+      if (bytes < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ALOGE("Failed to read bitcode from file descriptor %d! (%s)", mFd,
+              ::strerror(errno));
+        break;
+      } else if (bytes == 0) {
+        break;
+      }
+      total += bytes;
+    }
+    return total;
+  }
+
+  static uint32_t ReadLE32(const unsigned char *pBuf) {
+    return (static_cast<uint32_t>(pBuf[0])) |
+           (static_cast<uint32_t>(pBuf[1]) << 8) |
+           (static_cast<uint32_t>(pBuf[2]) << 16) |
+           (static_cast<uint32_t>(pBuf[3]) << 24);
+  }
+
+  // Skip the wrapper header if there's one. Return false on error.
+  bool start() {
+    mPendingEnd = readFully(mPending, sizeof(mPending));
+    if ((mPendingEnd < sizeof(mPending)) ||
+        (ReadLE32(mPending) != 0x0B17C0DE)) {
+      // Plain bitcode (or too short to be anything else.)
+      return true;
+    }
+
+    uint32_t offset = ReadLE32(mPending + 8);
+    uint32_t size = ReadLE32(mPending + 12);
+    if (offset < sizeof(mPending)) {
+      ALOGE("Invalid bitcode wrapper from file descriptor %d!", mFd);
+      return false;
+    }
+
+    // Discard the rest of the header.
+    unsigned char buf[256];
+    for (size_t left = offset - sizeof(mPending); left > 0; ) {
+      size_t chunk = (left < sizeof(buf)) ? left : sizeof(buf);
+      if (readFully(buf, chunk) != chunk) {
+        ALOGE("Truncated bitcode wrapper from file descriptor %d!", mFd);
+        return false;
+      }
+      left -= chunk;
+    }
+
+    mPendingEnd = 0;
+    mRemaining = size;
+    return true;
+  }
+
+public:
+  FdDataStreamer(int pFd)
+    : mFd(pFd), mStarted(false), mPendingBegin(0), mPendingEnd(0),
+      mRemaining(static_cast<size_t>(-1)) { }
+
+  // The reader takes a short read as the end of the input, so keep reading
+  // until pLen bytes have arrived or the end is reached.
+  virtual size_t GetBytes(unsigned char *pBuf, size_t pLen) {
+    if (!mStarted) {
+      mStarted = true;
+      if (!start()) {
+        // Let the reader report the empty input.
+        mPendingEnd = 0;
+        mRemaining = 0;
+      }
+    }
+
+    size_t total = 0;
+    if (mPendingBegin < mPendingEnd) {
+      size_t pending = mPendingEnd - mPendingBegin;
+      total = (pending < pLen) ? pending : pLen;
+      ::memcpy(pBuf, mPending + mPendingBegin, total);
+      mPendingBegin += total;
+    }
+
+    size_t want = pLen - total;
+    if (want > mRemaining) {
+      want = mRemaining;
+    }
+    size_t bytes = readFully(pBuf + total, want);
+    if (mRemaining != static_cast<size_t>(-1)) {
+      mRemaining -= bytes;
+    }
+    return total + bytes;
+  }
+};
+
+// Helper function to create the Source from the bitcode buffer pInput. Take
+// the ownership of pInput.
+static inline bcc::Source *helper_create_source(bcc::BCCContext &pContext,
+                                                llvm::MemoryBuffer *pInput) {
+  llvm::Module *module = helper_load_bitcode(pContext.mImpl->mLLVMContext,
+                                             pInput);
+  if (module == NULL) {
+    delete pInput;
+    return NULL;
+  }
+
+  bcc::Source *result =
+      bcc::Source::CreateFromModule(pContext, *module, /* pNoDelete */false);
+  if (result == NULL) {
+    delete module;
+  }
+
+  return result;
+}
+
 } // end anonymous namespace
 
 namespace bcc {
@@ -66,64 +272,60 @@ Source *Source::CreateFromBuffer(BCCContext &pContext,
     return NULL;
   }
 
-  llvm::Module *module = helper_load_bitcode(pContext.mImpl->mLLVMContext,
-                                             input_memory);
-  if (module == NULL) {
-    delete input_memory;
-    return NULL;
-  }
-
-  Source *result = CreateFromModule(pContext, *module, /* pNoDelete */false);
-  if (result == NULL) {
-    delete module;
-  }
-
-  return result;
+  return helper_create_source(pContext, input_memory);
 }
 
 Source *Source::CreateFromFile(BCCContext &pContext, const std::string &pPath) {
-  llvm::OwningPtr<llvm::MemoryBuffer> input_data;
+  llvm::MemoryBuffer *input_memory = NULL;
 
-  llvm::error_code ec = llvm::MemoryBuffer::getFile(pPath, input_data);
-  if (ec != llvm::error_code::success()) {
-    ALOGE("Failed to load bitcode from path %s! (%s)", pPath.c_str(),
-                                                       ec.message().c_str());
-    return NULL;
+  int fd = ::open(pPath.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    input_memory = MappedBitcodeBuffer::Create(fd, pPath);
+    ::close(fd);
   }
 
-  llvm::MemoryBuffer *input_memory = input_data.take();
-  llvm::Module *module = helper_load_bitcode(pContext.mImpl->mLLVMContext,
-                                             input_memory);
-  if (module == NULL) {
-    delete input_memory;
-    return NULL;
-  }
+  if (input_memory == NULL) {
+    // Fall back to let LLVM read the file.
+    llvm::OwningPtr<llvm::MemoryBuffer> input_data;
 
-  Source *result = CreateFromModule(pContext, *module, /* pNoDelete */false);
-  if (result == NULL) {
-    delete module;
+    llvm::error_code ec = llvm::MemoryBuffer::getFile(pPath, input_data);
+    if (ec != llvm::error_code::success()) {
+      ALOGE("Failed to load bitcode from path %s! (%s)", pPath.c_str(),
+                                                         ec.message().c_str());
+      return NULL;
+    }
+
+    input_memory = input_data.take();
   }
 
-  return result;
+  return helper_create_source(pContext, input_memory);
 }
 
 Source *Source::CreateFromFd(BCCContext &pContext, int pFd) {
-  llvm::OwningPtr<llvm::MemoryBuffer> input_data;
+  llvm::MemoryBuffer *input_memory =
+      MappedBitcodeBuffer::Create(pFd, /* pName */"");
 
-  llvm::error_code ec =
-      llvm::MemoryBuffer::getOpenFile(pFd, /* Filename */"", input_data);
+  if (input_memory != NULL) {
+    return helper_create_source(pContext, input_memory);
+  }
 
-  if (ec != llvm::error_code::success()) {
-    ALOGE("Failed to load bitcode from file descriptor %d! (%s)",
-          pFd, ec.message().c_str());
+  // Not a regular file. Stream the bitcode instead of waiting for the whole
+  // input to arrive.
+  FdDataStreamer *streamer = new (std::nothrow) FdDataStreamer(pFd);
+  if (streamer == NULL) {
+    ALOGE("Out of memory when create the bitcode streamer for file descriptor "
+          "%d!", pFd);
     return NULL;
   }
 
-  llvm::MemoryBuffer *input_memory = input_data.take();
-  llvm::Module *module = helper_load_bitcode(pContext.mImpl->mLLVMContext,
-                                             input_memory);
+  // The module takes the ownership of streamer even on error.
+  std::string error;
+  llvm::Module *module =
+      llvm::getStreamedBitcodeModule(/* name */"", streamer,
+                                     pContext.mImpl->mLLVMContext, &error);
   if (module == NULL) {
-    delete input_memory;
+    ALOGE("Unable to parse the bitcode from file descriptor %d! (%s)", pFd,
+          error.c_str());
     return NULL;
   }
 
@@ -28,6 +28,8 @@ libbcc_executionengine_SRC_FILES := \
   GDBJIT.cpp \
   GDBJITRegistrar.cpp \
   ObjectLoader.cpp \
+  PerfJITRecorder.cpp \
+  RelocationCache.cpp \
   SymbolResolverProxy.cpp \
   SymbolResolvers.cpp
 
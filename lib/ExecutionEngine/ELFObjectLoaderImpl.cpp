@@ -130,6 +130,56 @@ size_t ELFObjectLoaderImpl::getSymbolSize(const char *pName) const {
 
 }
 
+bool ELFObjectLoaderImpl::getSymbolLocation(const char *pName,
+                                            unsigned &pSectionIdx,
+                                            size_t &pOffset) const {
+  if (mSymTab == NULL) {
+    return false;
+  }
+
+  const ELFSymbol<32> *symbol = mSymTab->getByName(pName);
+  if (symbol == NULL) {
+    ALOGV("Request symbol '%s' is not found in the object!", pName);
+    return false;
+  }
+
+  // Undefined, absolute and common symbols don't live in a section of the
+  // object.
+  unsigned section_idx = symbol->getSectionIndex();
+  if ((section_idx == llvm::ELF::SHN_UNDEF) ||
+      (section_idx >= llvm::ELF::SHN_LORESERVE)) {
+    return false;
+  }
+
+  pSectionIdx = section_idx;
+  // st_value holds the offset from the beginning of the section in a
+  // relocatable object.
+  pOffset = static_cast<size_t>(symbol->getValue());
+  return true;
+}
+
+void *ELFObjectLoaderImpl::getSectionAddress(unsigned pSectionIdx) const {
+  const ELFSectionHeaderTable<32> *shtab = mObject->getSectionHeaderTable();
+  if (pSectionIdx >= shtab->size()) {
+    return NULL;
+  }
+
+  const ELFSectionHeader<32> *sh = (*shtab)[pSectionIdx];
+  if (!(sh->getFlags() & llvm::ELF::SHF_ALLOC) ||
+      ((sh->getType() != llvm::ELF::SHT_PROGBITS) &&
+       (sh->getType() != llvm::ELF::SHT_NOBITS))) {
+    return NULL;
+  }
+
+  ELFSectionBits<32> *section =
+      static_cast<ELFSectionBits<32> *>(mObject->getSectionByIndex(pSectionIdx));
+  if (section == NULL) {
+    return NULL;
+  }
+
+  return section->getBuffer();
+}
+
 bool
 ELFObjectLoaderImpl::getSymbolNameList(android::Vector<const char *>& pNameList,
                                        ObjectLoader::SymbolType pType) const {
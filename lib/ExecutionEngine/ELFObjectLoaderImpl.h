@@ -47,6 +47,11 @@ public:
 
   virtual size_t getSymbolSize(const char *pName) const;
 
+  virtual bool getSymbolLocation(const char *pName, unsigned &pSectionIdx,
+                                 size_t &pOffset) const;
+
+  virtual void *getSectionAddress(unsigned pSectionIdx) const;
+
   virtual bool getSymbolNameList(android::Vector<const char *>& pNameList,
                                  ObjectLoader::SymbolType pType) const;
   ~ELFObjectLoaderImpl();
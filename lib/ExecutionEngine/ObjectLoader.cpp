@@ -16,20 +16,67 @@
 
 #include "bcc/ExecutionEngine/ObjectLoader.h"
 
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <utils/FileMap.h>
 
 #include "bcc/ExecutionEngine/GDBJITRegistrar.h"
+#include "bcc/ExecutionEngine/PerfJITRecorder.h"
 #include "bcc/Support/FileBase.h"
 #include "bcc/Support/Log.h"
+#include "bcc/Support/Properties.h"
 
 #include "ELFObjectLoaderImpl.h"
 
 using namespace bcc;
 
+namespace {
+
+// Return true if the process is being traced (e.g., by gdbserver.)
+bool IsDebuggerAttached() {
+  FILE *status = ::fopen("/proc/self/status", "r");
+  if (status == NULL) {
+    return false;
+  }
+
+  char line[256];
+  int tracer_pid = 0;
+  while (::fgets(line, sizeof(line), status) != NULL) {
+    if (::sscanf(line, "TracerPid: %d", &tracer_pid) == 1) {
+      break;
+    }
+  }
+  ::fclose(status);
+
+  return (tracer_pid != 0);
+}
+
+// Return true if the debug image should be built at load time: a debugger is
+// already attached, or debug.bcc.gdb is set for debuggers attached later.
+bool ShouldRegisterAtLoad() {
+  return IsPropertyEnabled("debug.bcc.gdb") || IsDebuggerAttached();
+}
+
+} // end anonymous namespace
+
 ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
                                  const char *pName,
                                  SymbolResolverInterface &pResolver,
                                  bool pEnableGDBDebug) {
+  return Load(pMemStart, pMemSize, pName, pResolver, pEnableGDBDebug,
+              /* pDebugFD */-1);
+}
+
+ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
+                                 const char *pName,
+                                 SymbolResolverInterface &pResolver,
+                                 bool pEnableGDBDebug, int pDebugFD) {
   ObjectLoader *result = NULL;
 
   // Check parameters.
@@ -46,6 +93,16 @@ ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
     goto bail;
   }
 
+  // The loader owns pDebugFD from now on.
+  result->mDebugFD = pDebugFD;
+  pDebugFD = -1;
+  if (result->mDebugFD >= 0) {
+    struct stat file_stat;
+    if (::fstat(result->mDebugFD, &file_stat) == 0) {
+      result->mDebugFileMTime = file_stat.st_mtime;
+    }
+  }
+
   // Currently, only ELF object loader is supported. Therefore, there's no codes
   // to detect the object file type and to select the one appropriated. Directly
   // try out the ELF object loader.
@@ -67,27 +124,35 @@ ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
     goto bail;
   }
 
+  // Let perf know the functions when requested.
+  PerfJITRecorder::GetInstance().recordObject(*result, pName);
+
   // GDB debugging is enabled. Note that error occurrs during the setup of
   // debugging won't failed the object load. Only a warning is issued to notify
   // that the debugging is disabled due to the failure.
-  if (pEnableGDBDebug) {
-    // GDB's JIT debugging requires the source object file corresponded to the
-    // process image desired to debug with. And some fields in the object file
-    // must be updated to record the runtime information after it's loaded into
-    // memory. For example, GDB's JIT debugging requires an ELF file with the
-    // value of sh_addr in the section header to be the memory address that the
-    // section lives in the process image. Therefore, a writable memory with its
-    // contents initialized to the contents of pFile is created.
-    result->mDebugImage = new (std::nothrow) uint8_t [ pMemSize ];
-    if (result->mDebugImage != NULL) {
-      ::memcpy(result->mDebugImage, pMemStart, pMemSize);
-      if (!result->mImpl->prepareDebugImage(result->mDebugImage, pMemSize)) {
+  //
+  // The debug image is only built now if a debugger is already attached or
+  // debug.bcc.gdb is set. Otherwise, it's built by registerWithGDB() on
+  // request.
+  result->mEnableGDBDebug = pEnableGDBDebug;
+  result->mDebugImageSize = pMemSize;
+  if (pEnableGDBDebug && ShouldRegisterAtLoad()) {
+    if (result->mDebugFD >= 0) {
+      if (!result->registerWithGDB()) {
         ALOGW("GDB debug for %s is enabled by the user but won't work due to "
               "failure debug image preparation!", pName);
-      } else {
-        registerObjectWithGDB(
-            reinterpret_cast<const ObjectBuffer *>(result->mDebugImage),
-            pMemSize);
+      }
+    } else {
+      // pMemStart is not guaranteed to live after the load. The image has to
+      // be copied now.
+      uint8_t *debug_image = new (std::nothrow) uint8_t [ pMemSize ];
+      if (debug_image != NULL) {
+        ::memcpy(debug_image, pMemStart, pMemSize);
+        if (!result->registerDebugImage(debug_image, /* pIsMapped */false)) {
+          ALOGW("GDB debug for %s is enabled by the user but won't work due "
+                "to failure debug image preparation!", pName);
+          delete [] debug_image;
+        }
       }
     }
   }
@@ -95,6 +160,9 @@ ObjectLoader *ObjectLoader::Load(void *pMemStart, size_t pMemSize,
   return result;
 
 bail:
+  if (pDebugFD >= 0) {
+    ::close(pDebugFD);
+  }
   delete result;
   return NULL;
 }
@@ -136,9 +204,21 @@ ObjectLoader *ObjectLoader::Load(FileBase &pFile,
     return NULL;
   }
 
+  // Keep a descriptor of the file to build the debug image from. It refers
+  // to the file just mapped, so the image comes from the same file even if
+  // it's replaced later.
+  int debug_fd = -1;
+  if (pEnableGDBDebug) {
+    debug_fd = pFile.duplicateFD();
+    if (debug_fd < 0) {
+      ALOGW("Unable to keep %s open for GDB debug! (%s)", input_filename,
+            ::strerror(errno));
+    }
+  }
+
   // Delegate the load request.
   result = Load(file_map->getDataPtr(), file_size, input_filename, pResolver,
-                pEnableGDBDebug);
+                pEnableGDBDebug, debug_fd);
 
   // No whether the load is successful or not, file_map is no longer needed. On
   // success, there's a copy of the object corresponded to the pFile in the
@@ -148,6 +228,65 @@ ObjectLoader *ObjectLoader::Load(FileBase &pFile,
   return result;
 }
 
+bool ObjectLoader::registerDebugImage(void *pDebugImage, bool pIsMapped) {
+  // GDB's JIT debugging requires the source object file corresponded to the
+  // process image desired to debug with. And some fields in the object file
+  // must be updated to record the runtime information after it's loaded into
+  // memory. For example, GDB's JIT debugging requires an ELF file with the
+  // value of sh_addr in the section header to be the memory address that the
+  // section lives in the process image.
+  if (!mImpl->prepareDebugImage(pDebugImage, mDebugImageSize)) {
+    return false;
+  }
+
+  mDebugImage = pDebugImage;
+  mIsDebugImageMapped = pIsMapped;
+  registerObjectWithGDB(reinterpret_cast<const ObjectBuffer *>(mDebugImage),
+                        mDebugImageSize);
+  return true;
+}
+
+bool ObjectLoader::registerWithGDB() {
+  if (mDebugImage != NULL) {
+    return true;
+  }
+
+  if (!mEnableGDBDebug || (mDebugFD < 0)) {
+    return false;
+  }
+
+  // Mapping a file which has been truncated since the load will fault.
+  struct stat file_stat;
+  if ((::fstat(mDebugFD, &file_stat) != 0) ||
+      (static_cast<size_t>(file_stat.st_size) != mDebugImageSize) ||
+      (file_stat.st_mtime != mDebugFileMTime)) {
+    ALOGW("Object file has changed since it was loaded. GDB debug is "
+          "disabled!");
+    return false;
+  }
+
+  // A private writable mapping of the file. Only the pages patched by
+  // prepareDebugImage() are copied.
+  void *debug_image = ::mmap(NULL, mDebugImageSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE, mDebugFD, 0);
+  if (debug_image == MAP_FAILED) {
+    ALOGW("Failed to map the object file for GDB debug! (%s)",
+          ::strerror(errno));
+    return false;
+  }
+
+  if (!registerDebugImage(debug_image, /* pIsMapped */true)) {
+    ::munmap(debug_image, mDebugImageSize);
+    return false;
+  }
+
+  // The mapping stays valid without the descriptor.
+  ::close(mDebugFD);
+  mDebugFD = -1;
+
+  return true;
+}
+
 void *ObjectLoader::getSymbolAddress(const char *pName) const {
   return mImpl->getSymbolAddress(pName);
 }
@@ -156,12 +295,32 @@ size_t ObjectLoader::getSymbolSize(const char *pName) const {
   return mImpl->getSymbolSize(pName);
 }
 
+bool ObjectLoader::getSymbolLocation(const char *pName, unsigned &pSectionIdx,
+                                     size_t &pOffset) const {
+  return mImpl->getSymbolLocation(pName, pSectionIdx, pOffset);
+}
+
+void *ObjectLoader::getSectionAddress(unsigned pSectionIdx) const {
+  return mImpl->getSectionAddress(pSectionIdx);
+}
+
 bool ObjectLoader::getSymbolNameList(android::Vector<const char *>& pNameList,
                                      SymbolType pType) const {
   return mImpl->getSymbolNameList(pNameList, pType);
 }
 
 ObjectLoader::~ObjectLoader() {
+  if (mDebugImage != NULL) {
+    deregisterObjectWithGDB(
+        reinterpret_cast<const ObjectBuffer *>(mDebugImage));
+    if (mIsDebugImageMapped) {
+      ::munmap(mDebugImage, mDebugImageSize);
+    } else {
+      delete [] reinterpret_cast<uint8_t *>(mDebugImage);
+    }
+  }
+  if (mDebugFD >= 0) {
+    ::close(mDebugFD);
+  }
   delete mImpl;
-  delete [] reinterpret_cast<uint8_t *>(mDebugImage);
 }
@@ -42,6 +42,11 @@ public:
 
   virtual size_t getSymbolSize(const char *pName) const = 0;
 
+  virtual bool getSymbolLocation(const char *pName, unsigned &pSectionIdx,
+                                 size_t &pOffset) const = 0;
+
+  virtual void *getSectionAddress(unsigned pSectionIdx) const = 0;
+
   virtual bool getSymbolNameList(android::Vector<const char *>& pNameList,
                                  ObjectLoader::SymbolType pType) const = 0;
 
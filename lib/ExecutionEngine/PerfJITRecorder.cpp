@@ -0,0 +1,313 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/ExecutionEngine/PerfJITRecorder.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <llvm/Support/ELF.h>
+
+#include <cutils/properties.h>
+
+#include "bcc/ExecutionEngine/ObjectLoader.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+#ifdef TARGET_BUILD
+#define JITDUMP_DIR "/data/local/tmp"
+#else
+#define JITDUMP_DIR "/tmp"
+#endif
+
+//===----------------------------------------------------------------------===//
+// The jitdump format (see tools/perf/Documentation/jitdump-specification.txt
+// in the Linux source.)
+//===----------------------------------------------------------------------===//
+const uint32_t kJITDumpMagic = 0x4A695444; // "JiTD"
+const uint32_t kJITDumpVersion = 1;
+const uint32_t kJITCodeLoad = 0;
+const uint32_t kJITCodeClose = 3;
+
+struct JITDumpHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t totalSize;
+  uint32_t elfMach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct JITDumpCodeLoad {
+  // Record prefix
+  uint32_t id;
+  uint32_t totalSize;
+  uint64_t timestamp;
+
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t codeAddr;
+  uint64_t codeSize;
+  uint64_t codeIndex;
+  // Followed by the NUL-terminated name and the code.
+};
+
+struct JITDumpRecordHeader {
+  uint32_t id;
+  uint32_t totalSize;
+  uint64_t timestamp;
+};
+
+uint32_t GetELFMachine() {
+#if defined(__arm__)
+  return llvm::ELF::EM_ARM;
+#elif defined(__mips__)
+  return llvm::ELF::EM_MIPS;
+#elif defined(__x86_64__)
+  return llvm::ELF::EM_X86_64;
+#elif defined(__i386__)
+  return llvm::ELF::EM_386;
+#else
+  return llvm::ELF::EM_NONE;
+#endif
+}
+
+// perf expects the timestamps in CLOCK_MONOTONIC with `perf record -k mono`.
+uint64_t GetTimestamp() {
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return (static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec);
+}
+
+bool WriteFully(int pFD, const void *pBuf, size_t pSize) {
+  const uint8_t *buf = reinterpret_cast<const uint8_t *>(pBuf);
+  while (pSize > 0) {
+    ssize_t written = ::write(pFD, buf, pSize);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    pSize -= written;
+  }
+  return true;
+}
+
+void GetMode(bool &pPerfMap, bool &pJITDump) {
+  char buf[PROPERTY_VALUE_MAX];
+
+  property_get("debug.bcc.perf", buf, "");
+  if (buf[0] == '\0') {
+    const char *env = ::getenv("BCC_PERF");
+    if (env != NULL) {
+      ::strncpy(buf, env, sizeof(buf) - 1);
+      buf[sizeof(buf) - 1] = '\0';
+    }
+  }
+
+  bool all = ((::strcmp(buf, "1") == 0) || (::strcmp(buf, "all") == 0));
+  pPerfMap = all || (::strcmp(buf, "map") == 0);
+  pJITDump = all || (::strcmp(buf, "jitdump") == 0);
+  return;
+}
+
+} // end anonymous namespace
+
+PerfJITRecorder &PerfJITRecorder::GetInstance() {
+  static PerfJITRecorder recorder;
+  return recorder;
+}
+
+PerfJITRecorder::PerfJITRecorder()
+  : mPerfMap(NULL), mJITDumpFD(-1), mJITDumpMarker(NULL), mCodeIndex(0) {
+  pthread_mutex_init(&mLock, NULL);
+
+  bool perf_map, jitdump;
+  GetMode(perf_map, jitdump);
+
+  if (perf_map) {
+    openPerfMap();
+  }
+  if (jitdump) {
+    openJITDump();
+  }
+}
+
+PerfJITRecorder::~PerfJITRecorder() {
+  if (mPerfMap != NULL) {
+    ::fclose(mPerfMap);
+  }
+  if (mJITDumpMarker != NULL) {
+    ::munmap(mJITDumpMarker, ::sysconf(_SC_PAGESIZE));
+  }
+  if (mJITDumpFD >= 0) {
+    // Mark the end of the dump.
+    JITDumpRecordHeader record;
+    record.id = kJITCodeClose;
+    record.totalSize = sizeof(record);
+    record.timestamp = GetTimestamp();
+    WriteFully(mJITDumpFD, &record, sizeof(record));
+    ::close(mJITDumpFD);
+  }
+  pthread_mutex_destroy(&mLock);
+}
+
+bool PerfJITRecorder::openPerfMap() {
+  char path[64];
+  ::snprintf(path, sizeof(path), "/tmp/perf-%d.map", ::getpid());
+
+  mPerfMap = ::fopen(path, "a");
+  if (mPerfMap == NULL) {
+    ALOGW("Unable to open %s for perf! (%s)", path, ::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool PerfJITRecorder::openJITDump() {
+  char path[64];
+  ::snprintf(path, sizeof(path), JITDUMP_DIR "/jit-%d.dump", ::getpid());
+
+  int fd = ::open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (fd < 0) {
+    ALOGW("Unable to open %s for perf! (%s)", path, ::strerror(errno));
+    return false;
+  }
+
+  JITDumpHeader header;
+  ::memset(&header, 0, sizeof(header));
+  header.magic = kJITDumpMagic;
+  header.version = kJITDumpVersion;
+  header.totalSize = sizeof(header);
+  header.elfMach = GetELFMachine();
+  header.pid = ::getpid();
+  header.timestamp = GetTimestamp();
+
+  if (!WriteFully(fd, &header, sizeof(header))) {
+    ALOGW("Failed to write the header of %s! (%s)", path, ::strerror(errno));
+    ::close(fd);
+    ::unlink(path);
+    return false;
+  }
+
+  // perf finds the dump through the executable mapping of the file recorded in
+  // its trace.
+  void *marker = ::mmap(NULL, ::sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                        MAP_PRIVATE, fd, 0);
+  if (marker == MAP_FAILED) {
+    ALOGW("Failed to map %s for perf! (%s)", path, ::strerror(errno));
+    ::close(fd);
+    ::unlink(path);
+    return false;
+  }
+
+  mJITDumpFD = fd;
+  mJITDumpMarker = marker;
+  return true;
+}
+
+void PerfJITRecorder::writePerfMapEntry(const void *pAddr, size_t pSize,
+                                        const char *pName) {
+  ::fprintf(mPerfMap, "%lx %lx %s\n",
+            static_cast<unsigned long>(reinterpret_cast<uintptr_t>(pAddr)),
+            static_cast<unsigned long>(pSize), pName);
+  return;
+}
+
+void PerfJITRecorder::writeJITDumpEntry(const void *pAddr, size_t pSize,
+                                        const char *pName) {
+  size_t name_size = ::strlen(pName) + 1;
+
+  JITDumpCodeLoad record;
+  ::memset(&record, 0, sizeof(record));
+  record.id = kJITCodeLoad;
+  record.totalSize = sizeof(record) + name_size + pSize;
+  record.timestamp = GetTimestamp();
+  record.pid = ::getpid();
+  record.tid = ::syscall(__NR_gettid);
+  record.vma = record.codeAddr = reinterpret_cast<uintptr_t>(pAddr);
+  record.codeSize = pSize;
+  record.codeIndex = mCodeIndex++;
+
+  if (!WriteFully(mJITDumpFD, &record, sizeof(record)) ||
+      !WriteFully(mJITDumpFD, pName, name_size) ||
+      !WriteFully(mJITDumpFD, pAddr, pSize)) {
+    ALOGW("Failed to write the jitdump record of %s! (%s)", pName,
+          ::strerror(errno));
+  }
+  return;
+}
+
+void PerfJITRecorder::recordObject(const ObjectLoader &pLoader,
+                                   const char *pName) {
+  if (!isEnabled()) {
+    return;
+  }
+
+  android::Vector<const char *> func_names;
+  if (!pLoader.getSymbolNameList(func_names, ObjectLoader::kFunctionType)) {
+    return;
+  }
+
+  // Tell the functions of the different objects apart with the name of the
+  // object.
+  const char *object_name = ::strrchr(pName, '/');
+  object_name = (object_name != NULL) ? (object_name + 1) : pName;
+
+  pthread_mutex_lock(&mLock);
+  for (size_t i = 0, e = func_names.size(); i != e; i++) {
+    const char *func_name = func_names[i];
+    void *func = pLoader.getSymbolAddress(func_name);
+    size_t func_size = pLoader.getSymbolSize(func_name);
+
+    // Skip the undefined functions.
+    if ((func == NULL) || (func_size == 0)) {
+      continue;
+    }
+
+    std::string name(func_name);
+    name.append(" [").append(object_name).append("]");
+
+    if (mPerfMap != NULL) {
+      writePerfMapEntry(func, func_size, name.c_str());
+    }
+    if (mJITDumpFD >= 0) {
+      writeJITDumpEntry(func, func_size, name.c_str());
+    }
+  }
+  if (mPerfMap != NULL) {
+    ::fflush(mPerfMap);
+  }
+  pthread_mutex_unlock(&mLock);
+
+  return;
+}
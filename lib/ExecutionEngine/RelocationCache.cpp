@@ -0,0 +1,442 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/ExecutionEngine/RelocationCache.h"
+
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <llvm/Support/ELF.h>
+
+#include "bcc/Support/FileBase.h"
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/Log.h"
+#include "bcc/Support/OutputFile.h"
+
+using namespace bcc;
+
+namespace {
+
+#if defined(__LP64__)
+typedef llvm::ELF::Elf64_Ehdr ElfEhdr;
+typedef llvm::ELF::Elf64_Phdr ElfPhdr;
+#else
+typedef llvm::ELF::Elf32_Ehdr ElfEhdr;
+typedef llvm::ELF::Elf32_Phdr ElfPhdr;
+#endif
+
+// Type of the note section which holds the build ID generated by ld
+// --build-id.
+const uint32_t kNoteGNUBuildId = 3;
+
+struct LibraryInfo {
+  // Name as given by dladdr().
+  std::string name;
+  // Path and load address found in /proc/self/maps.
+  std::string path;
+  uintptr_t base;
+  std::string buildId;
+};
+
+const char *GetBaseName(const char *pPath) {
+  const char *slash = ::strrchr(pPath, '/');
+  return (slash != NULL) ? (slash + 1) : pPath;
+}
+
+// Fill the path and the load address of each of pLibraries by looking for the
+// first mapping of the library in /proc/self/maps. The libraries are matched
+// by base name since the dynamic linker may only know the library by its
+// soname.
+void LocateLibraries(android::Vector<LibraryInfo> &pLibraries) {
+  FILE *maps = ::fopen("/proc/self/maps", "r");
+  if (maps == NULL) {
+    ALOGV("Unable to open /proc/self/maps for locating the libraries!");
+    return;
+  }
+
+  char line[1024];
+  while (::fgets(line, sizeof(line), maps) != NULL) {
+    unsigned long start, end, offset;
+    char perms[5];
+    int path_pos = 0;
+    if ((::sscanf(line, "%lx-%lx %4s %lx %*s %*s %n", &start, &end, perms,
+                  &offset, &path_pos) < 4) ||
+        (path_pos == 0) || (offset != 0)) {
+      continue;
+    }
+
+    char *path = line + path_pos;
+    path[::strcspn(path, "\n")] = '\0';
+    if (path[0] != '/') {
+      continue;
+    }
+
+    const char *base_name = GetBaseName(path);
+    for (size_t i = 0; i < pLibraries.size(); i++) {
+      LibraryInfo &lib = pLibraries.editItemAt(i);
+      if (lib.path.empty() &&
+          (::strcmp(GetBaseName(lib.name.c_str()), base_name) == 0)) {
+        lib.path = path;
+        lib.base = static_cast<uintptr_t>(start);
+      }
+    }
+  }
+
+  ::fclose(maps);
+  return;
+}
+
+// Return the build ID of the library loaded at pBase. If the library wasn't
+// linked with --build-id, its device, inode, size and modification time are
+// used instead.
+bool GetLibraryBuildId(const LibraryInfo &pLibrary, std::string &pBuildId) {
+  const uint8_t *base = reinterpret_cast<const uint8_t *>(pLibrary.base);
+  const ElfEhdr *ehdr = reinterpret_cast<const ElfEhdr *>(base);
+
+  if (::memcmp(ehdr->e_ident, llvm::ELF::ElfMagic, 4) == 0) {
+    const ElfPhdr *phdrs = reinterpret_cast<const ElfPhdr *>(base +
+                                                             ehdr->e_phoff);
+    // The mapping starts at the page containing the first loadable segment.
+    uintptr_t first_vaddr = 0;
+    for (unsigned i = 0; i < ehdr->e_phnum; i++) {
+      if (phdrs[i].p_type == llvm::ELF::PT_LOAD) {
+        first_vaddr = phdrs[i].p_vaddr & ~(::getpagesize() - 1);
+        break;
+      }
+    }
+
+    for (unsigned i = 0; i < ehdr->e_phnum; i++) {
+      if (phdrs[i].p_type != llvm::ELF::PT_NOTE) {
+        continue;
+      }
+      const uint8_t *note = base + (phdrs[i].p_vaddr - first_vaddr);
+      const uint8_t *note_end = note + phdrs[i].p_memsz;
+      while ((note + 3 * sizeof(uint32_t)) <= note_end) {
+        const uint32_t *nhdr = reinterpret_cast<const uint32_t *>(note);
+        uint32_t name_size = (nhdr[0] + 3) & ~3;
+        uint32_t desc_size = (nhdr[1] + 3) & ~3;
+        const uint8_t *name = note + 3 * sizeof(uint32_t);
+        const uint8_t *desc = name + name_size;
+        if ((desc + desc_size) > note_end) {
+          break;
+        }
+        if ((nhdr[2] == kNoteGNUBuildId) && (nhdr[0] == 4) &&
+            (::memcmp(name, "GNU", 4) == 0)) {
+          static const char hex[] = "0123456789abcdef";
+          pBuildId.clear();
+          for (uint32_t j = 0; j < nhdr[1]; j++) {
+            pBuildId += hex[desc[j] >> 4];
+            pBuildId += hex[desc[j] & 0xf];
+          }
+          return true;
+        }
+        note = desc + desc_size;
+      }
+    }
+  }
+
+  struct stat st;
+  if (::stat(pLibrary.path.c_str(), &st) != 0) {
+    return false;
+  }
+  char stamp[128];
+  ::snprintf(stamp, sizeof(stamp), "stat:%llx:%llx:%llx:%lx",
+             static_cast<unsigned long long>(st.st_dev),
+             static_cast<unsigned long long>(st.st_ino),
+             static_cast<unsigned long long>(st.st_size),
+             static_cast<unsigned long>(st.st_mtime));
+  pBuildId = stamp;
+  return true;
+}
+
+} // end anonymous namespace
+
+android::String8 RelocationCache::GetPath(const FileBase &pObjFile) {
+  android::String8 result(pObjFile.getName().c_str());
+  result.append(".reloc");
+  return result;
+}
+
+RelocationCache::RelocationCache(SymbolResolverInterface &pResolver)
+  : mResolver(pResolver), mStringPool(NULL), mNext(0), mIsDirty(true) {
+}
+
+bool RelocationCache::read(InputFile &pInput) {
+  const char *input_filename = pInput.getName().c_str();
+  uint8_t *data = NULL;
+  const relocache::Header *header;
+  const relocache::LibraryItem *lib_items;
+  const relocache::SymbolItem *sym_items;
+  android::Vector<LibraryInfo> libs;
+  size_t filesize;
+  uint64_t pool_offset;
+
+  if (pInput.hasError()) {
+    goto bail;
+  }
+
+  filesize = pInput.getSize();
+  if (pInput.hasError() || (filesize < sizeof(relocache::Header))) {
+    goto bail;
+  }
+
+  data = new (std::nothrow) uint8_t [filesize];
+  if (data == NULL) {
+    ALOGE("Out of memory when read relocation cache %s!", input_filename);
+    goto bail;
+  }
+
+  if (pInput.read(data, filesize) != static_cast<ssize_t>(filesize)) {
+    ALOGW("Failed to read relocation cache %s! (%s)", input_filename,
+          pInput.getErrorMessage().c_str());
+    goto bail;
+  }
+
+  header = reinterpret_cast<const relocache::Header *>(data);
+  if ((::memcmp(header->magic, RELOCACHE_MAGIC, sizeof(header->magic)) != 0) ||
+      (::memcmp(header->version, RELOCACHE_VERSION,
+                sizeof(header->version)) != 0)) {
+    ALOGV("Relocation cache %s is in a different format. Ignore it.",
+          input_filename);
+    goto bail;
+  }
+
+  // The counts come from the file. Compute in 64 bits so that they can't
+  // wrap around size_t and pass the size check.
+  pool_offset = sizeof(relocache::Header) +
+      static_cast<uint64_t>(header->numLibraries) *
+          sizeof(relocache::LibraryItem) +
+      static_cast<uint64_t>(header->numSymbols) *
+          sizeof(relocache::SymbolItem);
+  if (((pool_offset + header->strPoolSize) != filesize) ||
+      (header->strPoolSize == 0) || (data[filesize - 1] != '\0')) {
+    ALOGW("Corrupted relocation cache %s!", input_filename);
+    goto bail;
+  }
+
+  mStringPool = new (std::nothrow) char [header->strPoolSize];
+  if (mStringPool == NULL) {
+    ALOGE("Out of memory when read relocation cache %s!", input_filename);
+    goto bail;
+  }
+  ::memcpy(mStringPool, data + pool_offset, header->strPoolSize);
+
+  // Check whether the libraries are the ones the addresses were taken from.
+  lib_items = reinterpret_cast<const relocache::LibraryItem *>(header + 1);
+  for (uint32_t i = 0; i < header->numLibraries; i++) {
+    if ((lib_items[i].name >= header->strPoolSize) ||
+        (lib_items[i].buildId >= header->strPoolSize)) {
+      ALOGW("Corrupted relocation cache %s!", input_filename);
+      goto bail;
+    }
+    LibraryInfo lib;
+    lib.name = &mStringPool[lib_items[i].name];
+    lib.base = 0;
+    libs.push(lib);
+  }
+
+  LocateLibraries(libs);
+
+  for (uint32_t i = 0; i < header->numLibraries; i++) {
+    std::string build_id;
+    if (libs[i].path.empty() || !GetLibraryBuildId(libs[i], build_id) ||
+        (build_id != &mStringPool[lib_items[i].buildId])) {
+      ALOGV("%s has changed since relocation cache %s was written.",
+            libs[i].name.c_str(), input_filename);
+      goto bail;
+    }
+  }
+
+  sym_items = reinterpret_cast<const relocache::SymbolItem *>(
+                  lib_items + header->numLibraries);
+  for (uint32_t i = 0; i < header->numSymbols; i++) {
+    const relocache::SymbolItem &item = sym_items[i];
+    void *addr = NULL;
+    if (item.name >= header->strPoolSize) {
+      ALOGW("Corrupted relocation cache %s!", input_filename);
+      goto bail;
+    }
+    if (item.library != relocache::gNoLibrary) {
+      if (item.library >= header->numLibraries) {
+        ALOGW("Corrupted relocation cache %s!", input_filename);
+        goto bail;
+      }
+      addr = reinterpret_cast<void *>(libs[item.library].base + item.offset);
+    }
+    mReplay.push(std::make_pair(&mStringPool[item.name], addr));
+  }
+
+  delete [] data;
+  mNext = 0;
+  mIsDirty = false;
+  return true;
+
+bail:
+  delete [] data;
+  delete [] mStringPool;
+  mStringPool = NULL;
+  mReplay.clear();
+  mNext = 0;
+  mIsDirty = true;
+  return false;
+}
+
+bool RelocationCache::write(OutputFile &pOutput) const {
+  const char *output_filename = pOutput.getName().c_str();
+
+  if (pOutput.hasError()) {
+    ALOGE("Invalid relocation cache %s for output! (%s)", output_filename,
+          pOutput.getErrorMessage().c_str());
+    return false;
+  }
+
+  // The replayed symbols followed by the ones resolved afterward.
+  android::Vector<std::pair<const char *, void *> > symbols;
+  for (size_t i = 0; i < mNext; i++) {
+    symbols.push(mReplay[i]);
+  }
+  for (size_t i = 0; i < mResolved.size(); i++) {
+    symbols.push(std::make_pair(mResolved[i].first.c_str(),
+                                mResolved[i].second));
+  }
+
+  // Find the library where each symbol lives.
+  android::Vector<LibraryInfo> libs;
+  android::Vector<uint32_t> sym_libs;
+  for (size_t i = 0; i < symbols.size(); i++) {
+    Dl_info info;
+    uint32_t lib_idx = relocache::gNoLibrary;
+    if ((symbols[i].second != NULL) &&
+        (::dladdr(symbols[i].second, &info) != 0) &&
+        (info.dli_fname != NULL) && (info.dli_fbase != NULL)) {
+      for (lib_idx = 0; lib_idx < libs.size(); lib_idx++) {
+        if (libs[lib_idx].name == info.dli_fname) {
+          break;
+        }
+      }
+      if (lib_idx == libs.size()) {
+        LibraryInfo lib;
+        lib.name = info.dli_fname;
+        lib.base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+        libs.push(lib);
+      }
+    }
+    sym_libs.push(lib_idx);
+  }
+
+  // Only keep the libraries which can be found again with their build ID.
+  android::Vector<LibraryInfo> located(libs);
+  for (size_t i = 0; i < located.size(); i++) {
+    located.editItemAt(i).base = 0;
+  }
+  LocateLibraries(located);
+  android::Vector<bool> usable;
+  for (size_t i = 0; i < libs.size(); i++) {
+    LibraryInfo &lib = libs.editItemAt(i);
+    lib.path = located[i].path;
+    usable.push(!lib.path.empty() && (located[i].base == lib.base) &&
+                GetLibraryBuildId(lib, lib.buildId));
+  }
+
+  // Lay out the string pool.
+  std::string pool;
+  android::Vector<relocache::LibraryItem> lib_items;
+  for (size_t i = 0; i < libs.size(); i++) {
+    relocache::LibraryItem item;
+    item.name = pool.size();
+    pool.append(libs[i].name.c_str(), libs[i].name.size() + 1);
+    item.buildId = pool.size();
+    pool.append(libs[i].buildId.c_str(), libs[i].buildId.size() + 1);
+    lib_items.push(item);
+  }
+
+  android::Vector<relocache::SymbolItem> sym_items;
+  for (size_t i = 0; i < symbols.size(); i++) {
+    relocache::SymbolItem item;
+    item.name = pool.size();
+    pool.append(symbols[i].first, ::strlen(symbols[i].first) + 1);
+    item.library = relocache::gNoLibrary;
+    item.offset = 0;
+    uint32_t lib_idx = sym_libs[i];
+    if ((lib_idx != relocache::gNoLibrary) && usable[lib_idx]) {
+      uintptr_t offset = reinterpret_cast<uintptr_t>(symbols[i].second) -
+                         libs[lib_idx].base;
+      if (offset <= 0xffffffffUL) {
+        item.library = lib_idx;
+        item.offset = static_cast<uint32_t>(offset);
+      }
+    }
+    sym_items.push(item);
+  }
+
+  relocache::Header header;
+  ::memcpy(header.magic, RELOCACHE_MAGIC, sizeof(header.magic));
+  ::memcpy(header.version, RELOCACHE_VERSION, sizeof(header.version));
+  header.numLibraries = lib_items.size();
+  header.numSymbols = sym_items.size();
+  header.strPoolSize = pool.size();
+
+  size_t lib_items_size = lib_items.size() * sizeof(relocache::LibraryItem);
+  size_t sym_items_size = sym_items.size() * sizeof(relocache::SymbolItem);
+  if ((pOutput.write(&header, sizeof(header)) != sizeof(header)) ||
+      ((lib_items_size > 0) &&
+       (pOutput.write(lib_items.array(), lib_items_size) !=
+            static_cast<ssize_t>(lib_items_size))) ||
+      ((sym_items_size > 0) &&
+       (pOutput.write(sym_items.array(), sym_items_size) !=
+            static_cast<ssize_t>(sym_items_size))) ||
+      (pOutput.write(pool.data(), pool.size()) !=
+           static_cast<ssize_t>(pool.size()))) {
+    ALOGE("Cannot write out relocation cache %s! (%s)", output_filename,
+          pOutput.getErrorMessage().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void *RelocationCache::getAddress(const char *pName) {
+  if (mNext < mReplay.size()) {
+    const std::pair<const char *, void *> &entry = mReplay[mNext];
+    if (::strcmp(entry.first, pName) == 0) {
+      mNext++;
+      if (entry.second != NULL) {
+        return entry.second;
+      }
+      // Not recorded as an address in a library.
+      return mResolver.getAddress(pName);
+    }
+
+    // The object requests a different sequence of symbols. Stop replaying.
+    ALOGV("Relocation cache diverged at symbol #%zu (%s v.s. %s)", mNext,
+          entry.first, pName);
+    mReplay.resize(mNext);
+    mIsDirty = true;
+  }
+
+  void *addr = mResolver.getAddress(pName);
+  mResolved.push(std::make_pair(std::string(pName), addr));
+  return addr;
+}
+
+RelocationCache::~RelocationCache() {
+  delete [] mStringPool;
+}
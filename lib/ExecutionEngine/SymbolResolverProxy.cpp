@@ -19,17 +19,43 @@
 using namespace bcc;
 
 void *SymbolResolverProxy::getAddress(const char *pName) {
-  // Search the address of the symbol by following the chain of resolvers.
+  pthread_mutex_lock(&mCacheLock);
+  llvm::StringMap<void *>::const_iterator cached = mCache.find(pName);
+  if (cached != mCache.end()) {
+    void *addr = cached->getValue();
+    pthread_mutex_unlock(&mCacheLock);
+    return addr;
+  }
+  pthread_mutex_unlock(&mCacheLock);
+
+  // Search the address of the symbol by following the chain of resolvers. The
+  // lock isn't held here, so two threads may look up the same name at once.
+  // They get the same address.
+  void *addr = NULL;
   for (size_t i = 0; i < mChain.size(); i++) {
-    void *addr = mChain[i]->getAddress(pName);
+    addr = mChain[i]->getAddress(pName);
     if (addr != NULL) {
-      return addr;
+      break;
     }
   }
-  // Symbol not found or there's no resolver containing in the chain.
-  return NULL;
+
+  // Remember the result even if the symbol is not found or there's no
+  // resolver containing in the chain.
+  pthread_mutex_lock(&mCacheLock);
+  mCache[pName] = addr;
+  pthread_mutex_unlock(&mCacheLock);
+  return addr;
+}
+
+void SymbolResolverProxy::invalidateCache() {
+  pthread_mutex_lock(&mCacheLock);
+  mCache.clear();
+  pthread_mutex_unlock(&mCacheLock);
+  return;
 }
 
 void SymbolResolverProxy::chainResolver(SymbolResolverInterface &pResolver) {
   mChain.push_back(&pResolver);
+  // The new resolver may know the symbols missed before.
+  invalidateCache();
 }
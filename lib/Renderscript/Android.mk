@@ -22,10 +22,14 @@ LOCAL_PATH := $(call my-dir)
 #=====================================================================
 
 libbcc_renderscript_SRC_FILES := \
+  RSCacheIndex.cpp \
   RSCompiler.cpp \
   RSCompilerDriver.cpp \
   RSExecutable.cpp \
+  RSForEachExecutor.cpp \
   RSForEachExpand.cpp \
+  RSForEachFuse.cpp \
+  RSImportTable.cpp \
   RSInfo.cpp \
   RSInfoExtractor.cpp \
   RSInfoReader.cpp \
@@ -0,0 +1,400 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSCacheIndex.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utils/FileMap.h>
+#include <utils/Vector.h>
+
+#include "bcc/Support/FileMutex.h"
+#include "bcc/Support/InputFile.h"
+#include "bcc/Support/Log.h"
+#include "bcc/Support/OutputFile.h"
+
+using namespace bcc;
+
+namespace {
+
+const char IndexFileName[] = "rscache.index";
+
+pthread_mutex_t gIndicesLock = PTHREAD_MUTEX_INITIALIZER;
+android::Vector<std::pair<std::string, RSCacheIndex *> > gIndices;
+
+// Read the whole file pPath into pContents.
+bool ReadWholeFile(const char *pPath, std::string &pContents) {
+  InputFile input(pPath);
+  if (input.hasError()) {
+    return false;
+  }
+
+  size_t size = input.getSize();
+  if (input.hasError()) {
+    return false;
+  }
+
+  pContents.resize(size);
+  if ((size > 0) &&
+      (input.read(&pContents[0], size) != static_cast<ssize_t>(size))) {
+    return false;
+  }
+  return true;
+}
+
+inline const char *GetFileName(const char *pPath) {
+  const char *name = ::strrchr(pPath, '/');
+  return (name != NULL) ? (name + 1) : pPath;
+}
+
+inline std::string GetInfoPath(const char *pObjPath) {
+  // See RSInfo::GetPath().
+  return std::string(pObjPath) + ".info";
+}
+
+struct Entry {
+  std::string name;
+  std::string info;
+  uint64_t objSize;
+  uint64_t objMTime;
+  uint64_t infoIno;
+  uint64_t infoMTime;
+};
+
+} // end anonymous namespace
+
+std::string RSCacheIndex::GetPath(const char *pCacheDir) {
+  std::string result(pCacheDir);
+  result.append("/").append(IndexFileName);
+  return result;
+}
+
+RSCacheIndex *RSCacheIndex::Get(const char *pCacheDir) {
+  std::string path = GetPath(pCacheDir);
+  RSCacheIndex *result = NULL;
+
+  pthread_mutex_lock(&gIndicesLock);
+  for (size_t i = 0, e = gIndices.size(); i != e; i++) {
+    if (gIndices[i].first == path) {
+      result = gIndices[i].second;
+      break;
+    }
+  }
+  if (result == NULL) {
+    // The indices live until the process exits.
+    result = new (std::nothrow) RSCacheIndex(path);
+    if (result != NULL) {
+      gIndices.push(std::make_pair(path, result));
+    } else {
+      ALOGE("Out of memory when create the RS cache index for %s!",
+            pCacheDir);
+    }
+  }
+  pthread_mutex_unlock(&gIndicesLock);
+
+  return result;
+}
+
+RSCacheIndex::RSCacheIndex(const std::string &pPath)
+  : mPath(pPath), mMap(NULL), mData(NULL), mSize(0), mDev(0), mIno(0),
+    mMTime(0) {
+  pthread_mutex_init(&mLock, NULL);
+}
+
+RSCacheIndex::~RSCacheIndex() {
+  unmap();
+  pthread_mutex_destroy(&mLock);
+}
+
+void RSCacheIndex::unmap() {
+  if (mMap != NULL) {
+    mMap->release();
+  }
+  mMap = NULL;
+  mData = NULL;
+  mSize = 0;
+  return;
+}
+
+bool RSCacheIndex::Validate(const uint8_t *pData, size_t pSize,
+                            const char *pPath) {
+  if (pSize < sizeof(rsindex::Header)) {
+    ALOGV("RS cache index %s is too small. Ignore it.", pPath);
+    return false;
+  }
+
+  const rsindex::Header *header =
+      reinterpret_cast<const rsindex::Header *>(pData);
+
+  if ((::memcmp(header->magic, RSINDEX_MAGIC, sizeof(header->magic)) != 0) ||
+      (::memcmp(header->version, RSINDEX_VERSION,
+                sizeof(header->version)) != 0)) {
+    ALOGV("Unknown RS cache index %s. Ignore it.", pPath);
+    return false;
+  }
+
+  if ((header->entrySize != sizeof(rsindex::EntryItem)) ||
+      ((sizeof(rsindex::Header) +
+        static_cast<uint64_t>(header->numEntries) * header->entrySize) >
+       pSize)) {
+    ALOGW("Corrupted RS cache index %s! (entries out of the range)", pPath);
+    return false;
+  }
+
+  const rsindex::EntryItem *entries =
+      reinterpret_cast<const rsindex::EntryItem *>(pData +
+                                                   sizeof(rsindex::Header));
+  for (uint32_t i = 0; i < header->numEntries; i++) {
+    const rsindex::EntryItem &entry = entries[i];
+    if ((entry.name >= pSize) ||
+        (::memchr(pData + entry.name, '\0', pSize - entry.name) == NULL) ||
+        ((static_cast<uint64_t>(entry.info) + entry.infoSize) > pSize)) {
+      ALOGW("Corrupted RS cache index %s! (entry #%u out of the range)",
+            pPath, i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+const rsindex::EntryItem *RSCacheIndex::FindEntry(const uint8_t *pData,
+                                                  size_t pSize,
+                                                  const char *pName) {
+  const rsindex::Header *header =
+      reinterpret_cast<const rsindex::Header *>(pData);
+  const rsindex::EntryItem *entries =
+      reinterpret_cast<const rsindex::EntryItem *>(pData +
+                                                   sizeof(rsindex::Header));
+
+  for (uint32_t i = 0; i < header->numEntries; i++) {
+    const char *name = reinterpret_cast<const char *>(pData + entries[i].name);
+    if (::strcmp(name, pName) == 0) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+void RSCacheIndex::refresh() {
+  struct stat index_stat;
+  if (::stat(mPath.c_str(), &index_stat) != 0) {
+    unmap();
+    return;
+  }
+
+  // The index file is only replaced, never modified in place.
+  if ((mMap != NULL) && (index_stat.st_dev == mDev) &&
+      (index_stat.st_ino == mIno) && (index_stat.st_mtime == mMTime) &&
+      (static_cast<size_t>(index_stat.st_size) == mSize)) {
+    return;
+  }
+
+  unmap();
+
+  InputFile index_file(mPath);
+  if (index_file.hasError()) {
+    return;
+  }
+
+  size_t size = index_file.getSize();
+  if (index_file.hasError() || (size == 0)) {
+    return;
+  }
+
+  android::FileMap *map = index_file.createMap(/* pOffset */0, size);
+  if (map == NULL) {
+    ALOGW("Failed to map RS cache index %s! (%s)", mPath.c_str(),
+          index_file.getErrorMessage().c_str());
+    return;
+  }
+
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(map->getDataPtr());
+  if (!Validate(data, size, mPath.c_str())) {
+    map->release();
+    return;
+  }
+
+  mMap = map;
+  mData = data;
+  mSize = size;
+  mDev = index_stat.st_dev;
+  mIno = index_stat.st_ino;
+  mMTime = index_stat.st_mtime;
+  return;
+}
+
+RSInfo *RSCacheIndex::lookup(const char *pObjPath,
+                             const RSInfo::DependencyTableTy &pDeps) {
+  RSInfo *result = NULL;
+
+  pthread_mutex_lock(&mLock);
+
+  refresh();
+
+  if (mMap != NULL) {
+    const rsindex::EntryItem *entry = FindEntry(mData, mSize,
+                                                GetFileName(pObjPath));
+    struct stat obj_stat, info_stat;
+    if ((entry != NULL) && (::stat(pObjPath, &obj_stat) == 0) &&
+        (static_cast<uint64_t>(obj_stat.st_size) == entry->objSize) &&
+        (static_cast<uint64_t>(obj_stat.st_mtime) == entry->objMTime) &&
+        (::stat(GetInfoPath(pObjPath).c_str(), &info_stat) == 0) &&
+        (static_cast<uint64_t>(info_stat.st_ino) == entry->infoIno) &&
+        (static_cast<uint64_t>(info_stat.st_size) == entry->infoSize) &&
+        (static_cast<uint64_t>(info_stat.st_mtime) == entry->infoMTime)) {
+      result = RSInfo::ReadFromBuffer(mData + entry->info, entry->infoSize,
+                                      pObjPath, pDeps);
+    }
+  }
+
+  pthread_mutex_unlock(&mLock);
+
+  return result;
+}
+
+bool RSCacheIndex::update(const char *pObjPath, const char *pInfoPath) {
+  FileMutex<FileBase::kWriteLock> index_mutex(mPath);
+  if (index_mutex.hasError() || !index_mutex.lock()) {
+    ALOGE("Unable to acquire the lock for writing %s! (%s)", mPath.c_str(),
+          index_mutex.getErrorMessage().c_str());
+    return false;
+  }
+
+  const char *obj_name = GetFileName(pObjPath);
+
+  // Collect the entries. The index file may have been replaced since it was
+  // mapped so it's read again under the lock.
+  android::Vector<Entry> entries;
+
+  // The RS info file is checked to be the same before and after the read, in
+  // case it's replaced in between.
+  Entry new_entry;
+  struct stat obj_stat, info_stat, info_stat_after;
+  new_entry.name = obj_name;
+  if ((::stat(pInfoPath, &info_stat) != 0) ||
+      !ReadWholeFile(pInfoPath, new_entry.info) ||
+      (::stat(pInfoPath, &info_stat_after) != 0) ||
+      (::stat(pObjPath, &obj_stat) != 0)) {
+    ALOGW("Unable to read RS info file %s for the RS cache index!",
+          pInfoPath);
+    return false;
+  }
+  if ((info_stat.st_ino != info_stat_after.st_ino) ||
+      (info_stat.st_mtime != info_stat_after.st_mtime) ||
+      (static_cast<uint64_t>(info_stat_after.st_size) !=
+          new_entry.info.size())) {
+    ALOGV("RS info file %s changed while reading it. Skip the RS cache "
+          "index update.", pInfoPath);
+    return false;
+  }
+  new_entry.objSize = obj_stat.st_size;
+  new_entry.objMTime = obj_stat.st_mtime;
+  new_entry.infoIno = info_stat.st_ino;
+  new_entry.infoMTime = info_stat.st_mtime;
+  entries.push(new_entry);
+
+  std::string old_index;
+  if (ReadWholeFile(mPath.c_str(), old_index) &&
+      Validate(reinterpret_cast<const uint8_t *>(old_index.data()),
+               old_index.size(), mPath.c_str())) {
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(old_index.data());
+    const rsindex::Header *header =
+        reinterpret_cast<const rsindex::Header *>(data);
+    const rsindex::EntryItem *items =
+        reinterpret_cast<const rsindex::EntryItem *>(data +
+                                                     sizeof(rsindex::Header));
+    for (uint32_t i = 0; i < header->numEntries; i++) {
+      const char *name = reinterpret_cast<const char *>(data + items[i].name);
+      if (::strcmp(name, obj_name) == 0) {
+        continue;
+      }
+      Entry entry;
+      entry.name = name;
+      entry.info.assign(reinterpret_cast<const char *>(data + items[i].info),
+                        items[i].infoSize);
+      entry.objSize = items[i].objSize;
+      entry.objMTime = items[i].objMTime;
+      entry.infoIno = items[i].infoIno;
+      entry.infoMTime = items[i].infoMTime;
+      entries.push(entry);
+    }
+  }
+
+  // Lay out the new index: the header, the entries and then their contents.
+  rsindex::Header header;
+  ::memcpy(header.magic, RSINDEX_MAGIC, sizeof(header.magic));
+  ::memcpy(header.version, RSINDEX_VERSION, sizeof(header.version));
+  header.numEntries = entries.size();
+  header.entrySize = sizeof(rsindex::EntryItem);
+
+  std::string contents(reinterpret_cast<const char *>(&header),
+                       sizeof(header));
+  uint64_t offset = sizeof(header) +
+                    static_cast<uint64_t>(entries.size()) *
+                        sizeof(rsindex::EntryItem);
+  for (size_t i = 0, e = entries.size(); i != e; i++) {
+    rsindex::EntryItem item;
+    item.name = offset;
+    offset += entries[i].name.size() + 1;
+    item.info = offset;
+    item.infoSize = entries[i].info.size();
+    offset += entries[i].info.size();
+    item.objSize = entries[i].objSize;
+    item.objMTime = entries[i].objMTime;
+    item.infoIno = entries[i].infoIno;
+    item.infoMTime = entries[i].infoMTime;
+    contents.append(reinterpret_cast<const char *>(&item), sizeof(item));
+  }
+  if (offset > static_cast<uint32_t>(-1)) {
+    ALOGE("RS cache index %s grows too large!", mPath.c_str());
+    return false;
+  }
+  for (size_t i = 0, e = entries.size(); i != e; i++) {
+    contents.append(entries[i].name.c_str(), entries[i].name.size() + 1);
+    contents.append(entries[i].info);
+  }
+
+  // Replace the index file. The processes which have mapped the old one keep
+  // using it until they notice.
+  std::string tmp_path = mPath + ".tmp";
+  bool result;
+  {
+    OutputFile output(tmp_path, FileBase::kTruncate);
+    result = !output.hasError() &&
+             (output.write(contents.data(), contents.size()) ==
+                 static_cast<ssize_t>(contents.size()));
+  }
+
+  if (result && (::rename(tmp_path.c_str(), mPath.c_str()) != 0)) {
+    ALOGE("Failed to rename %s to %s! (%s)", tmp_path.c_str(), mPath.c_str(),
+          ::strerror(errno));
+    result = false;
+  }
+
+  if (!result) {
+    ALOGE("Failed to update RS cache index %s!", mPath.c_str());
+    ::unlink(tmp_path.c_str());
+  }
+
+  return result;
+}
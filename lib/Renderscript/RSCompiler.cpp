@@ -16,10 +16,14 @@
 
 #include "bcc/Renderscript/RSCompiler.h"
 
+#include <cstdlib>
+#include <cstring>
+
 #include <llvm/Module.h>
 #include <llvm/PassManager.h>
 #include <llvm/Transforms/IPO.h>
 
+#include "bcc/Config/Config.h"
 #include "bcc/Renderscript/RSExecutable.h"
 #include "bcc/Renderscript/RSInfo.h"
 #include "bcc/Renderscript/RSScript.h"
@@ -29,6 +33,42 @@
 
 using namespace bcc;
 
+namespace {
+
+// Per-script overrides of the CompilerConfig options for the expanded foreach
+// loops:
+//
+//   #pragma rs_prefetch_distance(<number of elements>)
+//   #pragma rs_nontemporal_store(true|false)
+const char PrefetchDistancePragma[] = "rs_prefetch_distance";
+const char NonTemporalStorePragma[] = "rs_nontemporal_store";
+
+void GetForEachLoopOptions(const RSInfo &pInfo, unsigned &pPrefetchDistance,
+                           bool &pNonTemporalStore) {
+  const RSInfo::PragmaListTy &pragmas = pInfo.getPragmas();
+  for (RSInfo::PragmaListTy::const_iterator pragma_iter = pragmas.begin(),
+          pragma_end = pragmas.end(); pragma_iter != pragma_end;
+       pragma_iter++) {
+    const char *key = pragma_iter->first;
+    const char *value = pragma_iter->second;
+    if (::strcmp(key, PrefetchDistancePragma) == 0) {
+      char *end;
+      unsigned long distance = ::strtoul(value, &end, 10);
+      if ((*value == '\0') || (*end != '\0')) {
+        ALOGW("Ignore invalid value '%s' of pragma %s!", value, key);
+      } else {
+        pPrefetchDistance = static_cast<unsigned>(distance);
+      }
+    } else if (::strcmp(key, NonTemporalStorePragma) == 0) {
+      // An empty value means "true."
+      pNonTemporalStore = (::strcmp(value, "false") != 0);
+    }
+  }
+  return;
+}
+
+} // end anonymous namespace
+
 bool RSCompiler::beforeAddLTOPasses(Script &pScript, llvm::PassManager &pPM) {
   // Add a pass to internalize the symbols that don't need to have global
   // visibility.
@@ -73,7 +113,17 @@ bool RSCompiler::beforeAddLTOPasses(Script &pScript, llvm::PassManager &pPM) {
            foreach_func_end = export_foreach_func.end();
        foreach_func_iter != foreach_func_end; foreach_func_iter++) {
     std::string name(foreach_func_iter->first);
-    expanded_foreach_funcs.push_back(name.append(".expand"));
+    expanded_foreach_funcs.push_back(name + ".expand");
+    // Cache-blocked variants (if any) and their tile dimension.
+    expanded_foreach_funcs.push_back(name + ".expand_tile");
+    expanded_foreach_funcs.push_back(name + ".expand_tile_dims");
+  }
+
+  // So do the fused kernel groups.
+  std::vector<RSForEachFusionGroupTy> fusion_groups;
+  GetRSForEachFusionGroups(*info, fusion_groups);
+  for (size_t i = 0; i < fusion_groups.size(); i++) {
+    expanded_foreach_funcs.push_back(GetRSForEachFusedName(fusion_groups[i]));
   }
 
   // Need to wait until ForEachExpandList is fully populated to fill in
@@ -82,6 +132,13 @@ bool RSCompiler::beforeAddLTOPasses(Script &pScript, llvm::PassManager &pPM) {
     export_symbols.push_back(expanded_foreach_funcs[i].c_str());
   }
 
+  // The import table is filled by RSExecutable when the script is loaded.
+  if (mUseImportTable) {
+    export_symbols.push_back(RSExecutable::ImportTableSymbolName);
+    export_symbols.push_back(RSExecutable::ImportNameTableSymbolName);
+    pPM.add(createRSImportTablePass());
+  }
+
   pPM.add(llvm::createInternalizePass(export_symbols));
 
   return true;
@@ -104,8 +161,23 @@ bool RSCompiler::beforeExecuteLTOPasses(Script &pScript,
   }
 
   // Expand ForEach on CPU path to reduce launch overhead.
+  unsigned prefetch_distance = getPrefetchDistance();
+  bool non_temporal_store = isNonTemporalStoreEnabled();
+  GetForEachLoopOptions(*info, prefetch_distance, non_temporal_store);
+
   rs_passes.add(createRSForEachExpandPass(info->getExportForeachFuncs(),
-                                          /* pEnableStepOpt */ true));
+                                          /* pEnableStepOpt */ true,
+                                          RS_FOREACH_TILE_CACHE_SIZE,
+                                          prefetch_distance,
+                                          non_temporal_store));
+
+  // Fuse the groups of kernels requested via "#pragma rs_fuse".
+  std::vector<RSForEachFusionGroupTy> fusion_groups;
+  GetRSForEachFusionGroups(*info, fusion_groups);
+  if (!fusion_groups.empty()) {
+    rs_passes.add(createRSForEachFusePass(info->getExportForeachFuncs(),
+                                          fusion_groups));
+  }
 
   // Execute the pass.
   rs_passes.run(module);
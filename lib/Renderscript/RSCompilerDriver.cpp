@@ -16,14 +16,24 @@
 
 #include "bcc/Renderscript/RSCompilerDriver.h"
 
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <llvm/Support/Path.h>
 
 #include "bcinfo/BitcodeWrapper.h"
 
+#include "bcc/Linker.h"
+#include "bcc/Renderscript/RSCacheIndex.h"
 #include "bcc/Renderscript/RSExecutable.h"
 #include "bcc/Renderscript/RSScript.h"
 #include "bcc/Support/CompilerConfig.h"
 #include "bcc/Support/TargetCompilerConfigs.h"
+#include "bcc/Support/TargetLinkerConfigs.h"
 #include "bcc/Source.h"
 #include "bcc/Support/FileMutex.h"
 #include "bcc/Support/Log.h"
@@ -31,6 +41,7 @@
 #include "bcc/Support/Initialization.h"
 #include "bcc/Support/Sha1Util.h"
 #include "bcc/Support/OutputFile.h"
+#include "bcc/Support/Properties.h"
 
 #include <cutils/properties.h>
 #include <utils/String8.h>
@@ -50,21 +61,46 @@ bool is_force_recompile() {
   }
 
   // Re-compile if debug.rs.forcerecompile is set.
-  property_get("debug.rs.forcerecompile", buf, "0");
-  if ((::strcmp(buf, "1") == 0) || (::strcmp(buf, "true") == 0)) {
-    return true;
-  } else {
-    return false;
+  return IsPropertyEnabled("debug.rs.forcerecompile");
+}
+
+// Name of the dependency entry that keys the cache on the options of the
+// loops generated by RSForEachExpandPass.
+const char ForEachLoopOptionsDependency[] = "bcc.foreach_loop_options";
+
+// Compute the SHA-1 of the foreach loop options in pConfig (or the defaults of
+// CompilerConfig if pConfig is NULL.) Per-script overrides given by pragmas are
+// part of the bitcode and hence already covered by its SHA-1.
+void GetForEachLoopOptionsSHA1(const CompilerConfig *pConfig,
+                               uint8_t pResult[SHA1_DIGEST_LENGTH]) {
+  unsigned prefetch_distance = 0;
+  bool non_temporal_store = false;
+
+  if (pConfig != NULL) {
+    prefetch_distance = pConfig->getPrefetchDistance();
+    non_temporal_store = pConfig->isNonTemporalStoreEnabled();
   }
+
+  char options[64];
+  int length = ::snprintf(options, sizeof(options),
+                          "prefetch=%u nontemporal=%d", prefetch_distance,
+                          static_cast<int>(non_temporal_store));
+  Sha1Util::GetSHA1DigestFromBuffer(pResult, options,
+                                    static_cast<size_t>(length));
 }
 
 } // end anonymous namespace
 
-RSCompilerDriver::RSCompilerDriver() : mConfig(NULL), mCompiler() {
+RSCompilerDriver::RSCompilerDriver()
+  : mConfig(NULL), mCompiler(), mUseSharedObject(false),
+    mUseCacheIndex(IsPropertyEnabled("debug.rs.cacheindex")),
+    mTargetRelocModel(llvm::Reloc::Default) {
   init::Initialize();
   // Chain the symbol resolvers for BCC runtimes and RS runtimes.
   mResolver.chainResolver(mBCCRuntime);
   mResolver.chainResolver(mRSRuntime);
+
+  setUseSharedObject(IsPropertyEnabled("debug.rs.sharedobject"));
 }
 
 RSCompilerDriver::~RSCompilerDriver() {
@@ -80,6 +116,16 @@ RSCompilerDriver::loadScriptCache(const char *pOutputPath,
   if (is_force_recompile())
     return NULL;
 
+  // The shared object is linked from an object compiled in PIC. Recompile
+  // the script if it's going to be loaded by the ObjectLoader.
+  if (!mUseSharedObject) {
+    android::String8 so_path = RSExecutable::GetSharedObjectPath(pOutputPath);
+    struct stat so_stat;
+    if (::stat(so_path.string(), &so_stat) == 0) {
+      return NULL;
+    }
+  }
+
   //===--------------------------------------------------------------------===//
   // Acquire the read lock for reading output object file.
   //===--------------------------------------------------------------------===//
@@ -104,36 +150,54 @@ RSCompilerDriver::loadScriptCache(const char *pOutputPath,
   }
 
   //===--------------------------------------------------------------------===//
-  // Acquire the read lock on output_file for reading its RS info file.
+  // Look up the RS info in the cache index.
   //===--------------------------------------------------------------------===//
-  android::String8 info_path = RSInfo::GetPath(*output_file);
-
-  if (!output_file->lock()) {
-    ALOGE("Unable to acquire the read lock on %s for reading %s! (%s)",
-          pOutputPath, info_path.string(),
-          output_file->getErrorMessage().c_str());
-    delete output_file;
-    return NULL;
+  // The index is replaced atomically so no lock is required to read it.
+  RSInfo *info = NULL;
+  RSCacheIndex *cache_index = getCacheIndex(pOutputPath);
+  if (cache_index != NULL) {
+    info = cache_index->lookup(pOutputPath, pDeps);
   }
 
- //===---------------------------------------------------------------------===//
-  // Open and load the RS info file.
-  //===--------------------------------------------------------------------===//
-  InputFile info_file(info_path.string());
-  RSInfo *info = RSInfo::ReadFromFile(info_file, pDeps);
+  if (info == NULL) {
+    //===------------------------------------------------------------------===//
+    // Acquire the read lock on output_file for reading its RS info file.
+    //===------------------------------------------------------------------===//
+    android::String8 info_path = RSInfo::GetPath(*output_file);
+
+    if (!output_file->lock()) {
+      ALOGE("Unable to acquire the read lock on %s for reading %s! (%s)",
+            pOutputPath, info_path.string(),
+            output_file->getErrorMessage().c_str());
+      delete output_file;
+      return NULL;
+    }
 
-  // Release the lock on output_file.
-  output_file->unlock();
+    //===------------------------------------------------------------------===//
+    // Open and load the RS info file.
+    //===------------------------------------------------------------------===//
+    InputFile info_file(info_path.string());
+    info = RSInfo::ReadFromFile(info_file, pDeps);
 
-  if (info == NULL) {
-    delete output_file;
-    return NULL;
+    // Release the lock on output_file.
+    output_file->unlock();
+
+    if (info == NULL) {
+      delete output_file;
+      return NULL;
+    }
+
+    // Let the following loads find it in the index.
+    if (cache_index != NULL) {
+      cache_index->update(pOutputPath, info_path.string());
+    }
   }
 
   //===--------------------------------------------------------------------===//
   // Create the RSExecutable.
   //===--------------------------------------------------------------------===//
-  result = RSExecutable::Create(*info, *output_file, mResolver);
+  result = RSExecutable::Create(*info, *output_file, mResolver,
+                                mUseSharedObject);
   if (result == NULL) {
     delete output_file;
     delete info;
@@ -143,6 +207,14 @@ RSCompilerDriver::loadScriptCache(const char *pOutputPath,
   return result;
 }
 
+RSCacheIndex *RSCompilerDriver::getCacheIndex(const char *pOutputPath) const {
+  if (!mUseCacheIndex) {
+    return NULL;
+  }
+  std::string cache_dir = llvm::sys::path::parent_path(pOutputPath).str();
+  return RSCacheIndex::Get(cache_dir.c_str());
+}
+
 bool RSCompilerDriver::setupConfig(const RSScript &pScript) {
   bool changed = false;
 
@@ -164,6 +236,15 @@ bool RSCompilerDriver::setupConfig(const RSScript &pScript) {
       return false;
     }
     mConfig->setOptimizationLevel(script_opt_level);
+    mTargetRelocModel = mConfig->getRelocationModel();
+    changed = true;
+  }
+
+  // Code linked into a shared object must be position-independent.
+  const llvm::Reloc::Model reloc_model =
+      (mUseSharedObject ? llvm::Reloc::PIC_ : mTargetRelocModel);
+  if (mConfig->getRelocationModel() != reloc_model) {
+    mConfig->setRelocationModel(reloc_model);
     changed = true;
   }
 
@@ -180,6 +261,71 @@ bool RSCompilerDriver::setupConfig(const RSScript &pScript) {
   return changed;
 }
 
+bool RSCompilerDriver::linkSharedObject(const char *pObjPath,
+                                        const char *pSOPath) {
+  DefaultLinkerConfig config;
+
+  // The script doesn't reference anything but the libraries below directly.
+  // The calls to the runtime are routed through the import table.
+  config.setShared(true);
+  config.setBsymbolic(true);
+  config.setSOName(llvm::sys::path::filename(pSOPath).str());
+  config.setDyld("/system/bin/linker");
+  config.setSysRoot("/");
+  config.addSearchDir("=/system/lib");
+
+  // The shared object may be dlopen()'ed by this or the other processes.
+  // Link into a new file and rename() it over the old one so that the
+  // existing mappings are never truncated.
+  android::String8 tmp_so_path(pSOPath);
+  tmp_so_path.append(".tmp");
+
+  // Constructors of the script are never run (neither does ObjectLoader) so
+  // crtbegin_so.o and crtend_so.o are not linked in.
+  Linker::ErrorCode result;
+  {
+    Linker linker;
+    result = linker.config(config);
+    if (result == Linker::kSuccess) {
+      result = linker.setOutput(tmp_so_path.string());
+    }
+    if (result == Linker::kSuccess) {
+      result = linker.addObject(pObjPath);
+    }
+    if (result == Linker::kSuccess) {
+      result = linker.addNameSpec("c");
+    }
+    if (result == Linker::kSuccess) {
+      result = linker.addNameSpec("m");
+    }
+    if (result == Linker::kSuccess) {
+      result = linker.addNameSpec("bcc");
+    }
+    if (result == Linker::kSuccess) {
+      result = linker.link();
+    }
+    // The output is written out and closed when the linker goes away.
+  }
+
+  if (result != Linker::kSuccess) {
+    ALOGW("Failed to link %s into shared object %s! (%s)", pObjPath, pSOPath,
+          Linker::GetErrorString(result));
+    ::unlink(tmp_so_path.string());
+    ::unlink(pSOPath);
+    return false;
+  }
+
+  if (::rename(tmp_so_path.string(), pSOPath) != 0) {
+    ALOGW("Failed to rename %s to %s! (%s)", tmp_so_path.string(), pSOPath,
+          ::strerror(errno));
+    ::unlink(tmp_so_path.string());
+    ::unlink(pSOPath);
+    return false;
+  }
+
+  return true;
+}
+
 RSExecutable *
 RSCompilerDriver::compileScript(RSScript &pScript,
                                 const char* pScriptName,
@@ -276,10 +422,24 @@ RSCompilerDriver::compileScript(RSScript &pScript,
     return NULL;
   }
 
+  //===--------------------------------------------------------------------===//
+  // Link the shared object.
+  //===--------------------------------------------------------------------===//
+  // A shared object left behind by the previous compilation is stale anyway.
+  // Failing to link only results in a warning since RSExecutable falls back
+  // to the ObjectLoader when the shared object is missing.
+  android::String8 so_path = RSExecutable::GetSharedObjectPath(pOutputPath);
+  if (mUseSharedObject) {
+    linkSharedObject(pOutputPath, so_path.string());
+  } else {
+    ::unlink(so_path.string());
+  }
+
   //===--------------------------------------------------------------------===//
   // Create the RSExecutable.
   //===--------------------------------------------------------------------===//
-  result = RSExecutable::Create(*info, *output_file, mResolver);
+  result = RSExecutable::Create(*info, *output_file, mResolver,
+                                mUseSharedObject);
   if (result == NULL) {
     delete info;
     delete output_file;
@@ -308,6 +468,12 @@ RSCompilerDriver::compileScript(RSScript &pScript,
   if (!result->syncInfo(/* pForce */true)) {
     ALOGW("%s was successfully compiled and loaded but its RS info file failed "
           "to write out!", pOutputPath);
+  } else {
+    RSCacheIndex *cache_index = getCacheIndex(pOutputPath);
+    if (cache_index != NULL) {
+      cache_index->update(pOutputPath,
+                          RSInfo::GetPath(*output_file).string());
+    }
   }
 
   return result;
@@ -343,6 +509,13 @@ RSExecutable *RSCompilerDriver::build(BCCContext &pContext,
   Sha1Util::GetSHA1DigestFromBuffer(bitcode_sha1, pBitcode, pBitcodeSize);
   dep_info.push(std::make_pair(pResName, bitcode_sha1));
 
+  // Objects compiled with different foreach loop options are not
+  // interchangeable.
+  uint8_t loop_options_sha1[SHA1_DIGEST_LENGTH];
+  GetForEachLoopOptionsSHA1(mConfig, loop_options_sha1);
+  dep_info.push(std::make_pair(ForEachLoopOptionsDependency,
+                               loop_options_sha1));
+
   //===--------------------------------------------------------------------===//
   // Construct output path.
   //===--------------------------------------------------------------------===//
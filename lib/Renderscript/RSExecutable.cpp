@@ -19,14 +19,187 @@
 #include "bcc/Config/Config.h"
 #include "bcc/Support/Disassembler.h"
 #include "bcc/Support/FileBase.h"
+#include "bcc/Support/InputFile.h"
 #include "bcc/Support/Log.h"
 #include "bcc/Support/OutputFile.h"
+#include "bcc/ExecutionEngine/RelocationCache.h"
 #include "bcc/ExecutionEngine/SymbolResolverProxy.h"
 
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
 #include <utils/String8.h>
 
 using namespace bcc;
 
+namespace {
+
+// Resolve the exported symbols of a RS executable in the order of
+// RSInfo::getSymbolLocations(). The locations are neither used nor recorded
+// for the scripts loaded by dlopen().
+class SymbolLocator {
+private:
+  const RSExecutable &mExecutable;
+  const ObjectLoader *mLoader;
+  const RSInfo::SymbolLocationListTy &mLocations;
+  // True if the recorded locations can be used.
+  bool mUseLocations;
+  size_t mNext;
+  RSInfo::SymbolLocationListTy mRecorded;
+
+  void *lookup(const char *pName, const char *pSuffix) const {
+    if (pSuffix == NULL) {
+      return mExecutable.getSymbolAddress(pName);
+    }
+    android::String8 name(pName);
+    name.append(pSuffix);
+    return mExecutable.getSymbolAddress(name.string());
+  }
+
+  void *record(const char *pName, const char *pSuffix) {
+    if (mLoader == NULL) {
+      return lookup(pName, pSuffix);
+    }
+
+    android::String8 name(pName);
+    if (pSuffix != NULL) {
+      name.append(pSuffix);
+    }
+
+    void *addr = mLoader->getSymbolAddress(name.string());
+    uint32_t section = (addr == NULL) ? rsinfo::gUndefSectionIndex :
+                                        rsinfo::gUnknownSectionIndex;
+    uint32_t offset = 0;
+
+    unsigned section_idx;
+    size_t section_offset;
+    if ((addr != NULL) &&
+        mLoader->getSymbolLocation(name.string(), section_idx,
+                                   section_offset)) {
+      // Only keep the location which agrees with the symbol address.
+      uint8_t *base =
+          reinterpret_cast<uint8_t *>(mLoader->getSectionAddress(section_idx));
+      if ((base != NULL) && ((base + section_offset) == addr)) {
+        section = section_idx;
+        offset = static_cast<uint32_t>(section_offset);
+      }
+    }
+
+    mRecorded.push(std::make_pair(section, offset));
+    return addr;
+  }
+
+public:
+  SymbolLocator(const RSExecutable &pExecutable, const ObjectLoader *pLoader,
+                const RSInfo::SymbolLocationListTy &pLocations,
+                size_t pNumSymbols)
+    : mExecutable(pExecutable), mLoader(pLoader), mLocations(pLocations),
+      mUseLocations((pLoader != NULL) && (pLocations.size() == pNumSymbols)),
+      mNext(0) { }
+
+  // Return the address of the next symbol which is named pName followed by
+  // pSuffix (if any.) The name is only used when the location of the symbol is
+  // not available.
+  void *next(const char *pName, const char *pSuffix = NULL) {
+    if (!mUseLocations) {
+      return record(pName, pSuffix);
+    }
+
+    const std::pair<uint32_t, uint32_t> &location = mLocations[mNext++];
+    if (location.first == rsinfo::gUndefSectionIndex) {
+      return NULL;
+    } else if (location.first != rsinfo::gUnknownSectionIndex) {
+      void *section = mLoader->getSectionAddress(location.first);
+      uint8_t *base = reinterpret_cast<uint8_t *>(section);
+      if (base != NULL) {
+        return (base + location.second);
+      }
+      ALOGW("Section #%u recorded for %s%s is not loaded! Fall back to the "
+            "lookup by name.", location.first, pName,
+            (pSuffix != NULL) ? pSuffix : "");
+    }
+    return lookup(pName, pSuffix);
+  }
+
+  inline bool hasRecorded() const
+  { return (mLoader != NULL) && !mUseLocations; }
+  inline const RSInfo::SymbolLocationListTy &getRecorded() const
+  { return mRecorded; }
+};
+
+// dlopen() returns the handle of the loaded one when the same shared object is
+// opened again, in which case the two RSExecutable would share the globals of
+// the script. Bionic matches the shared objects by their base name. Therefore,
+// the base names of the shared objects opened by RSExecutable are tracked to
+// make sure each of them is used by only one RSExecutable at a time.
+pthread_mutex_t gSharedObjectsLock = PTHREAD_MUTEX_INITIALIZER;
+android::Vector<std::string> gSharedObjects;
+
+std::string GetSharedObjectKey(const char *pPath) {
+  const char *slash = ::strrchr(pPath, '/');
+  return std::string((slash != NULL) ? (slash + 1) : pPath);
+}
+
+void *OpenSharedObject(const char *pPath) {
+  std::string key = GetSharedObjectKey(pPath);
+  void *handle = NULL;
+
+  pthread_mutex_lock(&gSharedObjectsLock);
+  for (size_t i = 0; i < gSharedObjects.size(); i++) {
+    if (gSharedObjects[i] == key) {
+      ALOGV("%s is in use. Load its object file instead.", pPath);
+      pthread_mutex_unlock(&gSharedObjectsLock);
+      return NULL;
+    }
+  }
+
+  handle = ::dlopen(pPath, RTLD_NOW | RTLD_LOCAL);
+  if (handle != NULL) {
+    gSharedObjects.push_back(key);
+  } else {
+    const char *err = ::dlerror();
+    ALOGW("Failed to load shared object %s! (%s)", pPath,
+          (err != NULL) ? err : "unknown error");
+  }
+  pthread_mutex_unlock(&gSharedObjectsLock);
+
+  return handle;
+}
+
+void CloseSharedObject(const char *pPath, void *pHandle) {
+  std::string key = GetSharedObjectKey(pPath);
+
+  pthread_mutex_lock(&gSharedObjectsLock);
+  ::dlclose(pHandle);
+  for (size_t i = 0; i < gSharedObjects.size(); i++) {
+    if (gSharedObjects[i] == key) {
+      gSharedObjects.removeAt(i);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&gSharedObjectsLock);
+  return;
+}
+
+// Return true if the shared object pSOPath exists and isn't older than the
+// object pObjPath it was linked from.
+bool IsSharedObjectUpToDate(const char *pSOPath, const char *pObjPath) {
+  struct stat so_stat, obj_stat;
+  if ((::stat(pSOPath, &so_stat) != 0) || (::stat(pObjPath, &obj_stat) != 0)) {
+    return false;
+  }
+  return (so_stat.st_mtime >= obj_stat.st_mtime);
+}
+
+} // end anonymous namespace
+
 const char *RSExecutable::SpecialFunctionNames[] = {
   "root",
   "init",
@@ -35,39 +208,123 @@ const char *RSExecutable::SpecialFunctionNames[] = {
   NULL
 };
 
+const char RSExecutable::ImportTableSymbolName[] = ".rs.imports";
+const char RSExecutable::ImportNameTableSymbolName[] = ".rs.import_names";
+
+android::String8 RSExecutable::GetSharedObjectPath(const char *pObjPath) {
+  android::String8 result(pObjPath);
+  result.append(".so");
+  return result;
+}
+
 RSExecutable *RSExecutable::Create(RSInfo &pInfo,
                                    FileBase &pObjFile,
-                                   SymbolResolverProxy &pResolver) {
-  // Load the object file. Enable the GDB's JIT debugging if the script contains
-  // debug information.
-  ObjectLoader *loader = ObjectLoader::Load(pObjFile,
-                                            pResolver,
-                                            pInfo.hasDebugInformation());
-  if (loader == NULL) {
-    return NULL;
+                                   SymbolResolverProxy &pResolver,
+                                   bool pUseSharedObject) {
+  // Replay the external symbols resolved by the previous load of the object
+  // if the libraries they come from haven't changed.
+  android::String8 reloc_path = RelocationCache::GetPath(pObjFile);
+  RelocationCache reloc_cache(pResolver);
+  {
+    InputFile reloc_file(reloc_path.string());
+    if (!reloc_file.hasError() && pObjFile.lock(FileBase::kReadLock)) {
+      reloc_cache.read(reloc_file);
+      pObjFile.unlock();
+    }
+  }
+
+  // Prefer the shared object linked from pObjFile. The dynamic linker maps its
+  // text from the file so the pages are shared among the processes.
+  android::String8 so_path = GetSharedObjectPath(pObjFile.getName().c_str());
+  ObjectLoader *loader = NULL;
+  void *shared_object = NULL;
+  if (pUseSharedObject) {
+    if (IsSharedObjectUpToDate(so_path.string(), pObjFile.getName().c_str())) {
+      shared_object = OpenSharedObject(so_path.string());
+    }
+  }
+
+  if (shared_object == NULL) {
+    // Load the object file. Enable the GDB's JIT debugging if the script
+    // contains debug information.
+    loader = ObjectLoader::Load(pObjFile, reloc_cache,
+                                pInfo.hasDebugInformation());
+    if (loader == NULL) {
+      return NULL;
+    }
   }
 
   // Now, all things required to build a RSExecutable object are ready.
   RSExecutable *result = new (std::nothrow) RSExecutable(pInfo,
                                                          pObjFile,
-                                                         *loader);
+                                                         loader,
+                                                         shared_object);
   if (result == NULL) {
     ALOGE("Out of memory when create object to hold RS result file for %s!",
           pObjFile.getName().c_str());
+    delete loader;
+    if (shared_object != NULL) {
+      CloseSharedObject(so_path.string(), shared_object);
+    }
     return NULL;
   }
 
+  if (!result->resolveImports(reloc_cache)) {
+    // Don't take the ownership of pInfo and pObjFile on failure.
+    if (shared_object != NULL) {
+      CloseSharedObject(so_path.string(), shared_object);
+      result->mSharedObject = NULL;
+    }
+    result->mInfo = NULL;
+    result->mObjFile = NULL;
+    delete result;
+    return NULL;
+  }
+
+  // Failure to update the relocation cache only costs a full symbol
+  // resolution on the next load.
+  // The cache is written to a new file and rename()'d into place, so that the
+  // concurrent readers never see a partial one.
+  if (reloc_cache.isDirty() && pObjFile.lock(FileBase::kWriteLock)) {
+    android::String8 tmp_reloc_path(reloc_path);
+    tmp_reloc_path.append(".tmp");
+
+    bool written;
+    {
+      OutputFile reloc_file(tmp_reloc_path.string(), FileBase::kTruncate);
+      written = !reloc_file.hasError() && reloc_cache.write(reloc_file);
+    }
+
+    if (!written ||
+        (::rename(tmp_reloc_path.string(), reloc_path.string()) != 0)) {
+      ALOGW("Failed to update the relocation cache %s!", reloc_path.string());
+      ::unlink(tmp_reloc_path.string());
+    }
+    pObjFile.unlock();
+  }
+
+  // Use the symbol locations recorded in the RS info if they match the export
+  // lists. Otherwise, look up the symbols by name and record their locations.
+  const RSInfo::ExportVarNameListTy &export_var_names =
+      pInfo.getExportVarNames();
+  const RSInfo::ExportFuncNameListTy &export_func_names =
+      pInfo.getExportFuncNames();
+  const RSInfo::ExportForeachFuncListTy &export_foreach_funcs =
+      pInfo.getExportForeachFuncs();
+  size_t num_symbols = export_var_names.size() + export_func_names.size() +
+                       3 * export_foreach_funcs.size();
+  SymbolLocator locator(*result, loader, pInfo.getSymbolLocations(),
+                        num_symbols);
+
   unsigned idx;
   // Resolve addresses of RS export vars.
   idx = 0;
-  const RSInfo::ExportVarNameListTy &export_var_names =
-      pInfo.getExportVarNames();
   for (RSInfo::ExportVarNameListTy::const_iterator
            var_iter = export_var_names.begin(),
            var_end = export_var_names.end(); var_iter != var_end;
        var_iter++, idx++) {
     const char *name = *var_iter;
-    void *addr = result->getSymbolAddress(name);
+    void *addr = locator.next(name);
     if (addr == NULL) {
       ALOGW("RS export var at entry #%u named %s cannot be found in the result "
             "object!", idx, name);
@@ -77,14 +334,12 @@ RSExecutable *RSExecutable::Create(RSInfo &pInfo,
 
   // Resolve addresses of RS export functions.
   idx = 0;
-  const RSInfo::ExportFuncNameListTy &export_func_names =
-      pInfo.getExportFuncNames();
   for (RSInfo::ExportFuncNameListTy::const_iterator
            func_iter = export_func_names.begin(),
            func_end = export_func_names.end(); func_iter != func_end;
        func_iter++, idx++) {
     const char *name = *func_iter;
-    void *addr = result->getSymbolAddress(name);
+    void *addr = locator.next(name);
     if (addr == NULL) {
       ALOGW("RS export func at entry #%u named %s cannot be found in the result"
             " object!", idx, name);
@@ -94,21 +349,36 @@ RSExecutable *RSExecutable::Create(RSInfo &pInfo,
 
   // Resolve addresses of expanded RS foreach function.
   idx = 0;
-  const RSInfo::ExportForeachFuncListTy &export_foreach_funcs =
-      pInfo.getExportForeachFuncs();
   for (RSInfo::ExportForeachFuncListTy::const_iterator
            foreach_iter = export_foreach_funcs.begin(),
            foreach_end = export_foreach_funcs.end();
        foreach_iter != foreach_end; foreach_iter++, idx++) {
     const char *func_name = foreach_iter->first;
-    android::String8 expanded_func_name(func_name);
-    expanded_func_name.append(".expand");
-    void *addr = result->getSymbolAddress(expanded_func_name.string());
+    void *addr = locator.next(func_name, ".expand");
     if (addr == NULL) {
-      ALOGW("Expanded RS foreach at entry #%u named %s cannot be found in the "
-            "result object!", idx, expanded_func_name.string());
+      ALOGW("Expanded RS foreach at entry #%u named %s.expand cannot be found "
+            "in the result object!", idx, func_name);
     }
     result->mExportForeachFuncAddrs.push_back(addr);
+
+    // The cache-blocked variant is optional.
+    void *tile_addr = locator.next(func_name, ".expand_tile");
+    const uint32_t *tile_dims = reinterpret_cast<const uint32_t *>(
+        locator.next(func_name, ".expand_tile_dims"));
+    if (tile_addr == NULL) {
+      tile_dims = NULL;
+    } else if (tile_dims == NULL) {
+      ALOGW("Tiled RS foreach at entry #%u for %s is missing its tile "
+            "dimension!", idx, func_name);
+      tile_addr = NULL;
+    }
+    result->mExportForeachTileFuncAddrs.push_back(tile_addr);
+    result->mExportForeachTileDims.push_back(tile_dims);
+  }
+
+  if (locator.hasRecorded()) {
+    pInfo.setSymbolLocations(locator.getRecorded());
+    result->mIsInfoDirty = true;
   }
 
   // Copy pragma key/value pairs from RSInfo::getPragmas() into mPragmaKeys and
@@ -124,32 +394,81 @@ RSExecutable *RSExecutable::Create(RSInfo &pInfo,
   return result;
 }
 
+bool RSExecutable::resolveImports(SymbolResolverInterface &pResolver) {
+  void **table =
+      reinterpret_cast<void **>(getSymbolAddress(ImportTableSymbolName));
+  const char * const *names = reinterpret_cast<const char * const *>(
+      getSymbolAddress(ImportNameTableSymbolName));
+
+  if ((table == NULL) || (names == NULL)) {
+    // The script calls the external functions directly.
+    return true;
+  }
+
+  for (size_t i = 0; names[i] != NULL; i++) {
+    table[i] = pResolver.getAddress(names[i]);
+    if (table[i] == NULL) {
+      ALOGE("Function %s imported by %s cannot be resolved!", names[i],
+            mObjFile->getName().c_str());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void *RSExecutable::getSymbolAddress(const char *pName) const {
+  if (mSharedObject != NULL) {
+    return ::dlsym(mSharedObject, pName);
+  }
+  return mLoader->getSymbolAddress(pName);
+}
+
 bool RSExecutable::syncInfo(bool pForce) {
   if (!pForce && !mIsInfoDirty) {
     return true;
   }
 
   android::String8 info_path = RSInfo::GetPath(*mObjFile);
-  OutputFile info_file(info_path.string(), FileBase::kTruncate);
-
-  if (info_file.hasError()) {
-    ALOGE("Failed to open the info file %s for write! (%s)", info_path.string(),
-          info_file.getErrorMessage().c_str());
-    return false;
-  }
 
   // Operation to the RS info file need to acquire the lock on the output file
   // first.
   if (!mObjFile->lock(FileBase::kWriteLock)) {
     ALOGE("Write to RS info file %s required the acquisition of the write lock "
           "on %s but got failure! (%s)", info_path.string(),
-          mObjFile->getName().c_str(), info_file.getErrorMessage().c_str());
+          mObjFile->getName().c_str(), mObjFile->getErrorMessage().c_str());
     return false;
   }
 
-  // Perform the write.
-  if (!mInfo->write(info_file)) {
+  // The RS info file may be mapped by the RSInfo read from it (in this or the
+  // other processes.) Write a new file and rename() it over the old one so
+  // that the existing mappings are never truncated.
+  android::String8 tmp_info_path(info_path);
+  tmp_info_path.append(".tmp");
+
+  bool result;
+  {
+    OutputFile info_file(tmp_info_path.string(), FileBase::kTruncate);
+
+    if (info_file.hasError()) {
+      ALOGE("Failed to open the info file %s for write! (%s)",
+            tmp_info_path.string(), info_file.getErrorMessage().c_str());
+      result = false;
+    } else {
+      // Perform the write.
+      result = mInfo->write(info_file);
+    }
+  }
+
+  if (result && (::rename(tmp_info_path.string(), info_path.string()) != 0)) {
+    ALOGE("Failed to rename %s to %s! (%s)", tmp_info_path.string(),
+          info_path.string(), ::strerror(errno));
+    result = false;
+  }
+
+  if (!result) {
     ALOGE("Failed to sync the RS info file %s!", info_path.string());
+    ::unlink(tmp_info_path.string());
     mObjFile->unlock();
     return false;
   }
@@ -161,7 +480,8 @@ bool RSExecutable::syncInfo(bool pForce) {
 
 void RSExecutable::dumpDisassembly(OutputFile &pOutput) const {
 #if DEBUG_MC_DISASSEMBLER
-  if (pOutput.hasError()) {
+  // The code of a shared object can be examined with the usual tools.
+  if (pOutput.hasError() || (mLoader == NULL)) {
     return;
   }
 
@@ -202,7 +522,14 @@ void RSExecutable::dumpDisassembly(OutputFile &pOutput) const {
 }
 
 RSExecutable::~RSExecutable() {
-  syncInfo();
+  if (mInfo != NULL) {
+    syncInfo();
+  }
+  if (mSharedObject != NULL) {
+    android::String8 so_path =
+        GetSharedObjectPath(mObjFile->getName().c_str());
+    CloseSharedObject(so_path.string(), mSharedObject);
+  }
   delete mInfo;
   delete mObjFile;
   delete mLoader;
@@ -0,0 +1,364 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSForEachExecutor.h"
+
+#include <cstring>
+#include <new>
+
+#include <time.h>
+
+#include "bcc/Renderscript/RSExecutable.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+uint64_t GetTimeNs() {
+  struct timespec now;
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  return (static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec);
+}
+
+} // end anonymous namespace
+
+RSForEachExecutor::RSForEachExecutor(unsigned pNumThreads,
+                                     uint32_t pChunkSize)
+  : mNumThreads((pNumThreads > 0) ? pNumThreads : 1), mChunkSize(pChunkSize),
+    mWorkers(NULL), mGeneration(0), mNumBusyWorkers(0), mShutdown(false),
+    mHasError(false), mFunc(NULL), mTileFunc(NULL), mLaunch(NULL),
+    mNumActiveWorkers(0), mCellsPerChunk(0), mRowsPerChunk(0),
+    mChunksPerRow(0) {
+  pthread_mutex_init(&mLock, NULL);
+  pthread_cond_init(&mWorkCond, NULL);
+  pthread_cond_init(&mDoneCond, NULL);
+
+  mWorkers = new (std::nothrow) Worker[mNumThreads];
+  if (mWorkers == NULL) {
+    ALOGE("Out of memory when allocate %u workers for foreach executor!",
+          mNumThreads);
+    mHasError = true;
+    return;
+  }
+
+  for (unsigned i = 0; i < mNumThreads; i++) {
+    Worker &worker = mWorkers[i];
+    worker.mExecutor = this;
+    worker.mIndex = i;
+    pthread_mutex_init(&worker.mLock, NULL);
+    worker.mBegin = worker.mEnd = 0;
+    worker.mNumSteals = 0;
+  }
+
+  // The calling thread acts as worker #0.
+  for (unsigned i = 1; i < mNumThreads; i++) {
+    int error = ::pthread_create(&mWorkers[i].mThread, NULL, WorkerMain,
+                                 &mWorkers[i]);
+    if (error != 0) {
+      ALOGE("Failed to create worker thread #%u for foreach executor! (%s)", i,
+            ::strerror(error));
+      // Only keep the threads which have been started.
+      mNumThreads = i;
+      mHasError = true;
+      return;
+    }
+  }
+
+  return;
+}
+
+RSForEachExecutor::~RSForEachExecutor() {
+  pthread_mutex_lock(&mLock);
+  mShutdown = true;
+  pthread_cond_broadcast(&mWorkCond);
+  pthread_mutex_unlock(&mLock);
+
+  if (mWorkers != NULL) {
+    for (unsigned i = 1; i < mNumThreads; i++) {
+      ::pthread_join(mWorkers[i].mThread, NULL);
+    }
+    for (unsigned i = 0; i < mNumThreads; i++) {
+      pthread_mutex_destroy(&mWorkers[i].mLock);
+    }
+    delete [] mWorkers;
+  }
+
+  pthread_cond_destroy(&mDoneCond);
+  pthread_cond_destroy(&mWorkCond);
+  pthread_mutex_destroy(&mLock);
+}
+
+void *RSForEachExecutor::WorkerMain(void *pWorker) {
+  Worker &worker = *reinterpret_cast<Worker *>(pWorker);
+  RSForEachExecutor &executor = *worker.mExecutor;
+  unsigned generation = 0;
+
+  pthread_mutex_lock(&executor.mLock);
+  while (true) {
+    while (!executor.mShutdown && (executor.mGeneration == generation)) {
+      pthread_cond_wait(&executor.mWorkCond, &executor.mLock);
+    }
+    if (executor.mShutdown) {
+      break;
+    }
+    generation = executor.mGeneration;
+
+    if (worker.mIndex >= executor.mNumActiveWorkers) {
+      // Not taking part in this launch.
+      continue;
+    }
+
+    pthread_mutex_unlock(&executor.mLock);
+    executor.work(worker);
+    pthread_mutex_lock(&executor.mLock);
+
+    if (--executor.mNumBusyWorkers == 0) {
+      pthread_cond_signal(&executor.mDoneCond);
+    }
+  }
+  pthread_mutex_unlock(&executor.mLock);
+
+  return NULL;
+}
+
+void RSForEachExecutor::runChunk(uint32_t pChunk) {
+  const Launch &launch = *mLaunch;
+  uint32_t y = (pChunk / mChunksPerRow) * mRowsPerChunk;
+  uint32_t x1 = (pChunk % mChunksPerRow) * mCellsPerChunk;
+  uint32_t x2 = x1 + mCellsPerChunk;
+  if (x2 > launch.dimX) {
+    x2 = launch.dimX;
+  }
+
+  // Follow the Renderscript driver: p->in and p->out point to the cell
+  // (x1, y) while x1 and x2 give the range of x. The tiled function walks the
+  // rows itself.
+  StubParam p;
+  ::memset(&p, 0, sizeof(p));
+  if (launch.in != NULL) {
+    p.in = reinterpret_cast<const uint8_t *>(launch.in) +
+           (static_cast<size_t>(launch.inYStride) * y) +
+           (static_cast<size_t>(launch.inStep) * x1);
+  }
+  if (launch.out != NULL) {
+    p.out = reinterpret_cast<uint8_t *>(launch.out) +
+            (static_cast<size_t>(launch.outYStride) * y) +
+            (static_cast<size_t>(launch.outStep) * x1);
+  }
+  p.usr = launch.usr;
+  p.usr_len = launch.usrLen;
+  p.y = y;
+
+  if (mTileFunc != NULL) {
+    uint32_t y2 = y + mRowsPerChunk;
+    if (y2 > launch.dimY) {
+      y2 = launch.dimY;
+    }
+    p.tile_x1 = x1;
+    p.tile_x2 = x2;
+    p.tile_y1 = y;
+    p.tile_y2 = y2;
+    p.in_ystride = launch.inYStride;
+    p.out_ystride = launch.outYStride;
+    mTileFunc(&p, launch.inStep, launch.outStep);
+  } else {
+    mFunc(&p, x1, x2, launch.inStep, launch.outStep);
+  }
+  return;
+}
+
+bool RSForEachExecutor::grabChunk(Worker &pWorker, uint32_t &pChunk) {
+  bool result = false;
+
+  pthread_mutex_lock(&pWorker.mLock);
+  if (pWorker.mBegin < pWorker.mEnd) {
+    pChunk = pWorker.mBegin++;
+    result = true;
+  }
+  pthread_mutex_unlock(&pWorker.mLock);
+
+  return result;
+}
+
+bool RSForEachExecutor::stealChunks(Worker &pThief) {
+  for (unsigned i = 1; i < mNumActiveWorkers; i++) {
+    Worker &victim = mWorkers[(pThief.mIndex + i) % mNumActiveWorkers];
+    uint32_t begin, end;
+
+    // Take the upper half of the remaining range of the victim. The owner
+    // keeps consuming from the lower end.
+    pthread_mutex_lock(&victim.mLock);
+    end = victim.mEnd;
+    begin = victim.mEnd - (victim.mEnd - victim.mBegin + 1) / 2;
+    victim.mEnd = begin;
+    pthread_mutex_unlock(&victim.mLock);
+
+    if (begin < end) {
+      pthread_mutex_lock(&pThief.mLock);
+      pThief.mBegin = begin;
+      pThief.mEnd = end;
+      pthread_mutex_unlock(&pThief.mLock);
+      pThief.mNumSteals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void RSForEachExecutor::work(Worker &pWorker) {
+  uint32_t chunk;
+  do {
+    while (grabChunk(pWorker, chunk)) {
+      runChunk(chunk);
+    }
+  } while (stealChunks(pWorker));
+  return;
+}
+
+bool RSForEachExecutor::run(ExpandedFuncTy pFunc, bool pThreadable,
+                            const Launch &pLaunch, Stats *pStats) {
+  if (pFunc == NULL) {
+    ALOGE("Invalid expanded foreach function (NULL) supplied to executor!");
+    return false;
+  }
+
+  mFunc = pFunc;
+  mCellsPerChunk = ((mChunkSize == 0) || (mChunkSize > pLaunch.dimX)) ?
+                      pLaunch.dimX : mChunkSize;
+  mRowsPerChunk = 1;
+
+  return launch(pThreadable, pLaunch, pStats);
+}
+
+bool RSForEachExecutor::runTiled(TiledFuncTy pFunc, uint32_t pTileWidth,
+                                 uint32_t pTileHeight, bool pThreadable,
+                                 const Launch &pLaunch, Stats *pStats) {
+  if ((pFunc == NULL) || (pTileWidth == 0) || (pTileHeight == 0)) {
+    ALOGE("Invalid tiled foreach function or tile dimension (%ux%u) supplied "
+          "to executor!", pTileWidth, pTileHeight);
+    return false;
+  }
+
+  mTileFunc = pFunc;
+  mCellsPerChunk = (pTileWidth > pLaunch.dimX) ? pLaunch.dimX : pTileWidth;
+  mRowsPerChunk = (pTileHeight > pLaunch.dimY) ? pLaunch.dimY : pTileHeight;
+
+  return launch(pThreadable, pLaunch, pStats);
+}
+
+bool RSForEachExecutor::launch(bool pThreadable, const Launch &pLaunch,
+                               Stats *pStats) {
+  if (pStats != NULL) {
+    ::memset(pStats, 0, sizeof(*pStats));
+  }
+
+  if (mHasError) {
+    ALOGE("Foreach executor is in error state!");
+    mFunc = NULL;
+    mTileFunc = NULL;
+    return false;
+  }
+
+  if ((pLaunch.dimX == 0) || (pLaunch.dimY == 0)) {
+    mFunc = NULL;
+    mTileFunc = NULL;
+    return true;
+  }
+
+  mLaunch = &pLaunch;
+  mChunksPerRow = (pLaunch.dimX + mCellsPerChunk - 1) / mCellsPerChunk;
+
+  uint32_t num_chunks = mChunksPerRow *
+      ((pLaunch.dimY + mRowsPerChunk - 1) / mRowsPerChunk);
+  unsigned num_workers = pThreadable ? mNumThreads : 1;
+  if (num_workers > num_chunks) {
+    num_workers = num_chunks;
+  }
+
+  // Hand out the chunks evenly. Work stealing takes care of the imbalance.
+  for (unsigned i = 0; i < mNumThreads; i++) {
+    Worker &worker = mWorkers[i];
+    if (i < num_workers) {
+      worker.mBegin = static_cast<uint32_t>(
+          static_cast<uint64_t>(num_chunks) * i / num_workers);
+      worker.mEnd = static_cast<uint32_t>(
+          static_cast<uint64_t>(num_chunks) * (i + 1) / num_workers);
+    } else {
+      worker.mBegin = worker.mEnd = 0;
+    }
+    worker.mNumSteals = 0;
+  }
+
+  uint64_t start = GetTimeNs();
+
+  pthread_mutex_lock(&mLock);
+  mNumActiveWorkers = num_workers;
+  mNumBusyWorkers = num_workers - 1;
+  mGeneration++;
+  pthread_cond_broadcast(&mWorkCond);
+  pthread_mutex_unlock(&mLock);
+
+  work(mWorkers[0]);
+
+  pthread_mutex_lock(&mLock);
+  while (mNumBusyWorkers > 0) {
+    pthread_cond_wait(&mDoneCond, &mLock);
+  }
+  pthread_mutex_unlock(&mLock);
+
+  uint64_t end = GetTimeNs();
+
+  if (pStats != NULL) {
+    pStats->numThreads = num_workers;
+    pStats->numElements = static_cast<uint64_t>(pLaunch.dimX) * pLaunch.dimY;
+    pStats->elapsedNs = end - start;
+    for (unsigned i = 0; i < num_workers; i++) {
+      pStats->numSteals += mWorkers[i].mNumSteals;
+    }
+  }
+
+  mFunc = NULL;
+  mTileFunc = NULL;
+  mLaunch = NULL;
+
+  return true;
+}
+
+bool RSForEachExecutor::run(const RSExecutable &pExecutable, size_t pSlot,
+                            const Launch &pLaunch, Stats *pStats) {
+  const android::Vector<void *> &funcs =
+      pExecutable.getExportForeachFuncAddrs();
+
+  if (pSlot >= funcs.size()) {
+    ALOGE("Invalid foreach slot %zu (only %zu foreach functions.)", pSlot,
+          funcs.size());
+    return false;
+  }
+
+  const android::Vector<void *> &tile_funcs =
+      pExecutable.getExportForeachTileFuncAddrs();
+  const android::Vector<const uint32_t *> &tile_dims =
+      pExecutable.getExportForeachTileDims();
+  if ((tile_funcs[pSlot] != NULL) && (tile_dims[pSlot] != NULL)) {
+    return runTiled(reinterpret_cast<TiledFuncTy>(tile_funcs[pSlot]),
+                    tile_dims[pSlot][0], tile_dims[pSlot][1],
+                    pExecutable.isThreadable(), pLaunch, pStats);
+  }
+
+  return run(reinterpret_cast<ExpandedFuncTy>(funcs[pSlot]),
+             pExecutable.isThreadable(), pLaunch, pStats);
+}
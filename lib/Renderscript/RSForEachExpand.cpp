@@ -19,10 +19,17 @@
 
 #include <cstdlib>
 
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Twine.h>
 #include <llvm/DerivedTypes.h>
+#include <llvm/Constants.h>
 #include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
 #include <llvm/Instructions.h>
+#include <llvm/Intrinsics.h>
 #include <llvm/IRBuilder.h>
+#include <llvm/Metadata.h>
 #include <llvm/Module.h>
 #include <llvm/Pass.h>
 #include <llvm/Support/raw_ostream.h>
@@ -43,7 +50,9 @@ namespace {
  * input/output allocations (adjusting other relevant parameters as we go). We
  * support doing this for any ForEach-able compute kernels. The new function
  * name is the original function name followed by ".expand". Note that we
- * still generate code for the original function.
+ * still generate code for the original function. Specialized loops the
+ * ".expand" function dispatches to (".expand.contig" and ".expand.strided")
+ * and the cache-blocked ".expand_tile" variant may be generated as well.
  */
 class RSForEachExpandPass : public llvm::ModulePass {
 private:
@@ -54,9 +63,26 @@ private:
 
   const RSInfo::ExportForeachFuncListTy &mFuncs;
 
-  // Turns on optimization of allocation stride values.
+  // Turns on optimization of allocation stride values. A loop stepping through
+  // the allocations by constant element sizes is emitted next to the one using
+  // the driver-supplied steps, and "<NAME>.expand" picks one of them at
+  // runtime.
   bool mEnableStepOpt;
 
+  // Size (in bytes) of the data a single tile should touch when generating the
+  // cache-blocked ".expand_tile" variants. Zero disables tiling.
+  unsigned mTileCacheSize;
+
+  // Number of elements ahead of the current one to prefetch from the input
+  // allocation. Zero disables software prefetch.
+  unsigned mPrefetchDistance;
+
+  // Use non-temporal stores for the output of the kernels.
+  bool mNonTemporalStore;
+
+  // Pointer to RsForEachStubParamStruct. See getForEachStubPtrTy().
+  llvm::Type *mForEachStubPtrTy;
+
   uint32_t getRootSignature(llvm::Function *F) {
     const llvm::NamedMDNode *ExportForEachMetadata =
         M->getNamedMetadata("#rs_export_foreach");
@@ -106,14 +132,15 @@ private:
   // TD - Target Data size/layout information.
   // T - Type of allocation (should be a pointer).
   // OrigStep - Original step increment (root.expand() input from driver).
+  // ConstStep - Use the size of the element type as the step if possible.
   llvm::Value *getStepValue(llvm::TargetData *TD, llvm::Type *T,
-                            llvm::Value *OrigStep) {
+                            llvm::Value *OrigStep, bool ConstStep) {
     bccAssert(TD);
     bccAssert(T);
     bccAssert(OrigStep);
     llvm::PointerType *PT = llvm::dyn_cast<llvm::PointerType>(T);
     llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*C);
-    if (mEnableStepOpt && T != VoidPtrTy && PT) {
+    if (ConstStep && T != VoidPtrTy && PT) {
       llvm::Type *ET = PT->getElementType();
       uint64_t ETSize = TD->getTypeAllocSize(ET);
       llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
@@ -147,52 +174,86 @@ private:
     return Signature & 0x20;
   }
 
+  // Prefetch the input element mPrefetchDistance elements (of size InStep)
+  // ahead of InPtr. Does nothing if software prefetch is disabled.
+  void emitPrefetch(llvm::IRBuilder<> &Builder, llvm::Value *InPtr,
+                    llvm::Value *InStep) {
+    if (mPrefetchDistance == 0) {
+      return;
+    }
 
-public:
-  RSForEachExpandPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
-                      bool pEnableStepOpt)
-      : ModulePass(ID), M(NULL), C(NULL), mFuncs(pForeachFuncs),
-        mEnableStepOpt(pEnableStepOpt) {
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    llvm::Value *Offset = Builder.CreateMul(
+        InStep, llvm::ConstantInt::get(Int32Ty, mPrefetchDistance));
+    llvm::Value *Addr = Builder.CreateIntToPtr(Builder.CreateAdd(
+        Builder.CreatePtrToInt(InPtr, Int32Ty), Offset),
+        llvm::Type::getInt8PtrTy(*C), "PrefetchAddr");
+
+    // llvm.prefetch(address, rw = read, locality = high, cache type = data)
+    llvm::Function *Prefetch =
+        llvm::Intrinsic::getDeclaration(M, llvm::Intrinsic::prefetch);
+    llvm::Value *PrefetchArgs[] = {
+      Addr,
+      llvm::ConstantInt::get(Int32Ty, 0),
+      llvm::ConstantInt::get(Int32Ty, 3),
+      llvm::ConstantInt::get(Int32Ty, 1)
+    };
+    Builder.CreateCall(Prefetch, PrefetchArgs);
+    return;
   }
 
-  /* Performs the actual optimization on a selected function. On success, the
-   * Module will contain a new function of the name "<NAME>.expand" that
-   * invokes <NAME>() in a loop with the appropriate parameters.
-   */
-  bool ExpandFunction(llvm::Function *F, uint32_t Signature) {
-    ALOGV("Expanding ForEach-able Function %s", F->getName().str().c_str());
-
-    if (!Signature) {
-      Signature = getRootSignature(F);
-      if (!Signature) {
-        // We couldn't determine how to expand this function based on its
-        // function signature.
-        return false;
-      }
+  // Turn Store into a non-temporal store if requested. The code generator
+  // lowers it to a streaming store where the target supports one (e.g.,
+  // MOVNT* on x86) and to a regular store otherwise.
+  void markNonTemporal(llvm::StoreInst *Store) {
+    if (!mNonTemporalStore) {
+      return;
     }
 
-    llvm::TargetData TD(M);
+    llvm::Value *One = llvm::ConstantInt::get(llvm::Type::getInt32Ty(*C), 1);
+    Store->setMetadata(M->getMDKindID("nontemporal"),
+                       llvm::MDNode::get(*C, One));
+    return;
+  }
+
+  /* Return the type of pointer to RsForEachStubParamStruct. The struct type is
+   * created once per module so that the ".expand" and ".expand_tile" variants
+   * of a kernel agree on the type of their first parameter.
+   *
+   * Defined in frameworks/base/libs/rs/rs_hal.h:
+   *
+   * struct RsForEachStubParamStruct {
+   *   const void *in;
+   *   void *out;
+   *   const void *usr;
+   *   size_t usr_len;
+   *   uint32_t x;
+   *   uint32_t y;
+   *   uint32_t z;
+   *   uint32_t lod;
+   *   enum RsAllocationCubemapFace face;
+   *   uint32_t ar[16];
+   *
+   *   // Only read by the ".expand_tile" variants. The driver never has to
+   *   // populate these when calling the ".expand" functions.
+   *   uint32_t tile_x1;
+   *   uint32_t tile_x2;
+   *   uint32_t tile_y1;
+   *   uint32_t tile_y2;
+   *   uint32_t in_ystride;
+   *   uint32_t out_ystride;
+   * };
+   */
+  llvm::Type *getForEachStubPtrTy() {
+    if (mForEachStubPtrTy != NULL) {
+      return mForEachStubPtrTy;
+    }
 
     llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*C);
     llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
     llvm::Type *SizeTy = Int32Ty;
 
-    /* Defined in frameworks/base/libs/rs/rs_hal.h:
-     *
-     * struct RsForEachStubParamStruct {
-     *   const void *in;
-     *   void *out;
-     *   const void *usr;
-     *   size_t usr_len;
-     *   uint32_t x;
-     *   uint32_t y;
-     *   uint32_t z;
-     *   uint32_t lod;
-     *   enum RsAllocationCubemapFace face;
-     *   uint32_t ar[16];
-     * };
-     */
-    llvm::SmallVector<llvm::Type*, 9> StructTys;
+    llvm::SmallVector<llvm::Type*, 16> StructTys;
     StructTys.push_back(VoidPtrTy);  // const void *in
     StructTys.push_back(VoidPtrTy);  // void *out
     StructTys.push_back(VoidPtrTy);  // const void *usr
@@ -203,10 +264,206 @@ public:
     StructTys.push_back(Int32Ty);    // uint32_t lod
     StructTys.push_back(Int32Ty);    // enum RsAllocationCubemapFace
     StructTys.push_back(llvm::ArrayType::get(Int32Ty, 16));  // uint32_t ar[16]
-
-    llvm::Type *ForEachStubPtrTy = llvm::StructType::create(
+    StructTys.push_back(Int32Ty);    // uint32_t tile_x1
+    StructTys.push_back(Int32Ty);    // uint32_t tile_x2
+    StructTys.push_back(Int32Ty);    // uint32_t tile_y1
+    StructTys.push_back(Int32Ty);    // uint32_t tile_y2
+    StructTys.push_back(Int32Ty);    // uint32_t in_ystride
+    StructTys.push_back(Int32Ty);    // uint32_t out_ystride
+
+    mForEachStubPtrTy = llvm::StructType::create(
         StructTys, "RsForEachStubParamStruct")->getPointerTo();
 
+    return mForEachStubPtrTy;
+  }
+
+  // Compute the dimension (in cells) of the tile for a kernel whose input and
+  // output cells take InSize and OutSize bytes, respectively. A tile covers
+  // whole cache lines in its rows and the data it touches fits into
+  // mTileCacheSize bytes.
+  void getTileDims(uint64_t InSize, uint64_t OutSize,
+                   uint32_t &TileWidth, uint32_t &TileHeight) const {
+    uint64_t CellSize = InSize + OutSize;
+    if (CellSize == 0) {
+      CellSize = 1;
+    }
+
+    uint64_t TileCells = mTileCacheSize / CellSize;
+    if (TileCells == 0) {
+      TileCells = 1;
+    }
+
+    // Start from the largest power of two no greater than sqrt(TileCells) so
+    // that tiles are roughly square.
+    uint64_t Width = 1;
+    while ((Width * 2) * (Width * 2) <= TileCells) {
+      Width *= 2;
+    }
+
+    // Rows of a tile should span whole cache lines.
+    uint64_t MaxCellSize = (InSize > OutSize) ? InSize : OutSize;
+    if (MaxCellSize > 0) {
+      uint64_t LineCells = RS_FOREACH_CACHE_LINE_SIZE / MaxCellSize;
+      if ((LineCells > 0) && (Width < LineCells)) {
+        Width = LineCells;
+      }
+    }
+
+    uint64_t Height = TileCells / Width;
+    if (Height == 0) {
+      Height = 1;
+    }
+
+    TileWidth = static_cast<uint32_t>(Width);
+    TileHeight = static_cast<uint32_t>(Height);
+  }
+
+  /* Create "<NAME>.expand_tile", the cache-blocked variant of ExpandedFunc
+   * (i.e., "<NAME>.expand".) It walks the rows [p->tile_y1, p->tile_y2) and
+   * invokes ExpandedFunc on the columns [p->tile_x1, p->tile_x2) of each row.
+   * p->in and p->out must point to the cell (p->tile_x1, p->tile_y1) on entry
+   * and are advanced by p->in_ystride and p->out_ystride bytes per row.
+   *
+   * The tile dimension the driver should use is emitted as a constant global
+   * "<NAME>.expand_tile_dims" of type uint32_t[2] ({ width, height }).
+   */
+  bool ExpandTile(llvm::Function *F, llvm::Function *ExpandedFunc,
+                  uint64_t InSize, uint64_t OutSize) {
+    ALOGV("Creating tiled variant of ForEach-able Function %s",
+          F->getName().str().c_str());
+
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    llvm::Type *ForEachStubPtrTy = getForEachStubPtrTy();
+
+    uint32_t TileWidth, TileHeight;
+    getTileDims(InSize, OutSize, TileWidth, TileHeight);
+
+    llvm::Constant *Dims[] = {
+      llvm::ConstantInt::get(Int32Ty, TileWidth),
+      llvm::ConstantInt::get(Int32Ty, TileHeight)
+    };
+    llvm::ArrayType *DimsTy = llvm::ArrayType::get(Int32Ty, 2);
+    new llvm::GlobalVariable(*M, DimsTy, /* isConstant */true,
+                             llvm::GlobalValue::ExternalLinkage,
+                             llvm::ConstantArray::get(DimsTy, Dims),
+                             F->getName() + ".expand_tile_dims");
+
+    /* Create the function signature for the tiled function.
+     * void (const RsForEachStubParamStruct *p, uint32_t instep,
+     *       uint32_t outstep)
+     */
+    llvm::SmallVector<llvm::Type*, 8> ParamTys;
+    ParamTys.push_back(ForEachStubPtrTy);  // const RsForEachStubParamStruct *p
+    ParamTys.push_back(Int32Ty);           // uint32_t instep
+    ParamTys.push_back(Int32Ty);           // uint32_t outstep
+
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*C), ParamTys, false);
+    llvm::Function *TileFunc =
+        llvm::Function::Create(FT,
+                               llvm::GlobalValue::ExternalLinkage,
+                               F->getName() + ".expand_tile", M);
+
+    llvm::Function::arg_iterator Args = TileFunc->arg_begin();
+    llvm::Value *Arg_p = Args++;
+    llvm::Value *Arg_instep = Args++;
+    llvm::Value *Arg_outstep = Args++;
+
+    Arg_p->setName("p");
+    Arg_instep->setName("arg_instep");
+    Arg_outstep->setName("arg_outstep");
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", TileFunc);
+    llvm::IRBuilder<> Builder(Begin);
+
+    // Take a private copy of *p so that p->in, p->out and p->y can be updated
+    // for each row without touching the driver's copy.
+    llvm::AllocaInst *ALocalP = Builder.CreateAlloca(
+        llvm::cast<llvm::PointerType>(ForEachStubPtrTy)->getElementType(), 0,
+        "LocalP");
+    Builder.CreateStore(Builder.CreateLoad(Arg_p), ALocalP);
+
+    llvm::Value *TileX1 =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 10), "tile_x1");
+    llvm::Value *TileX2 =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 11), "tile_x2");
+    llvm::Value *TileY1 =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 12), "tile_y1");
+    llvm::Value *TileY2 =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 13), "tile_y2");
+    llvm::Value *InYStride =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 14), "in_ystride");
+    llvm::Value *OutYStride =
+        Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 15), "out_ystride");
+
+    llvm::Value *InRowPtr = Builder.CreateStructGEP(ALocalP, 0);
+    llvm::Value *OutRowPtr = Builder.CreateStructGEP(ALocalP, 1);
+    llvm::Value *YPtr = Builder.CreateStructGEP(ALocalP, 5);
+    Builder.CreateStore(TileY1, YPtr);
+
+    llvm::BasicBlock *Loop = llvm::BasicBlock::Create(*C, "Loop", TileFunc);
+    llvm::BasicBlock *Exit = llvm::BasicBlock::Create(*C, "Exit", TileFunc);
+
+    // if (tile_y1 < tile_y2) goto Loop; else goto Exit;
+    llvm::Value *Cond = Builder.CreateICmpSLT(TileY1, TileY2);
+    Builder.CreateCondBr(Cond, Loop, Exit);
+
+    // Loop:
+    Builder.SetInsertPoint(Loop);
+
+    // <NAME>.expand(&LocalP, tile_x1, tile_x2, instep, outstep);
+    llvm::Value *RowArgs[] = {
+      ALocalP, TileX1, TileX2, Arg_instep, Arg_outstep
+    };
+    Builder.CreateCall(ExpandedFunc, RowArgs);
+
+    // LocalP.in += in_ystride; LocalP.out += out_ystride;
+    llvm::Value *In = Builder.CreateLoad(InRowPtr);
+    Builder.CreateStore(Builder.CreateInBoundsGEP(In, InYStride), InRowPtr);
+    llvm::Value *Out = Builder.CreateLoad(OutRowPtr);
+    Builder.CreateStore(Builder.CreateInBoundsGEP(Out, OutYStride), OutRowPtr);
+
+    // LocalP.y++;
+    llvm::Value *YPlusOne = Builder.CreateNUWAdd(
+        Builder.CreateLoad(YPtr), llvm::ConstantInt::get(Int32Ty, 1));
+    Builder.CreateStore(YPlusOne, YPtr);
+
+    // If (LocalP.y < tile_y2) goto Loop; else goto Exit;
+    Cond = Builder.CreateICmpSLT(YPlusOne, TileY2);
+    Builder.CreateCondBr(Cond, Loop, Exit);
+
+    // Exit:
+    Builder.SetInsertPoint(Exit);
+    Builder.CreateRetVoid();
+
+    return true;
+  }
+
+
+public:
+  RSForEachExpandPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
+                      bool pEnableStepOpt, unsigned pTileCacheSize,
+                      unsigned pPrefetchDistance, bool pNonTemporalStore)
+      : ModulePass(ID), M(NULL), C(NULL), mFuncs(pForeachFuncs),
+        mEnableStepOpt(pEnableStepOpt), mTileCacheSize(pTileCacheSize),
+        mPrefetchDistance(pPrefetchDistance),
+        mNonTemporalStore(pNonTemporalStore), mForEachStubPtrTy(NULL) {
+  }
+
+  /* Create a function of the name Name that invokes the ForEach-able function
+   * F in a loop with the appropriate parameters. If ConstStep is true, the
+   * loop steps through the allocations by the size of their element type
+   * instead of the instep/outstep supplied by the driver. Return NULL on error.
+   */
+  llvm::Function *ExpandFunction(llvm::Function *F, uint32_t Signature,
+                                 const llvm::Twine &Name, bool ConstStep) {
+    ALOGV("Expanding ForEach-able Function %s", F->getName().str().c_str());
+
+    llvm::TargetData TD(M);
+
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+    llvm::Type *ForEachStubPtrTy = getForEachStubPtrTy();
+
     /* Create the function signature for our expanded function.
      * void (const RsForEachStubParamStruct *p, uint32_t x1, uint32_t x2,
      *       uint32_t instep, uint32_t outstep)
@@ -223,7 +480,7 @@ public:
     llvm::Function *ExpandedFunc =
         llvm::Function::Create(FT,
                                llvm::GlobalValue::ExternalLinkage,
-                               F->getName() + ".expand", M);
+                               Name, M);
 
     // Create and name the actual arguments to this expanded function.
     llvm::SmallVector<llvm::Argument*, 8> ArgVec;
@@ -237,7 +494,7 @@ public:
     if (ArgVec.size() != 5) {
       ALOGE("Incorrect number of arguments to function: %zu",
             ArgVec.size());
-      return false;
+      return NULL;
     }
     llvm::Value *Arg_p = ArgVec[0];
     llvm::Value *Arg_x1 = ArgVec[1];
@@ -272,7 +529,7 @@ public:
     if (hasIn(Signature)) {
       InTy = Args->getType();
       AIn = Builder.CreateAlloca(InTy, 0, "AIn");
-      InStep = getStepValue(&TD, InTy, Arg_instep);
+      InStep = getStepValue(&TD, InTy, Arg_instep, ConstStep);
       InStep->setName("instep");
       Builder.CreateStore(Builder.CreatePointerCast(Builder.CreateLoad(
           Builder.CreateStructGEP(Arg_p, 0)), InTy), AIn);
@@ -284,7 +541,7 @@ public:
     if (hasOut(Signature)) {
       OutTy = Args->getType();
       AOut = Builder.CreateAlloca(OutTy, 0, "AOut");
-      OutStep = getStepValue(&TD, OutTy, Arg_outstep);
+      OutStep = getStepValue(&TD, OutTy, Arg_outstep, ConstStep);
       OutStep->setName("outstep");
       Builder.CreateStore(Builder.CreatePointerCast(Builder.CreateLoad(
           Builder.CreateStructGEP(Arg_p, 1)), OutTy), AOut);
@@ -330,6 +587,7 @@ public:
 
     if (AIn) {
       InPtr = Builder.CreateLoad(AIn, "InPtr");
+      emitPrefetch(Builder, InPtr, InStep);
       RootArgs.push_back(InPtr);
     }
 
@@ -381,51 +639,21 @@ public:
     Builder.SetInsertPoint(Exit);
     Builder.CreateRetVoid();
 
-    return true;
+    return ExpandedFunc;
   }
 
-  /* Expand a pass-by-value kernel.
+  /* Expand a pass-by-value kernel. See ExpandFunction() for the parameters.
    */
-  bool ExpandKernel(llvm::Function *F, uint32_t Signature) {
+  llvm::Function *ExpandKernel(llvm::Function *F, uint32_t Signature,
+                               const llvm::Twine &Name, bool ConstStep) {
     bccAssert(isKernel(Signature));
     ALOGV("Expanding kernel Function %s", F->getName().str().c_str());
 
     // TODO: Refactor this to share functionality with ExpandFunction.
     llvm::TargetData TD(M);
 
-    llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*C);
     llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
-    llvm::Type *SizeTy = Int32Ty;
-
-    /* Defined in frameworks/base/libs/rs/rs_hal.h:
-     *
-     * struct RsForEachStubParamStruct {
-     *   const void *in;
-     *   void *out;
-     *   const void *usr;
-     *   size_t usr_len;
-     *   uint32_t x;
-     *   uint32_t y;
-     *   uint32_t z;
-     *   uint32_t lod;
-     *   enum RsAllocationCubemapFace face;
-     *   uint32_t ar[16];
-     * };
-     */
-    llvm::SmallVector<llvm::Type*, 9> StructTys;
-    StructTys.push_back(VoidPtrTy);  // const void *in
-    StructTys.push_back(VoidPtrTy);  // void *out
-    StructTys.push_back(VoidPtrTy);  // const void *usr
-    StructTys.push_back(SizeTy);     // size_t usr_len
-    StructTys.push_back(Int32Ty);    // uint32_t x
-    StructTys.push_back(Int32Ty);    // uint32_t y
-    StructTys.push_back(Int32Ty);    // uint32_t z
-    StructTys.push_back(Int32Ty);    // uint32_t lod
-    StructTys.push_back(Int32Ty);    // enum RsAllocationCubemapFace
-    StructTys.push_back(llvm::ArrayType::get(Int32Ty, 16));  // uint32_t ar[16]
-
-    llvm::Type *ForEachStubPtrTy = llvm::StructType::create(
-        StructTys, "RsForEachStubParamStruct")->getPointerTo();
+    llvm::Type *ForEachStubPtrTy = getForEachStubPtrTy();
 
     /* Create the function signature for our expanded function.
      * void (const RsForEachStubParamStruct *p, uint32_t x1, uint32_t x2,
@@ -443,7 +671,7 @@ public:
     llvm::Function *ExpandedFunc =
         llvm::Function::Create(FT,
                                llvm::GlobalValue::ExternalLinkage,
-                               F->getName() + ".expand", M);
+                               Name, M);
 
     // Create and name the actual arguments to this expanded function.
     llvm::SmallVector<llvm::Argument*, 8> ArgVec;
@@ -457,7 +685,7 @@ public:
     if (ArgVec.size() != 5) {
       ALOGE("Incorrect number of arguments to function: %zu",
             ArgVec.size());
-      return false;
+      return NULL;
     }
     llvm::Value *Arg_p = ArgVec[0];
     llvm::Value *Arg_x1 = ArgVec[1];
@@ -501,7 +729,7 @@ public:
         // We don't increment Args, since we are using the actual return type.
       }
       AOut = Builder.CreateAlloca(OutTy, 0, "AOut");
-      OutStep = getStepValue(&TD, OutTy, Arg_outstep);
+      OutStep = getStepValue(&TD, OutTy, Arg_outstep, ConstStep);
       OutStep->setName("outstep");
       Builder.CreateStore(Builder.CreatePointerCast(Builder.CreateLoad(
           Builder.CreateStructGEP(Arg_p, 1)), OutTy), AOut);
@@ -514,7 +742,7 @@ public:
       InBaseTy = Args->getType();
       InTy =InBaseTy->getPointerTo();
       AIn = Builder.CreateAlloca(InTy, 0, "AIn");
-      InStep = getStepValue(&TD, InTy, Arg_instep);
+      InStep = getStepValue(&TD, InTy, Arg_instep, ConstStep);
       InStep->setName("instep");
       Builder.CreateStore(Builder.CreatePointerCast(Builder.CreateLoad(
           Builder.CreateStructGEP(Arg_p, 0)), InTy), AIn);
@@ -560,6 +788,7 @@ public:
 
     if (AIn) {
       InPtr = Builder.CreateLoad(AIn, "InPtr");
+      emitPrefetch(Builder, InPtr, InStep);
       In = Builder.CreateLoad(InPtr, "In");
       RootArgs.push_back(In);
     }
@@ -578,7 +807,7 @@ public:
 
     if (AOut && !PassOutByReference) {
       OutPtr = Builder.CreateLoad(AOut, "OutPtr");
-      Builder.CreateStore(RetVal, OutPtr);
+      markNonTemporal(Builder.CreateStore(RetVal, OutPtr));
     }
 
     if (InPtr) {
@@ -608,6 +837,188 @@ public:
     Builder.SetInsertPoint(Exit);
     Builder.CreateRetVoid();
 
+    return ExpandedFunc;
+  }
+
+  // Find the types of a single input and output cell of the ForEach-able
+  // function F. Either of them is NULL if F doesn't take the corresponding
+  // allocation or only sees it as an untyped (void *) pointer.
+  void getCellTypes(llvm::Function *F, uint32_t Signature,
+                    llvm::Type *&InCellTy, llvm::Type *&OutCellTy) {
+    llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*C);
+    llvm::Function::arg_iterator Args = F->arg_begin();
+
+    InCellTy = NULL;
+    OutCellTy = NULL;
+
+    if (isKernel(Signature)) {
+      if (hasOut(Signature)) {
+        llvm::Type *OutBaseTy = F->getReturnType();
+        if (OutBaseTy->isVoidTy()) {
+          OutBaseTy = Args->getType();
+          Args++;
+          if (OutBaseTy != VoidPtrTy) {
+            OutCellTy = llvm::cast<llvm::PointerType>(OutBaseTy)->
+                getElementType();
+          }
+        } else {
+          OutCellTy = OutBaseTy;
+        }
+      }
+      if (hasIn(Signature)) {
+        InCellTy = Args->getType();
+      }
+    } else {
+      if (hasIn(Signature)) {
+        if (Args->getType() != VoidPtrTy) {
+          InCellTy = llvm::cast<llvm::PointerType>(Args->getType())->
+              getElementType();
+        }
+        Args++;
+      }
+      if (hasOut(Signature)) {
+        if (Args->getType() != VoidPtrTy) {
+          OutCellTy = llvm::cast<llvm::PointerType>(Args->getType())->
+              getElementType();
+        }
+      }
+    }
+    return;
+  }
+
+  llvm::Function *ExpandLoop(llvm::Function *F, uint32_t Signature,
+                             const llvm::Twine &Name, bool ConstStep) {
+    if (isKernel(Signature)) {
+      return ExpandKernel(F, Signature, Name, ConstStep);
+    } else {
+      return ExpandFunction(F, Signature, Name, ConstStep);
+    }
+  }
+
+  /* Create "<NAME>.expand" that dispatches to one of the two loops generated
+   * for F depending on the steps the driver supplies:
+   *
+   *  - Contig ("<NAME>.expand.contig") walks the allocations with a constant
+   *    step of one element, which lets the code generator fold the address
+   *    arithmetic. It's used when instep/outstep equal the size of the cell
+   *    types.
+   *  - General ("<NAME>.expand.strided") honors the runtime instep/outstep
+   *    and handles padded allocations.
+   */
+  llvm::Function *ExpandDispatch(llvm::Function *F, llvm::Function *Contig,
+                                 llvm::Function *General,
+                                 llvm::Type *InCellTy, llvm::Type *OutCellTy) {
+    llvm::TargetData TD(M);
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+
+    llvm::Function *ExpandedFunc =
+        llvm::Function::Create(Contig->getFunctionType(),
+                               llvm::GlobalValue::ExternalLinkage,
+                               F->getName() + ".expand", M);
+
+    llvm::SmallVector<llvm::Value*, 8> ArgVec;
+    for (llvm::Function::arg_iterator B = ExpandedFunc->arg_begin(),
+                                      E = ExpandedFunc->arg_end();
+         B != E;
+         ++B) {
+      ArgVec.push_back(B);
+    }
+    llvm::Value *Arg_p = ArgVec[0];
+    llvm::Value *Arg_instep = ArgVec[3];
+    llvm::Value *Arg_outstep = ArgVec[4];
+
+    Arg_p->setName("p");
+    ArgVec[1]->setName("x1");
+    ArgVec[2]->setName("x2");
+    Arg_instep->setName("arg_instep");
+    Arg_outstep->setName("arg_outstep");
+
+    llvm::BasicBlock *Begin =
+        llvm::BasicBlock::Create(*C, "Begin", ExpandedFunc);
+    llvm::IRBuilder<> Builder(Begin);
+
+    llvm::Value *IsContig = Builder.getTrue();
+
+    if (InCellTy != NULL) {
+      // instep == sizeof(*in)
+      IsContig = Builder.CreateAnd(IsContig, Builder.CreateICmpEQ(
+          Arg_instep,
+          llvm::ConstantInt::get(Int32Ty, TD.getTypeAllocSize(InCellTy))));
+    }
+
+    if (OutCellTy != NULL) {
+      // outstep == sizeof(*out)
+      IsContig = Builder.CreateAnd(IsContig, Builder.CreateICmpEQ(
+          Arg_outstep,
+          llvm::ConstantInt::get(Int32Ty, TD.getTypeAllocSize(OutCellTy))));
+    }
+
+    llvm::BasicBlock *ContigBB =
+        llvm::BasicBlock::Create(*C, "Contig", ExpandedFunc);
+    llvm::BasicBlock *GeneralBB =
+        llvm::BasicBlock::Create(*C, "General", ExpandedFunc);
+    Builder.CreateCondBr(IsContig, ContigBB, GeneralBB);
+
+    Builder.SetInsertPoint(ContigBB);
+    Builder.CreateCall(Contig, ArgVec);
+    Builder.CreateRetVoid();
+
+    Builder.SetInsertPoint(GeneralBB);
+    Builder.CreateCall(General, ArgVec);
+    Builder.CreateRetVoid();
+
+    return ExpandedFunc;
+  }
+
+  /* Expand the ForEach-able function F into "<NAME>.expand" (and, if tiling is
+   * enabled and F accesses neighboring cells, "<NAME>.expand_tile".) With the
+   * step optimization enabled, "<NAME>.expand" is a dispatcher to the
+   * contiguous and the strided loops built for F (see ExpandDispatch().)
+   */
+  bool Expand(llvm::Function *F, uint32_t Signature) {
+    if (!Signature) {
+      Signature = getRootSignature(F);
+      if (!Signature) {
+        // We couldn't determine how to expand this function based on its
+        // function signature.
+        return false;
+      }
+    }
+
+    llvm::Type *InCellTy, *OutCellTy;
+    getCellTypes(F, Signature, InCellTy, OutCellTy);
+
+    llvm::Function *ExpandedFunc = NULL;
+    if (!mEnableStepOpt || ((InCellTy == NULL) && (OutCellTy == NULL))) {
+      // Both of the loops would be the same.
+      ExpandedFunc = ExpandLoop(F, Signature, F->getName() + ".expand",
+                                /* ConstStep */false);
+    } else {
+      llvm::Function *Contig =
+          ExpandLoop(F, Signature, F->getName() + ".expand.contig",
+                     /* ConstStep */true);
+      llvm::Function *General =
+          ExpandLoop(F, Signature, F->getName() + ".expand.strided",
+                     /* ConstStep */false);
+      if ((Contig == NULL) || (General == NULL)) {
+        return false;
+      }
+      Contig->setLinkage(llvm::GlobalValue::InternalLinkage);
+      General->setLinkage(llvm::GlobalValue::InternalLinkage);
+      ExpandedFunc = ExpandDispatch(F, Contig, General, InCellTy, OutCellTy);
+    }
+
+    if (ExpandedFunc == NULL) {
+      return false;
+    }
+
+    if ((mTileCacheSize > 0) && RSForEachHasNeighborAccess(F)) {
+      llvm::TargetData TD(M);
+      ExpandTile(F, ExpandedFunc,
+                 (InCellTy != NULL) ? TD.getTypeAllocSize(InCellTy) : 0,
+                 (OutCellTy != NULL) ? TD.getTypeAllocSize(OutCellTy) : 0);
+    }
+
     return true;
   }
 
@@ -615,6 +1026,7 @@ public:
     bool Changed = false;
     this->M = &M;
     C = &M.getContext();
+    mForEachStubPtrTy = NULL;
 
     for (RSInfo::ExportForeachFuncListTy::const_iterator
              func_iter = mFuncs.begin(), func_end = mFuncs.end();
@@ -622,11 +1034,9 @@ public:
       const char *name = func_iter->first;
       uint32_t signature = func_iter->second;
       llvm::Function *kernel = M.getFunction(name);
-      if (kernel && isKernel(signature)) {
-        Changed |= ExpandKernel(kernel, signature);
-      }
-      else if (kernel && kernel->getReturnType()->isVoidTy()) {
-        Changed |= ExpandFunction(kernel, signature);
+      if (kernel && (isKernel(signature) ||
+                     kernel->getReturnType()->isVoidTy())) {
+        Changed |= Expand(kernel, signature);
       }
     }
 
@@ -645,10 +1055,48 @@ char RSForEachExpandPass::ID = 0;
 
 namespace bcc {
 
+bool RSForEachHasNeighborAccess(llvm::Function *F) {
+  // The passes run before inlining, so follow the calls to the helper
+  // functions defined in the module as well.
+  llvm::SmallPtrSet<llvm::Function *, 16> Visited;
+  llvm::SmallVector<llvm::Function *, 16> Worklist;
+  Visited.insert(F);
+  Worklist.push_back(F);
+
+  while (!Worklist.empty()) {
+    llvm::Function *Func = Worklist.pop_back_val();
+    for (llvm::Function::iterator BB = Func->begin(), BE = Func->end();
+         BB != BE; ++BB) {
+      for (llvm::BasicBlock::iterator I = BB->begin(), IE = BB->end();
+           I != IE; ++I) {
+        llvm::CallInst *Call = llvm::dyn_cast<llvm::CallInst>(I);
+        if (Call == NULL) {
+          continue;
+        }
+        llvm::Function *Callee = Call->getCalledFunction();
+        if (Callee == NULL) {
+          continue;
+        }
+        if (Callee->getName().find("rsGetElementAt") != llvm::StringRef::npos) {
+          return true;
+        }
+        if (!Callee->isDeclaration() && Visited.insert(Callee)) {
+          Worklist.push_back(Callee);
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
 llvm::ModulePass *
 createRSForEachExpandPass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
-                          bool pEnableStepOpt){
-  return new RSForEachExpandPass(pForeachFuncs, pEnableStepOpt);
+                          bool pEnableStepOpt, unsigned pTileCacheSize,
+                          unsigned pPrefetchDistance, bool pNonTemporalStore){
+  return new RSForEachExpandPass(pForeachFuncs, pEnableStepOpt,
+                                 pTileCacheSize, pPrefetchDistance,
+                                 pNonTemporalStore);
 }
 
 } // end namespace bcc
@@ -0,0 +1,386 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <cstring>
+
+#include <llvm/DerivedTypes.h>
+#include <llvm/Function.h>
+#include <llvm/Instructions.h>
+#include <llvm/IRBuilder.h>
+#include <llvm/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Type.h>
+
+#include "bcc/Renderscript/RSInfo.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+// Key of the pragma specifying a group of kernels to fuse, e.g.,
+//
+//   #pragma rs_fuse(brighten, grayscale)
+const char FusePragma[] = "rs_fuse";
+
+/* RSForEachFusePass - This pass fuses a group of pass-by-value kernels which
+ * are launched one after another over allocations of the same dimension, where
+ * each kernel consumes the output of the previous one. For a group
+ * (k1, k2, ..., kn), a function of the name "k1.k2. ... .kn.expand" is created
+ * with the same signature as the ".expand" functions generated by
+ * RSForEachExpandPass. It runs the whole group on each cell in a single loop,
+ * so the intermediate results stay in registers instead of being written to
+ * and read back from memory. Hence only the first kernel of a group may read
+ * neighboring cells (via rsGetElementAt()).
+ */
+class RSForEachFusePass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  llvm::Module *M;
+  llvm::LLVMContext *C;
+
+  const RSInfo::ExportForeachFuncListTy &mFuncs;
+  const std::vector<RSForEachFusionGroupTy> &mGroups;
+
+  static bool hasIn(uint32_t Signature) {
+    return Signature & 0x01;
+  }
+
+  static bool hasOut(uint32_t Signature) {
+    return Signature & 0x02;
+  }
+
+  static bool hasX(uint32_t Signature) {
+    return Signature & 0x08;
+  }
+
+  static bool hasY(uint32_t Signature) {
+    return Signature & 0x10;
+  }
+
+  static bool isKernel(uint32_t Signature) {
+    return Signature & 0x20;
+  }
+
+  // Return the signature of the foreach function pName or 0 if it isn't one.
+  uint32_t getSignature(const char *pName) const {
+    for (RSInfo::ExportForeachFuncListTy::const_iterator
+             func_iter = mFuncs.begin(), func_end = mFuncs.end();
+         func_iter != func_end; func_iter++) {
+      if (::strcmp(func_iter->first, pName) == 0) {
+        return func_iter->second;
+      }
+    }
+    return 0;
+  }
+
+  // Check whether the kernels in pGroup can be fused. On success, Kernels and
+  // Signatures are populated with the kernel functions and their signatures.
+  bool checkGroup(const RSForEachFusionGroupTy &pGroup,
+                  llvm::SmallVectorImpl<llvm::Function *> &Kernels,
+                  llvm::SmallVectorImpl<uint32_t> &Signatures) {
+    llvm::Type *PrevOutTy = NULL;
+
+    for (size_t i = 0, e = pGroup.size(); i != e; i++) {
+      const char *name = pGroup[i].c_str();
+      uint32_t Signature = getSignature(name);
+      llvm::Function *F = M->getFunction(name);
+
+      if ((F == NULL) || !isKernel(Signature)) {
+        ALOGW("Can't fuse %s: not a foreach kernel!", name);
+        return false;
+      }
+
+      // Only kernels returning their output by value can be fused since the
+      // result is passed to the next kernel in a register.
+      if (!hasOut(Signature) || F->getReturnType()->isVoidTy()) {
+        ALOGW("Can't fuse %s: kernel doesn't return its output!", name);
+        return false;
+      }
+
+      if (i > 0) {
+        if (!hasIn(Signature) || F->arg_empty() ||
+            (F->arg_begin()->getType() != PrevOutTy)) {
+          ALOGW("Can't fuse %s: its input doesn't match the output of %s!",
+                name, pGroup[i - 1].c_str());
+          return false;
+        }
+
+        // The intermediate results never reach memory, so a kernel reading
+        // the cells around its input would see stale data.
+        if (RSForEachHasNeighborAccess(F)) {
+          ALOGW("Can't fuse %s: it reads neighboring cells of the output of "
+                "%s!", name, pGroup[i - 1].c_str());
+          return false;
+        }
+      }
+
+      PrevOutTy = F->getReturnType();
+      Kernels.push_back(F);
+      Signatures.push_back(Signature);
+    }
+
+    return true;
+  }
+
+  /* Create the fused loop for a group of compatible kernels.
+   * void (const RsForEachStubParamStruct *p, uint32_t x1, uint32_t x2,
+   *       uint32_t instep, uint32_t outstep)
+   *
+   * The layout of RsForEachStubParamStruct is described in
+   * RSForEachExpand.cpp. Only p->in, p->out and p->y are used here.
+   */
+  bool FuseGroup(const RSForEachFusionGroupTy &pGroup) {
+    llvm::SmallVector<llvm::Function *, 4> Kernels;
+    llvm::SmallVector<uint32_t, 4> Signatures;
+
+    if (pGroup.size() < 2) {
+      ALOGW("Fusion group with less than two kernels is ignored!");
+      return false;
+    }
+
+    if (!checkGroup(pGroup, Kernels, Signatures)) {
+      return false;
+    }
+
+    std::string FusedName = GetRSForEachFusedName(pGroup);
+    if (M->getFunction(FusedName) != NULL) {
+      ALOGW("Kernel group %s has been fused already!", FusedName.c_str());
+      return false;
+    }
+
+    ALOGV("Fusing foreach kernels into %s", FusedName.c_str());
+
+    llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*C);
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*C);
+
+    llvm::SmallVector<llvm::Type*, 16> StructTys;
+    StructTys.push_back(VoidPtrTy);  // const void *in
+    StructTys.push_back(VoidPtrTy);  // void *out
+    StructTys.push_back(VoidPtrTy);  // const void *usr
+    StructTys.push_back(Int32Ty);    // size_t usr_len
+    StructTys.push_back(Int32Ty);    // uint32_t x
+    StructTys.push_back(Int32Ty);    // uint32_t y
+
+    // Only the leading fields of RsForEachStubParamStruct are accessed.
+    llvm::Type *ForEachStubPtrTy = llvm::StructType::create(
+        StructTys, "RsForEachStubParamStruct.head")->getPointerTo();
+
+    llvm::SmallVector<llvm::Type*, 8> ParamTys;
+    ParamTys.push_back(ForEachStubPtrTy);  // const RsForEachStubParamStruct *p
+    ParamTys.push_back(Int32Ty);           // uint32_t x1
+    ParamTys.push_back(Int32Ty);           // uint32_t x2
+    ParamTys.push_back(Int32Ty);           // uint32_t instep
+    ParamTys.push_back(Int32Ty);           // uint32_t outstep
+
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*C), ParamTys, false);
+    llvm::Function *FusedFunc =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                               FusedName, M);
+
+    llvm::Function::arg_iterator Args = FusedFunc->arg_begin();
+    llvm::Value *Arg_p = Args++;
+    llvm::Value *Arg_x1 = Args++;
+    llvm::Value *Arg_x2 = Args++;
+    llvm::Value *Arg_instep = Args++;
+    llvm::Value *Arg_outstep = Args++;
+
+    Arg_p->setName("p");
+    Arg_x1->setName("x1");
+    Arg_x2->setName("x2");
+    Arg_instep->setName("instep");
+    Arg_outstep->setName("outstep");
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "Begin", FusedFunc);
+    llvm::IRBuilder<> Builder(Begin);
+
+    // uint32_t X = x1;
+    llvm::AllocaInst *AX = Builder.CreateAlloca(Int32Ty, 0, "AX");
+    Builder.CreateStore(Arg_x1, AX);
+
+    // The input of the group is the input of the first kernel.
+    llvm::Type *InTy = NULL;
+    llvm::AllocaInst *AIn = NULL;
+    if (hasIn(Signatures[0])) {
+      InTy = Kernels[0]->arg_begin()->getType()->getPointerTo();
+      AIn = Builder.CreateAlloca(InTy, 0, "AIn");
+      Builder.CreateStore(Builder.CreatePointerCast(Builder.CreateLoad(
+          Builder.CreateStructGEP(Arg_p, 0)), InTy), AIn);
+    }
+
+    // The output of the group is the output of the last kernel.
+    llvm::Type *OutTy = Kernels.back()->getReturnType()->getPointerTo();
+    llvm::AllocaInst *AOut = Builder.CreateAlloca(OutTy, 0, "AOut");
+    Builder.CreateStore(Builder.CreatePointerCast(Builder.CreateLoad(
+        Builder.CreateStructGEP(Arg_p, 1)), OutTy), AOut);
+
+    llvm::Value *Y = Builder.CreateLoad(Builder.CreateStructGEP(Arg_p, 5), "Y");
+
+    llvm::BasicBlock *Loop = llvm::BasicBlock::Create(*C, "Loop", FusedFunc);
+    llvm::BasicBlock *Exit = llvm::BasicBlock::Create(*C, "Exit", FusedFunc);
+
+    // if (x1 < x2) goto Loop; else goto Exit;
+    llvm::Value *Cond = Builder.CreateICmpSLT(Arg_x1, Arg_x2);
+    Builder.CreateCondBr(Cond, Loop, Exit);
+
+    // Loop:
+    Builder.SetInsertPoint(Loop);
+
+    llvm::Value *X = Builder.CreateLoad(AX, "X");
+
+    llvm::Value *InPtr = NULL;
+    llvm::Value *Value = NULL;
+    if (AIn) {
+      InPtr = Builder.CreateLoad(AIn, "InPtr");
+      Value = Builder.CreateLoad(InPtr, "In");
+    }
+
+    // Chain the kernels. The value returned from one kernel is the input to
+    // the next one.
+    for (size_t i = 0, e = Kernels.size(); i != e; i++) {
+      llvm::SmallVector<llvm::Value*, 4> KernelArgs;
+      if (hasIn(Signatures[i])) {
+        KernelArgs.push_back(Value);
+      }
+      if (hasX(Signatures[i])) {
+        KernelArgs.push_back(X);
+      }
+      if (hasY(Signatures[i])) {
+        KernelArgs.push_back(Y);
+      }
+      Value = Builder.CreateCall(Kernels[i], KernelArgs);
+    }
+
+    llvm::Value *OutPtr = Builder.CreateLoad(AOut, "OutPtr");
+    Builder.CreateStore(Value, OutPtr);
+
+    if (InPtr) {
+      // InPtr += instep
+      llvm::Value *NewIn = Builder.CreateIntToPtr(Builder.CreateNUWAdd(
+          Builder.CreatePtrToInt(InPtr, Int32Ty), Arg_instep), InTy);
+      Builder.CreateStore(NewIn, AIn);
+    }
+
+    // OutPtr += outstep
+    llvm::Value *NewOut = Builder.CreateIntToPtr(Builder.CreateNUWAdd(
+        Builder.CreatePtrToInt(OutPtr, Int32Ty), Arg_outstep), OutTy);
+    Builder.CreateStore(NewOut, AOut);
+
+    // X++;
+    llvm::Value *XPlusOne =
+        Builder.CreateNUWAdd(X, llvm::ConstantInt::get(Int32Ty, 1));
+    Builder.CreateStore(XPlusOne, AX);
+
+    // If (X < x2) goto Loop; else goto Exit;
+    Cond = Builder.CreateICmpSLT(XPlusOne, Arg_x2);
+    Builder.CreateCondBr(Cond, Loop, Exit);
+
+    // Exit:
+    Builder.SetInsertPoint(Exit);
+    Builder.CreateRetVoid();
+
+    return true;
+  }
+
+public:
+  RSForEachFusePass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
+                    const std::vector<RSForEachFusionGroupTy> &pGroups)
+      : ModulePass(ID), M(NULL), C(NULL), mFuncs(pForeachFuncs),
+        mGroups(pGroups) {
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    bool Changed = false;
+    this->M = &M;
+    C = &M.getContext();
+
+    for (size_t i = 0, e = mGroups.size(); i != e; i++) {
+      Changed |= FuseGroup(mGroups[i]);
+    }
+
+    return Changed;
+  }
+
+  virtual const char *getPassName() const {
+    return "ForEach Kernel Fusion";
+  }
+
+}; // end RSForEachFusePass
+
+} // end anonymous namespace
+
+char RSForEachFusePass::ID = 0;
+
+namespace bcc {
+
+void GetRSForEachFusionGroups(const RSInfo &pInfo,
+                              std::vector<RSForEachFusionGroupTy> &pGroups) {
+  const RSInfo::PragmaListTy &pragmas = pInfo.getPragmas();
+
+  for (RSInfo::PragmaListTy::const_iterator pragma_iter = pragmas.begin(),
+          pragma_end = pragmas.end(); pragma_iter != pragma_end;
+       pragma_iter++) {
+    if (::strcmp(pragma_iter->first, FusePragma) != 0) {
+      continue;
+    }
+
+    // The value is a comma-separated list of kernel names.
+    RSForEachFusionGroupTy group;
+    const char *value = pragma_iter->second;
+    while (*value != '\0') {
+      size_t len = ::strcspn(value, ",");
+      std::string name(value, len);
+
+      // Trim the whitespaces.
+      size_t first = name.find_first_not_of(" \t");
+      size_t last = name.find_last_not_of(" \t");
+      if (first != std::string::npos) {
+        group.push_back(name.substr(first, last - first + 1));
+      }
+
+      value += len;
+      if (*value == ',') {
+        value++;
+      }
+    }
+
+    if (!group.empty()) {
+      pGroups.push_back(group);
+    }
+  }
+
+  return;
+}
+
+std::string GetRSForEachFusedName(const RSForEachFusionGroupTy &pGroup) {
+  std::string name;
+  for (size_t i = 0, e = pGroup.size(); i != e; i++) {
+    name.append(pGroup[i]).append(".");
+  }
+  return name.append("expand");
+}
+
+llvm::ModulePass *
+createRSForEachFusePass(const RSInfo::ExportForeachFuncListTy &pForeachFuncs,
+                        const std::vector<RSForEachFusionGroupTy> &pGroups) {
+  return new RSForEachFusePass(pForeachFuncs, pGroups);
+}
+
+} // end namespace bcc
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <vector>
+
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/IRBuilder.h>
+#include <llvm/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Type.h>
+
+#include "bcc/Renderscript/RSExecutable.h"
+#include "bcc/Support/Log.h"
+
+using namespace bcc;
+
+namespace {
+
+/* RSImportTablePass - This pass makes the script call the external functions
+ * through a table of pointers instead of referencing them directly. Each
+ * external function F becomes an internal, always-inlined function calling
+ * the address in its slot of the table named
+ * RSExecutable::ImportTableSymbolName. The names of the functions are kept in
+ * a NULL-terminated array named RSExecutable::ImportNameTableSymbolName.
+ *
+ * The Renderscript runtime functions are only available via the symbol
+ * resolvers of libbcc, which the dynamic linker doesn't know. With this pass,
+ * the script can be linked into a shared object. RSExecutable fills the table
+ * once the object is loaded.
+ */
+class RSImportTablePass : public llvm::ModulePass {
+private:
+  static char ID;
+
+  llvm::Module *M;
+  llvm::LLVMContext *C;
+
+  // Return true if calls to F should go through the table.
+  static bool isImported(const llvm::Function &F) {
+    // The variadic arguments can't be forwarded.
+    return (F.isDeclaration() && (F.getIntrinsicID() == 0) &&
+            !F.isVarArg() && !F.use_empty());
+  }
+
+  // Give F a body which calls the address in the slot pSlot of pTable.
+  void ImportFunction(llvm::Function *F, llvm::GlobalVariable *pTable,
+                      unsigned pSlot) {
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*C, "entry", F);
+    llvm::IRBuilder<> Builder(Begin);
+
+    llvm::Value *Slot = Builder.CreateConstInBoundsGEP2_32(pTable, 0, pSlot);
+    llvm::Value *Callee = Builder.CreatePointerCast(Builder.CreateLoad(Slot),
+                                                    F->getType());
+
+    std::vector<llvm::Value *> Args;
+    for (llvm::Function::arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+         AI != AE; AI++) {
+      Args.push_back(AI);
+    }
+
+    llvm::CallInst *Call = Builder.CreateCall(Callee, Args);
+    Call->setCallingConv(F->getCallingConv());
+    Call->setAttributes(F->getAttributes());
+    Call->setTailCall();
+
+    if (F->getReturnType()->isVoidTy()) {
+      Builder.CreateRetVoid();
+    } else {
+      Builder.CreateRet(Call);
+    }
+
+    // F reads its slot now.
+    if (F->doesNotAccessMemory()) {
+      F->removeFnAttr(llvm::Attribute::ReadNone);
+      F->addFnAttr(llvm::Attribute::ReadOnly);
+    }
+    F->setLinkage(llvm::GlobalValue::InternalLinkage);
+    F->addFnAttr(llvm::Attribute::AlwaysInline);
+    return;
+  }
+
+public:
+  RSImportTablePass() : ModulePass(ID), M(NULL), C(NULL) {
+  }
+
+  virtual bool runOnModule(llvm::Module &M) {
+    this->M = &M;
+    C = &M.getContext();
+
+    std::vector<llvm::Function *> Imports;
+    for (llvm::Module::iterator FI = M.begin(), FE = M.end(); FI != FE; FI++) {
+      if (isImported(*FI)) {
+        Imports.push_back(FI);
+      }
+    }
+
+    llvm::PointerType *Int8PtrTy = llvm::Type::getInt8PtrTy(*C);
+
+    // The table is filled at load time.
+    llvm::ArrayType *TableTy = llvm::ArrayType::get(Int8PtrTy, Imports.size());
+    llvm::GlobalVariable *Table =
+        new llvm::GlobalVariable(M, TableTy, /* isConstant */false,
+                                 llvm::GlobalValue::ExternalLinkage,
+                                 llvm::ConstantAggregateZero::get(TableTy),
+                                 RSExecutable::ImportTableSymbolName);
+
+    std::vector<llvm::Constant *> Names;
+    llvm::Constant *Zero =
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(*C), 0);
+    llvm::Constant *Idxs[] = { Zero, Zero };
+    for (size_t i = 0, e = Imports.size(); i != e; i++) {
+      llvm::Constant *Name =
+          llvm::ConstantDataArray::getString(*C, Imports[i]->getName());
+      llvm::GlobalVariable *NameVar =
+          new llvm::GlobalVariable(M, Name->getType(), /* isConstant */true,
+                                   llvm::GlobalValue::PrivateLinkage, Name,
+                                   ".rs.import_name");
+      Names.push_back(
+          llvm::ConstantExpr::getInBoundsGetElementPtr(NameVar, Idxs));
+    }
+    Names.push_back(llvm::ConstantPointerNull::get(Int8PtrTy));
+
+    llvm::ArrayType *NameTableTy = llvm::ArrayType::get(Int8PtrTy,
+                                                        Names.size());
+    new llvm::GlobalVariable(M, NameTableTy, /* isConstant */true,
+                             llvm::GlobalValue::ExternalLinkage,
+                             llvm::ConstantArray::get(NameTableTy, Names),
+                             RSExecutable::ImportNameTableSymbolName);
+
+    for (size_t i = 0, e = Imports.size(); i != e; i++) {
+      ImportFunction(Imports[i], Table, i);
+    }
+
+    return true;
+  }
+
+  virtual const char *getPassName() const {
+    return "Renderscript Import Table";
+  }
+
+}; // end RSImportTablePass
+
+} // end anonymous namespace
+
+char RSImportTablePass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *createRSImportTablePass() {
+  return new RSImportTablePass();
+}
+
+} // end namespace bcc
@@ -26,6 +26,7 @@
 #include "bcc/Support/Log.h"
 
 #include <cutils/properties.h>
+#include <utils/FileMap.h>
 
 using namespace bcc;
 
@@ -180,7 +181,7 @@ bool RSInfo::CheckDependency(const RSInfo &pInfo,
   return true;
 }
 
-RSInfo::RSInfo(size_t pStringPoolSize) : mStringPool(NULL) {
+RSInfo::RSInfo(size_t pStringPoolSize) : mStringPool(NULL), mFileMap(NULL) {
   ::memset(&mHeader, 0, sizeof(mHeader));
 
   ::memcpy(mHeader.magic, RSINFO_MAGIC, sizeof(mHeader.magic));
@@ -194,6 +195,7 @@ RSInfo::RSInfo(size_t pStringPoolSize) : mStringPool(NULL) {
   mHeader.exportVarNameList.itemSize = sizeof(rsinfo::ExportVarNameItem);
   mHeader.exportFuncNameList.itemSize = sizeof(rsinfo::ExportFuncNameItem);
   mHeader.exportForeachFuncList.itemSize = sizeof(rsinfo::ExportForeachFuncItem);
+  mHeader.symbolLocationList.itemSize = sizeof(rsinfo::SymbolLocationItem);
 
   if (pStringPoolSize > 0) {
     mHeader.strPoolSize = pStringPoolSize;
@@ -206,7 +208,11 @@ RSInfo::RSInfo(size_t pStringPoolSize) : mStringPool(NULL) {
 }
 
 RSInfo::~RSInfo() {
-  delete [] mStringPool;
+  if (mFileMap != NULL) {
+    mFileMap->release();
+  } else {
+    delete [] mStringPool;
+  }
 }
 
 bool RSInfo::layout(off_t initial_offset) {
@@ -230,6 +236,9 @@ bool RSInfo::layout(off_t initial_offset) {
 
   mHeader.exportForeachFuncList.offset = AFTER(mHeader.exportFuncNameList);
   mHeader.exportForeachFuncList.count = mExportForeachFuncs.size();
+
+  mHeader.symbolLocationList.offset = AFTER(mHeader.exportForeachFuncList);
+  mHeader.symbolLocationList.count = mSymbolLocations.size();
 #undef AFTER
 
   return true;
@@ -289,6 +298,13 @@ void RSInfo::dump() const {
     ALOGV("name: %s, signature: %05x", foreach_iter->first,
                                        foreach_iter->second);
   }
+
+  DUMP_LIST_HEADER("RS symbol locations", mHeader.symbolLocationList);
+  for (SymbolLocationListTy::const_iterator
+          loc_iter = mSymbolLocations.begin(),
+          loc_end = mSymbolLocations.end(); loc_iter != loc_end; loc_iter++) {
+    ALOGV("section: %u, offset: %u", loc_iter->first, loc_iter->second);
+  }
 #undef DUMP_LIST_HEADER
 
 #endif // LOG_NDEBUG
@@ -152,6 +152,17 @@ helper_read_list_item<rsinfo::ExportForeachFuncItem, RSInfo::ExportForeachFuncLi
   return true;
 }
 
+// Procee SymbolLocationItem in the file
+template<> inline bool
+helper_read_list_item<rsinfo::SymbolLocationItem, RSInfo::SymbolLocationListTy>(
+    const rsinfo::SymbolLocationItem &pItem,
+    const RSInfo &pInfo,
+    RSInfo::SymbolLocationListTy &pResult)
+{
+  pResult.push(std::make_pair(pItem.section, pItem.offset));
+  return true;
+}
+
 template<typename ItemType, typename ItemContainer>
 inline bool helper_read_list(const uint8_t *pData,
                              const RSInfo &pInfo,
@@ -159,6 +170,9 @@ inline bool helper_read_list(const uint8_t *pData,
                              ItemContainer &pResult) {
   const ItemType *item;
 
+  // Avoid growing the container item by item.
+  pResult.setCapacity(pResult.size() + pHeader.count);
+
   // Out-of-range exception has been checked.
   for (uint32_t i = 0; i < pHeader.count; i++) {
     item = reinterpret_cast<const ItemType *>(pData +
@@ -173,46 +187,23 @@ inline bool helper_read_list(const uint8_t *pData,
 
 } // end anonymous namespace
 
-RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps) {
-  android::FileMap *map = NULL;
+RSInfo *RSInfo::Read(const uint8_t *pData, size_t pSize, const char *pName,
+                     const DependencyTableTy &pDeps, android::FileMap *pMap) {
   RSInfo *result = NULL;
-  const uint8_t *data;
   const rsinfo::Header *header;
-  size_t filesize;
-  const char *input_filename = pInput.getName().c_str();
-  const off_t cur_input_offset = pInput.tell();
-
-  if (pInput.hasError()) {
-    ALOGE("Invalid RS info file %s! (%s)", input_filename,
-                                           pInput.getErrorMessage().c_str());
-    goto bail;
-  }
 
-  filesize = pInput.getSize();
-  if (pInput.hasError()) {
-    ALOGE("Failed to get the size of RS info file %s! (%s)",
-          input_filename, pInput.getErrorMessage().c_str());
+  if (pSize < sizeof(rsinfo::Header)) {
+    ALOGV("RS info %s is too small. Treat it as a dirty cache.", pName);
     goto bail;
   }
 
-  // Create memory map for the file.
-  map = pInput.createMap(/* pOffset */cur_input_offset,
-                         /* pLength */filesize - cur_input_offset);
-  if (map == NULL) {
-    ALOGE("Failed to map RS info file %s to the memory! (%s)",
-          input_filename, pInput.getErrorMessage().c_str());
-    goto bail;
-  }
-
-  data = reinterpret_cast<const uint8_t *>(map->getDataPtr());
-
   // Header starts at the beginning of the file.
-  header = reinterpret_cast<const rsinfo::Header *>(data);
+  header = reinterpret_cast<const rsinfo::Header *>(pData);
 
   // Check the magic.
   if (::memcmp(header->magic, RSINFO_MAGIC, sizeof(header->magic)) != 0) {
     ALOGV("Wrong magic found in the RS info file %s. Treat it as a dirty "
-          "cache.", input_filename);
+          "cache.", pName);
     goto bail;
   }
 
@@ -221,7 +212,7 @@ RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps)
                RSINFO_VERSION,
                sizeof((header->version)) != 0)) {
     ALOGV("Mismatch the version of RS info file %s: (current) %s v.s. (file) "
-          "%s. Treat it as as a dirty cache.", input_filename, RSINFO_VERSION,
+          "%s. Treat it as as a dirty cache.", pName, RSINFO_VERSION,
           header->version);
     goto bail;
   }
@@ -233,98 +224,159 @@ RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps)
       (header->objectSlotList.itemSize != sizeof(rsinfo::ObjectSlotItem)) ||
       (header->exportVarNameList.itemSize != sizeof(rsinfo::ExportVarNameItem)) ||
       (header->exportFuncNameList.itemSize != sizeof(rsinfo::ExportFuncNameItem)) ||
-      (header->exportForeachFuncList.itemSize != sizeof(rsinfo::ExportForeachFuncItem))) {
-    ALOGW("Corrupted RS info file %s! (unexpected size found)", input_filename);
+      (header->exportForeachFuncList.itemSize != sizeof(rsinfo::ExportForeachFuncItem)) ||
+      (header->symbolLocationList.itemSize != sizeof(rsinfo::SymbolLocationItem))) {
+    ALOGW("Corrupted RS info file %s! (unexpected size found)", pName);
     goto bail;
   }
 
   // Check the range.
 #define LIST_DATA_RANGE(_list_header) \
   ((_list_header).offset + (_list_header).count * (_list_header).itemSize)
-  if (((header->headerSize + header->strPoolSize) > filesize) ||
-      (LIST_DATA_RANGE(header->dependencyTable) > filesize) ||
-      (LIST_DATA_RANGE(header->pragmaList) > filesize) ||
-      (LIST_DATA_RANGE(header->objectSlotList) > filesize) ||
-      (LIST_DATA_RANGE(header->exportVarNameList) > filesize) ||
-      (LIST_DATA_RANGE(header->exportFuncNameList) > filesize) ||
-      (LIST_DATA_RANGE(header->exportForeachFuncList) > filesize)) {
-    ALOGW("Corrupted RS info file %s! (data out of the range)", input_filename);
+  if (((header->headerSize + header->strPoolSize) > pSize) ||
+      (LIST_DATA_RANGE(header->dependencyTable) > pSize) ||
+      (LIST_DATA_RANGE(header->pragmaList) > pSize) ||
+      (LIST_DATA_RANGE(header->objectSlotList) > pSize) ||
+      (LIST_DATA_RANGE(header->exportVarNameList) > pSize) ||
+      (LIST_DATA_RANGE(header->exportFuncNameList) > pSize) ||
+      (LIST_DATA_RANGE(header->exportForeachFuncList) > pSize) ||
+      (LIST_DATA_RANGE(header->symbolLocationList) > pSize)) {
+    ALOGW("Corrupted RS info file %s! (data out of the range)", pName);
     goto bail;
   }
 #undef LIST_DATA_RANGE
 
-  // File seems ok, create result RSInfo object.
-  result = new (std::nothrow) RSInfo(header->strPoolSize);
-  if (result == NULL) {
-    ALOGE("Out of memory when create RSInfo object for %s!", input_filename);
+  // Every string in the pool must be terminated within the pool. Then no
+  // string served from the pool can run past it.
+  if ((header->strPoolSize > 0) &&
+      (pData[header->headerSize + header->strPoolSize - 1] != '\0')) {
+    ALOGW("Corrupted RS info file %s! (unterminated string pool)", pName);
     goto bail;
   }
 
-  // Make advice on our access pattern.
-  map->advise(android::FileMap::SEQUENTIAL);
+  // File seems ok, create result RSInfo object. The string pool is allocated
+  // only if it's going to be copied.
+  result = new (std::nothrow) RSInfo((pMap != NULL) ? 0 : header->strPoolSize);
+  if (result == NULL) {
+    ALOGE("Out of memory when create RSInfo object for %s!", pName);
+    goto bail;
+  }
 
-  // Copy the header.
+  // Copy the header. It may be modified (e.g., by setThreadable().)
   ::memcpy(&result->mHeader, header, sizeof(rsinfo::Header));
 
-  if (header->strPoolSize > 0) {
-    // Copy the string pool. The string pool is immediately after the header at
-    // the offset header->headerSize.
+  // The string pool is immediately after the header at the offset
+  // header->headerSize.
+  if (pMap != NULL) {
+    // Use the string pool in place. The mapping lives with result.
+    if (header->strPoolSize > 0) {
+      result->mStringPool =
+          const_cast<char *>(reinterpret_cast<const char *>(pData) +
+                             header->headerSize);
+    }
+    result->mFileMap = pMap;
+    pMap = NULL;
+  } else if (header->strPoolSize > 0) {
     if (result->mStringPool == NULL) {
       ALOGE("Out of memory when allocate string pool for RS info file %s!",
-            input_filename);
+            pName);
       goto bail;
     }
-    ::memcpy(result->mStringPool, data + result->mHeader.headerSize,
-             result->mHeader.strPoolSize);
+    ::memcpy(result->mStringPool, pData + header->headerSize,
+             header->strPoolSize);
   }
 
   // Populate all the data to the result object.
   if (!helper_read_list<rsinfo::DependencyTableItem, DependencyTableTy>
-        (data, *result, header->dependencyTable, result->mDependencyTable)) {
+        (pData, *result, header->dependencyTable, result->mDependencyTable)) {
     goto bail;
   }
 
   // Check dependency to see whether the cache is dirty or not.
-  if (!CheckDependency(*result, pInput.getName().c_str(), pDeps)) {
+  if (!CheckDependency(*result, pName, pDeps)) {
     goto bail;
   }
 
   if (!helper_read_list<rsinfo::PragmaItem, PragmaListTy>
-        (data, *result, header->pragmaList, result->mPragmas)) {
+        (pData, *result, header->pragmaList, result->mPragmas)) {
     goto bail;
   }
 
   if (!helper_read_list<rsinfo::ObjectSlotItem, ObjectSlotListTy>
-        (data, *result, header->objectSlotList, result->mObjectSlots)) {
+        (pData, *result, header->objectSlotList, result->mObjectSlots)) {
     goto bail;
   }
 
   if (!helper_read_list<rsinfo::ExportVarNameItem, ExportVarNameListTy>
-        (data, *result, header->exportVarNameList, result->mExportVarNames)) {
+        (pData, *result, header->exportVarNameList, result->mExportVarNames)) {
     goto bail;
   }
 
   if (!helper_read_list<rsinfo::ExportFuncNameItem, ExportFuncNameListTy>
-        (data, *result, header->exportFuncNameList, result->mExportFuncNames)) {
+        (pData, *result, header->exportFuncNameList, result->mExportFuncNames)) {
     goto bail;
   }
 
   if (!helper_read_list<rsinfo::ExportForeachFuncItem, ExportForeachFuncListTy>
-        (data, *result, header->exportForeachFuncList, result->mExportForeachFuncs)) {
+        (pData, *result, header->exportForeachFuncList, result->mExportForeachFuncs)) {
     goto bail;
   }
 
-  // Clean up.
-  map->release();
+  if (!helper_read_list<rsinfo::SymbolLocationItem, SymbolLocationListTy>
+        (pData, *result, header->symbolLocationList, result->mSymbolLocations)) {
+    goto bail;
+  }
 
   return result;
 
 bail:
-  if (map != NULL) {
-    map->release();
+  if (pMap != NULL) {
+    pMap->release();
   }
 
   delete result;
 
   return NULL;
+} // RSInfo::Read
+
+RSInfo *RSInfo::ReadFromFile(InputFile &pInput, const DependencyTableTy &pDeps) {
+  android::FileMap *map = NULL;
+  size_t filesize;
+  const char *input_filename = pInput.getName().c_str();
+  const off_t cur_input_offset = pInput.tell();
+
+  if (pInput.hasError()) {
+    ALOGE("Invalid RS info file %s! (%s)", input_filename,
+                                           pInput.getErrorMessage().c_str());
+    return NULL;
+  }
+
+  filesize = pInput.getSize();
+  if (pInput.hasError()) {
+    ALOGE("Failed to get the size of RS info file %s! (%s)",
+          input_filename, pInput.getErrorMessage().c_str());
+    return NULL;
+  }
+
+  // Create memory map for the file.
+  map = pInput.createMap(/* pOffset */cur_input_offset,
+                         /* pLength */filesize - cur_input_offset);
+  if (map == NULL) {
+    ALOGE("Failed to map RS info file %s to the memory! (%s)",
+          input_filename, pInput.getErrorMessage().c_str());
+    return NULL;
+  }
+
+  // Make advice on our access pattern. The whole file is going to be read.
+  map->advise(android::FileMap::WILLNEED);
+
+  // The mapping is owned by Read() from now on.
+  return Read(reinterpret_cast<const uint8_t *>(map->getDataPtr()),
+              filesize - cur_input_offset, input_filename, pDeps, map);
 } // RSInfo::ReadFromFile
+
+RSInfo *RSInfo::ReadFromBuffer(const uint8_t *pData, size_t pSize,
+                               const char *pName,
+                               const DependencyTableTy &pDeps) {
+  return Read(pData, pSize, pName, pDeps, /* pMap */NULL);
+} // RSInfo::ReadFromBuffer
@@ -135,6 +135,17 @@ helper_adapt_list_item<rsinfo::ExportForeachFuncItem,
   return true;
 }
 
+template<> inline bool
+helper_adapt_list_item<rsinfo::SymbolLocationItem,
+                       RSInfo::SymbolLocationListTy>(
+    rsinfo::SymbolLocationItem &pResult,
+    const RSInfo &pInfo,
+    const RSInfo::SymbolLocationListTy::const_iterator &pItem) {
+  pResult.section = pItem->first;
+  pResult.offset = pItem->second;
+  return true;
+}
+
 template<typename ItemType, typename ItemContainer>
 inline bool helper_write_list(OutputFile &pOutput,
                               const RSInfo &pInfo,
@@ -230,5 +241,11 @@ bool RSInfo::write(OutputFile &pOutput) {
     return false;
   }
 
+  // Write symbolLocationList.
+  if (!helper_write_list<rsinfo::SymbolLocationItem, SymbolLocationListTy>
+        (pOutput, *this, mHeader.symbolLocationList, mSymbolLocations)) {
+    return false;
+  }
+
   return true;
 }
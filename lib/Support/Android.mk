@@ -29,6 +29,7 @@ libbcc_support_SRC_FILES := \
   InputFile.cpp \
   LinkerConfig.cpp \
   OutputFile.cpp \
+  Properties.cpp \
   Sha1Util.cpp \
   TargetCompilerConfigs.cpp \
   TargetLinkerConfigs.cpp
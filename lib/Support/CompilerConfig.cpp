@@ -63,6 +63,12 @@ CompilerConfig::CompilerConfig(const std::string &pTriple)
   //===--------------------------------------------------------------------===//
   mOptLevel = llvm::CodeGenOpt::Default;
 
+  //===--------------------------------------------------------------------===//
+  // Default setting for generated loops (no prefetch, regular stores)
+  //===--------------------------------------------------------------------===//
+  mPrefetchDistance = 0;
+  mNonTemporalStore = false;
+
   //===--------------------------------------------------------------------===//
   // Default setting for architecture type
   //===--------------------------------------------------------------------===//
@@ -241,6 +241,15 @@ size_t FileBase::getSize() {
   return file_stat.st_size;
 }
 
+int FileBase::duplicateFD() {
+  if (mFD < 0) {
+    return -1;
+  }
+
+  // A failure here (e.g., out of descriptors) doesn't affect this file.
+  return ::dup(mFD);
+}
+
 off_t FileBase::seek(off_t pOffset) {
   if ((mFD < 0) || hasError()) {
     return static_cast<off_t>(-1);
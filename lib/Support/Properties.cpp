@@ -0,0 +1,28 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/Properties.h"
+
+#include <cstring>
+
+#include <cutils/properties.h>
+
+bool bcc::IsPropertyEnabled(const char *pName) {
+  char buf[PROPERTY_VALUE_MAX];
+
+  property_get(pName, buf, "0");
+  return ((::strcmp(buf, "1") == 0) || (::strcmp(buf, "true") == 0));
+}
@@ -19,7 +19,18 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include <fcntl.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "bcc/Config/Config.h"
 #include "bcc/Support/Initialization.h"
@@ -36,7 +47,14 @@ static void usage() {
                   "            [--triple triple]\n"
                   "            [--android-sysroot sysroot]\n"
 #endif
-                  "            input_filename(s) or input_fd(s)...\n");
+                  "            [--cache-dir cache_dir]\n"
+                  "            input_filename(s) or input_fd(s)...\n"
+                  "       abcc --daemon socket_path\n"
+#ifndef TARGET_BUILD
+                  "            [--android-sysroot sysroot]\n"
+#endif
+                  "            [--cache-dir cache_dir]\n"
+                  );
   return;
 }
 
@@ -58,8 +76,10 @@ enum Mode {
 };
 
 static inline bool ParseArguments(int argc, const char *const *argv, Mode &mode,
-                                  const char *&input, const char *&output,
-                                  const char *&triple, const char *&sysroot) {
+                                  std::vector<const char *> &inputs,
+                                  const char *&output,
+                                  const char *&triple, const char *&sysroot,
+                                  const char *&cache_dir) {
   if (argc < 4) {
     return false;
   }
@@ -101,6 +121,16 @@ static inline bool ParseArguments(int argc, const char *const *argv, Mode &mode,
   }
 #endif
 
+  if (::strcmp(argv[arg_idx], "--cache-dir") == 0) {
+    if ((arg_idx + 2 /* --cache-dir [cache_dir] input */) >= argc) {
+      ALOGE("Too few arguments when --cache-dir was given!");
+      return false;
+    }
+
+    cache_dir = argv[arg_idx + 1];
+    arg_idx += 2;
+  }
+
   if (triple == NULL) {
     triple = DEFAULT_TARGET_TRIPLE_STRING;
   }
@@ -111,15 +141,17 @@ static inline bool ParseArguments(int argc, const char *const *argv, Mode &mode,
 
   ALOGD("Triple: %s, Android sysroot: %s", triple, sysroot);
 
-  // input is in argv[arg_idx]
-  // TODO: Support multiple input files.
-  input = argv[arg_idx];
+  // inputs are in argv[arg_idx...]
+  for (; arg_idx < argc; arg_idx++) {
+    inputs.push_back(argv[arg_idx]);
+  }
 
   return true;
 }
 
-static bool Build(int input_fd, int output_fd,
-                  const char *triple, const char *sysroot) {
+static bool Build(const std::vector<int> &input_fds, int output_fd,
+                  const char *triple, const char *sysroot,
+                  const char *cache_dir) {
   ABCCompilerDriver *driver = ABCCompilerDriver::Create(triple);
 
   if (driver == NULL) {
@@ -127,39 +159,58 @@ static bool Build(int input_fd, int output_fd,
   }
 
   driver->setAndroidSysroot(sysroot);
+  if (cache_dir != NULL) {
+    driver->setCacheDir(cache_dir);
+  }
 
-  bool build_result = driver->build(input_fd, output_fd);;
+  bool build_result = driver->build(input_fds, output_fd);
 
   delete driver;
 
   return build_result;
 }
 
-static int ProcessFromFd(const char *input, const char *output,
-                         const char *triple, const char *sysroot) {
-  int output_fd, input_fd;
+static int ProcessFromFd(const std::vector<const char *> &inputs,
+                         const char *output,
+                         const char *triple, const char *sysroot,
+                         const char *cache_dir) {
+  int output_fd;
+  std::vector<int> input_fds;
 
   if (!GetIntArg(output, output_fd)) {
     ALOGE("Bad output fd '%s'", output);
     return EXIT_FAILURE;
   }
 
-  if (!GetIntArg(input, input_fd)) {
-    ALOGE("Bad input fd '%s'", input);
-    return EXIT_FAILURE;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    int input_fd;
+    if (!GetIntArg(inputs[i], input_fd)) {
+      ALOGE("Bad input fd '%s'", inputs[i]);
+      return EXIT_FAILURE;
+    }
+    input_fds.push_back(input_fd);
   }
 
-  if (!Build(input_fd, output_fd, triple, sysroot)) {
+  if (!Build(input_fds, output_fd, triple, sysroot, cache_dir)) {
     return EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
 }
 
-static int ProcessFromFile(const char *input, const char *output,
-                           const char *triple, const char *sysroot) {
-  // TODO: Support multiple input files.
-  int output_fd = -1, input_fd = -1;
+static void CloseFds(const std::vector<int> &fds) {
+  for (size_t i = 0; i < fds.size(); i++) {
+    ::close(fds[i]);
+  }
+  return;
+}
+
+static int ProcessFromFile(const std::vector<const char *> &inputs,
+                           const char *output,
+                           const char *triple, const char *sysroot,
+                           const char *cache_dir) {
+  int output_fd = -1;
+  std::vector<int> input_fds;
 
   // Open the output file.
   output_fd = ::open(output, O_RDWR | O_CREAT | O_TRUNC, 0755);
@@ -169,30 +220,271 @@ static int ProcessFromFile(const char *input, const char *output,
     return EXIT_FAILURE;
   }
 
-  // Open the input file.
-  input_fd = ::open(input, O_RDONLY);
+  // Open the input files.
+  for (size_t i = 0; i < inputs.size(); i++) {
+    int input_fd = ::open(inputs[i], O_RDONLY);
 
-  if (input_fd < 0) {
-    ALOGE("Failed to open %s for input! (%s)", input, strerror(errno));
-    ::close(output_fd);
-    return EXIT_FAILURE;
+    if (input_fd < 0) {
+      ALOGE("Failed to open %s for input! (%s)", inputs[i], strerror(errno));
+      ::close(output_fd);
+      CloseFds(input_fds);
+      return EXIT_FAILURE;
+    }
+    input_fds.push_back(input_fd);
   }
 
-  if (!Build(input_fd, output_fd, triple, sysroot)) {
+  if (!Build(input_fds, output_fd, triple, sysroot, cache_dir)) {
     ::close(output_fd);
-    ::close(input_fd);
+    CloseFds(input_fds);
     return EXIT_FAILURE;
   }
 
   ::close(output_fd);
-  ::close(input_fd);
+  CloseFds(input_fds);
 
   return EXIT_SUCCESS;
 }
 
+//===----------------------------------------------------------------------===//
+// Daemon mode
+//===----------------------------------------------------------------------===//
+// abcc --daemon socket_path listens on the Unix domain socket socket_path
+// (SOCK_SEQPACKET) and serves the build requests one at a time. The drivers,
+// and so their configured compilers and the system objects they've read, are
+// kept across the requests. Only the processes of the same user (or root) may
+// connect.
+//
+// A request is one message whose data is the NUL-terminated target triple
+// (empty for the default one) and which carries the output fd followed by the
+// input fd(s) in SCM_RIGHTS. The reply is a 32-bit status, 0 on success.
+//
+// A client which doesn't send its request or read the reply within
+// kDaemonTimeout seconds is dropped. The timeout only covers the socket, so
+// all the fds must refer to regular files. A pipe which is never written to
+// would block the build, and the requests of all the other clients with it.
+
+static const size_t kMaxDaemonFds = 32;
+static const size_t kMaxTripleLength = 128;
+static const int kDaemonTimeout = 10;
+
+typedef std::map<std::string, ABCCompilerDriver *> DriverMap;
+
+static ABCCompilerDriver *GetDaemonDriver(DriverMap &drivers,
+                                          const char *triple,
+                                          const char *sysroot,
+                                          const char *cache_dir) {
+  DriverMap::iterator it = drivers.find(triple);
+  if (it != drivers.end()) {
+    return it->second;
+  }
+
+  ABCCompilerDriver *driver = ABCCompilerDriver::Create(triple);
+  if (driver == NULL) {
+    return NULL;
+  }
+
+  driver->setAndroidSysroot(sysroot);
+  if (cache_dir != NULL) {
+    driver->setCacheDir(cache_dir);
+  }
+  drivers[triple] = driver;
+  return driver;
+}
+
+// Return true if the peer of conn runs as the same user as the daemon or as
+// root.
+static bool CheckPeer(int conn) {
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
+  if (::getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0) {
+    ALOGE("Failed to get the credentials of the client! (%s)",
+          strerror(errno));
+    return false;
+  }
+
+  if ((cred.uid != 0) && (cred.uid != ::getuid())) {
+    ALOGW("Reject the request from uid %u (pid %d)!",
+          static_cast<unsigned>(cred.uid), static_cast<int>(cred.pid));
+    return false;
+  }
+
+  return true;
+}
+
+static bool SetTimeout(int conn) {
+  struct timeval timeout;
+  timeout.tv_sec = kDaemonTimeout;
+  timeout.tv_usec = 0;
+  if ((::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof(timeout)) != 0) ||
+      (::setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                    sizeof(timeout)) != 0)) {
+    ALOGE("Failed to set the timeout of the connection! (%s)",
+          strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+// Return true if all of pFds refer to regular files, which can't block the
+// daemon on read() or write().
+static bool CheckRegularFds(const std::vector<int> &pFds) {
+  for (size_t i = 0, e = pFds.size(); i != e; i++) {
+    struct stat fd_stat;
+    if (::fstat(pFds[i], &fd_stat) != 0) {
+      ALOGE("Failed to stat file descriptor `%d' of the request! (%s)",
+            pFds[i], strerror(errno));
+      return false;
+    }
+    if (!S_ISREG(fd_stat.st_mode)) {
+      ALOGE("File descriptor `%d' of the request is not a regular file!",
+            pFds[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ServeRequest(int conn, DriverMap &drivers, const char *sysroot,
+                         const char *cache_dir) {
+  char triple[kMaxTripleLength + 1];
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * kMaxDaemonFds)];
+  } control;
+
+  struct iovec iov;
+  iov.iov_base = triple;
+  iov.iov_len = kMaxTripleLength;
+
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  ssize_t size;
+  do {
+    size = ::recvmsg(conn, &msg, 0);
+  } while ((size < 0) && (errno == EINTR));
+
+  if (size < 0) {
+    ALOGE("Failed to receive the request! (%s)", strerror(errno));
+    return false;
+  }
+  triple[size] = '\0';
+
+  std::vector<int> fds;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+      const int *data = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+      size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      fds.insert(fds.end(), data, data + num_fds);
+    }
+  }
+
+  bool result = false;
+  if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+    ALOGE("The request is too large!");
+  } else if (fds.size() < 2) {
+    ALOGE("The request must carry the output fd and the input fd(s)!");
+  } else if (CheckRegularFds(fds)) {
+#ifdef TARGET_BUILD
+    // On-device version cannot configure the triple.
+    triple[0] = '\0';
+#endif
+    if (triple[0] == '\0') {
+      ::strcpy(triple, DEFAULT_TARGET_TRIPLE_STRING);
+    }
+
+    ABCCompilerDriver *driver = GetDaemonDriver(drivers, triple, sysroot,
+                                                cache_dir);
+    if (driver != NULL) {
+      std::vector<int> input_fds(fds.begin() + 1, fds.end());
+      result = driver->build(input_fds, fds[0]);
+    }
+  }
+
+  for (size_t i = 0; i < fds.size(); i++) {
+    ::close(fds[i]);
+  }
+
+  int32_t status = result ? 0 : 1;
+  if (::send(conn, &status, sizeof(status), 0) != sizeof(status)) {
+    ALOGW("Failed to reply to the request! (%s)", strerror(errno));
+  }
+
+  return result;
+}
+
+static int RunDaemon(const char *socket_path, const char *sysroot,
+                     const char *cache_dir) {
+  struct sockaddr_un addr;
+  if (::strlen(socket_path) >= sizeof(addr.sun_path)) {
+    ALOGE("Socket path %s is too long!", socket_path);
+    return EXIT_FAILURE;
+  }
+
+  // The clients may go away before the reply.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  int sock = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (sock < 0) {
+    ALOGE("Failed to create the socket! (%s)", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  ::strcpy(addr.sun_path, socket_path);
+
+  // Nobody can connect before listen(), so restrict the socket to its owner
+  // in between.
+  ::unlink(socket_path);
+  if ((::bind(sock, reinterpret_cast<struct sockaddr *>(&addr),
+              sizeof(addr)) != 0) ||
+      (::chmod(socket_path, S_IRUSR | S_IWUSR) != 0) ||
+      (::listen(sock, 8) != 0)) {
+    ALOGE("Failed to listen on %s! (%s)", socket_path, strerror(errno));
+    ::close(sock);
+    return EXIT_FAILURE;
+  }
+
+  ALOGI("Listening on %s", socket_path);
+
+  DriverMap drivers;
+  while (true) {
+    int conn = ::accept(sock, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ALOGE("Failed to accept the request! (%s)", strerror(errno));
+      break;
+    }
+
+    if (CheckPeer(conn) && SetTimeout(conn)) {
+      ServeRequest(conn, drivers, sysroot, cache_dir);
+    }
+    ::close(conn);
+  }
+
+  for (DriverMap::iterator it = drivers.begin(), e = drivers.end(); it != e;
+       ++it) {
+    delete it->second;
+  }
+  ::close(sock);
+  ::unlink(socket_path);
+
+  return EXIT_FAILURE;
+}
+
 int main(int argc, char **argv) {
   Mode mode = kUnknownMode;
-  const char *input, *output, *triple = NULL, *sysroot = NULL;
+  std::vector<const char *> inputs;
+  const char *output, *triple = NULL, *sysroot = NULL, *cache_dir = NULL;
 
   set_process_name("abcc");
 
@@ -200,13 +492,41 @@ int main(int argc, char **argv) {
 
   init::Initialize();
 
-  if (ParseArguments(argc, argv, mode, input, output, triple, sysroot)) {
+  if ((argc >= 3) && (::strcmp(argv[1], "--daemon") == 0)) {
+    const char *daemon_sysroot = "/";
+    int arg_idx = 3;
+    for (; arg_idx + 1 < argc; arg_idx += 2) {
+#ifndef TARGET_BUILD
+      if (::strcmp(argv[arg_idx], "--android-sysroot") == 0) {
+        daemon_sysroot = argv[arg_idx + 1];
+        continue;
+      }
+#endif
+      if (::strcmp(argv[arg_idx], "--cache-dir") == 0) {
+        cache_dir = argv[arg_idx + 1];
+        continue;
+      }
+      break;
+    }
+
+    if (arg_idx == argc) {
+      return RunDaemon(argv[2], daemon_sysroot, cache_dir);
+    }
+
+    ALOGE("Unknown option or missing value '%s' in daemon mode!",
+          argv[arg_idx]);
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  if (ParseArguments(argc, argv, mode, inputs, output, triple, sysroot,
+                     cache_dir)) {
     switch (mode) {
       case kFdMode: {
-        return ProcessFromFd(input, output, triple, sysroot);
+        return ProcessFromFd(inputs, output, triple, sysroot, cache_dir);
       }
       case kFileMode: {
-        return ProcessFromFile(input, output, triple, sysroot);
+        return ProcessFromFile(inputs, output, triple, sysroot, cache_dir);
       }
       default: {
         // Unknown mode encountered. Fall-through to print usage and return
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2012, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/system_error.h>
+
+#include <bcc/BCCContext.h>
+#include <bcc/Renderscript/RSCompilerDriver.h>
+#include <bcc/Renderscript/RSExecutable.h>
+#include <bcc/Renderscript/RSForEachExecutor.h>
+#include <bcc/Support/Initialization.h>
+
+using namespace bcc;
+
+//===----------------------------------------------------------------------===//
+// Options
+//===----------------------------------------------------------------------===//
+namespace {
+
+llvm::cl::opt<std::string>
+OptInputFilename(llvm::cl::Positional, llvm::cl::Required,
+                 llvm::cl::desc("<input bitcode file>"));
+
+#ifdef TARGET_BUILD
+#define DEFAULT_CACHE_DIR "/data/local/tmp"
+#else
+#define DEFAULT_CACHE_DIR "/tmp"
+#endif
+
+llvm::cl::opt<std::string>
+OptCacheDir("cache-dir", llvm::cl::desc("Directory to hold the compiled script "
+                                        "(default: " DEFAULT_CACHE_DIR ")"),
+            llvm::cl::init(DEFAULT_CACHE_DIR), llvm::cl::value_desc("dir"));
+
+llvm::cl::opt<unsigned>
+OptSlot("slot", llvm::cl::desc("Slot of the foreach function to run "
+                               "(default: 0)"),
+        llvm::cl::init(0));
+
+llvm::cl::opt<unsigned>
+OptDimX("x", llvm::cl::desc("Dimension X of the allocations (default: 1024)"),
+        llvm::cl::init(1024));
+
+llvm::cl::opt<unsigned>
+OptDimY("y", llvm::cl::desc("Dimension Y of the allocations (default: 1024)"),
+        llvm::cl::init(1024));
+
+llvm::cl::opt<unsigned>
+OptInSize("in-size", llvm::cl::desc("Size of an input cell in bytes, 0 for no "
+                                    "input allocation (default: 4)"),
+          llvm::cl::init(4));
+
+llvm::cl::opt<unsigned>
+OptOutSize("out-size", llvm::cl::desc("Size of an output cell in bytes, 0 for "
+                                      "no output allocation (default: 4)"),
+           llvm::cl::init(4));
+
+llvm::cl::opt<unsigned>
+OptThreads("threads", llvm::cl::desc("Maximum number of threads (default: "
+                                     "number of online CPUs)"),
+           llvm::cl::init(0));
+
+llvm::cl::opt<unsigned>
+OptChunk("chunk", llvm::cl::desc("Number of cells in a unit of work (default: "
+                                 "whole rows)"),
+         llvm::cl::init(0));
+
+llvm::cl::opt<std::string>
+OptRuntime("runtime", llvm::cl::desc("Shared library providing the "
+                                     "Renderscript runtime functions the "
+                                     "script calls (default: the ones loaded "
+                                     "in the process)"),
+           llvm::cl::value_desc("lib"));
+
+llvm::cl::opt<unsigned>
+OptIterations("iterations", llvm::cl::desc("Number of launches to measure for "
+                                           "each thread count (default: 10)"),
+              llvm::cl::init(10));
+
+} // end anonymous namespace
+
+// Resolve the calls to the Renderscript runtime from the library given by
+// --runtime (pContext), or from the ones loaded in the process.
+static void *LookupRuntime(void *pContext, const char *pName) {
+  return ::dlsym((pContext != NULL) ? pContext : RTLD_DEFAULT, pName);
+}
+
+static bool Measure(const RSExecutable &pExecutable, unsigned pNumThreads,
+                    const RSForEachExecutor::Launch &pLaunch,
+                    double &pElementsPerSecond, unsigned &pNumSteals) {
+  RSForEachExecutor executor(pNumThreads, OptChunk);
+  if (executor.hasError()) {
+    llvm::errs() << "Failed to start " << pNumThreads << " threads!\n";
+    return false;
+  }
+
+  RSForEachExecutor::Stats stats;
+
+  // Warm up the caches and the threads.
+  if (!executor.run(pExecutable, OptSlot, pLaunch, &stats)) {
+    return false;
+  }
+
+  uint64_t elements = 0, elapsed = 0;
+  pNumSteals = 0;
+  for (unsigned i = 0; i < OptIterations; i++) {
+    if (!executor.run(pExecutable, OptSlot, pLaunch, &stats)) {
+      return false;
+    }
+    elements += stats.numElements;
+    elapsed += stats.elapsedNs;
+    pNumSteals += stats.numSteals;
+  }
+
+  pElementsPerSecond = (elapsed == 0) ? 0.0 :
+      (static_cast<double>(elements) * 1.0e9 / elapsed);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+  init::Initialize();
+
+  llvm::OwningPtr<llvm::MemoryBuffer> bitcode;
+  llvm::error_code ec = llvm::MemoryBuffer::getFile(OptInputFilename, bitcode);
+  if (ec) {
+    llvm::errs() << "Failed to read `" << OptInputFilename << "'! (detail: "
+                 << ec.message() << ")\n";
+    return EXIT_FAILURE;
+  }
+
+  void *runtime = NULL;
+  if (!OptRuntime.empty()) {
+    runtime = ::dlopen(OptRuntime.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (runtime == NULL) {
+      llvm::errs() << "Failed to load runtime `" << OptRuntime << "'! ("
+                   << ::dlerror() << ")\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  BCCContext context;
+  RSCompilerDriver driver;
+  driver.setRSRuntimeLookupFunction(LookupRuntime);
+  driver.setRSRuntimeLookupContext(runtime);
+  std::string res_name = llvm::sys::path::stem(OptInputFilename);
+
+  RSExecutable *executable = driver.build(context, OptCacheDir.c_str(),
+                                          res_name.c_str(),
+                                          bitcode->getBufferStart(),
+                                          bitcode->getBufferSize());
+  if (executable == NULL) {
+    llvm::errs() << "Failed to build `" << OptInputFilename << "'!\n";
+    return EXIT_FAILURE;
+  }
+
+  unsigned max_threads = OptThreads;
+  if (max_threads == 0) {
+    long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+    max_threads = (cpus > 0) ? static_cast<unsigned>(cpus) : 1;
+  }
+
+  // Prepare the allocations.
+  RSForEachExecutor::Launch launch;
+  ::memset(&launch, 0, sizeof(launch));
+  launch.dimX = OptDimX;
+  launch.dimY = OptDimY;
+  launch.inStep = OptInSize;
+  launch.outStep = OptOutSize;
+  launch.inYStride = OptInSize * OptDimX;
+  launch.outYStride = OptOutSize * OptDimX;
+
+  size_t num_cells = static_cast<size_t>(OptDimX) * OptDimY;
+  void *in = NULL, *out = NULL;
+  if (OptInSize > 0) {
+    in = ::malloc(num_cells * OptInSize);
+    if (in != NULL) {
+      ::memset(in, 0x5a, num_cells * OptInSize);
+    }
+  }
+  if (OptOutSize > 0) {
+    out = ::calloc(num_cells, OptOutSize);
+  }
+  if (((OptInSize > 0) && (in == NULL)) || ((OptOutSize > 0) && (out == NULL))) {
+    llvm::errs() << "Out of memory when allocate " << OptDimX << "x" << OptDimY
+                 << " cells!\n";
+    ::free(in);
+    ::free(out);
+    delete executable;
+    return EXIT_FAILURE;
+  }
+  launch.in = in;
+  launch.out = out;
+
+  llvm::outs() << "Script: " << OptInputFilename << " (foreach slot #"
+               << OptSlot << ", "
+               << (executable->isThreadable() ? "threadable" : "not threadable")
+               << ")\n"
+               << "Launch: " << OptDimX << "x" << OptDimY << ", "
+               << OptIterations << " iterations\n\n"
+               << "threads  elements/s       speedup  efficiency  steals\n";
+
+  // Scaling curve, from one thread up to max_threads.
+  int result = EXIT_SUCCESS;
+  double base = 0.0;
+  for (unsigned threads = 1; threads <= max_threads; threads++) {
+    double elements_per_sec;
+    unsigned steals;
+    if (!Measure(*executable, threads, launch, elements_per_sec, steals)) {
+      result = EXIT_FAILURE;
+      break;
+    }
+    if (threads == 1) {
+      base = elements_per_sec;
+    }
+    double speedup = (base > 0.0) ? (elements_per_sec / base) : 0.0;
+
+    llvm::outs() << llvm::format("%7u  %15.0f  %7.2f  %9.1f%%  %6u\n", threads,
+                                 elements_per_sec, speedup,
+                                 speedup * 100.0 / threads, steals);
+
+    if (!executable->isThreadable()) {
+      // The executor always uses one thread for such scripts.
+      break;
+    }
+  }
+
+  ::free(in);
+  ::free(out);
+  delete executable;
+  if (runtime != NULL) {
+    ::dlclose(runtime);
+  }
+
+  return result;
+}